@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "nn_kernels.h"
+
+/**
+* @file check_kernels.c
+* @author Gianluca D'Amico
+* @brief Tool checking the kernels of the neural network
+*
+* HANDLING MODEL KERNELS: It runs the kernels of nn_kernels.c selected at
+* compile time on random inputs and compares them with their scalar _ref
+* version or with a plain C loop, within the tolerances stated in
+* nn_kernels.h. One line is printed for each kernel with its max error.
+*
+* Usage: check_kernels
+*
+* The exit status is 0 if every kernel is within its tolerance, 1 otherwise.
+* make check-kernels builds and runs it with the flags of the application,
+* add -DNN_KERNELS_SCALAR or -mno-avx to ARCH_FLAGS to check the other
+* kernel sets of the host.
+*
+*/
+
+#define MAX_N       1024    /**< Max length of the vectors. */
+#define ROWS        32      /**< Rows of the matrices, a multiple of 4. */
+#define BATCH       7       /**< Inputs of the batch kernels. */
+#define EXP_TOL     1.5e-7  /**< Relative error of vector_exp. */
+#define LOGIST_TOL  1e-7    /**< Absolute error of vector_logistic. */
+#define SOFTMAX_TOL 5e-7    /**< Absolute error of vector_softmax. */
+#define FRAME_SIDE  240     /**< Side of the random gray frames. */
+#define DIM         28      /**< Side of the downsampled images. */
+
+/**< Lengths of the vectors, with and without a tail for the vector loops. */
+static const int lengths[] = { 1, 3, 7, 8, 15, 16, 17, 31, 33, 64, 100,
+                                                        257, 512, 784, 1024 };
+#define NUM_LENGTHS ((int) (sizeof(lengths) / sizeof(lengths[0])))
+
+static unsigned int seed = 1;   /**< Fixed seed, repeatable inputs. */
+static int failures;            /**< Kernels out of their tolerance. */
+
+/**
+* @brief Random float in [lo, hi].
+*/
+static float uniform(float lo, float hi) {
+    return lo + (hi - lo) * ((float) rand_r(&seed) / RAND_MAX);
+}
+
+/**
+* @brief Fill a vector with random floats in [lo, hi].
+*/
+static void fill(float* x, int n, float lo, float hi) {
+
+    int j;
+
+    for (j = 0; j < n; ++j)
+        x[j] = uniform(lo, hi);
+}
+
+/**
+* @brief Fill a vector with random int8 in [-127, 127].
+*/
+static void fill_i8(signed char* x, int n) {
+
+    int j;
+
+    for (j = 0; j < n; ++j)
+        x[j] = (signed char) (rand_r(&seed) % 255 - 127);
+}
+
+/**
+* @brief Print the result of the check of a kernel.
+*
+* @param  name is the name of the kernel
+* @param  max_error is the max error found
+* @param  worst is the max ratio between an error and its tolerance
+*/
+static void report(const char* name, double max_error, double worst) {
+
+    printf("%-20s max error %-10.3g %s\n", name, max_error,
+                                                (worst <= 1) ? "ok" : "FAIL");
+    if (worst > 1)
+        failures++;
+}
+
+/**
+* @brief Tolerance of a dot product of n terms, see nn_kernels.h.
+*
+* @param  abs_sum is the sum of the absolute products
+* @param  n is the number of terms
+* @param  value is the reference result, with its bias
+* @return the max difference from the reference
+*/
+static double dot_tolerance(double abs_sum, int n, double value) {
+    return 2.0 * n * FLT_EPSILON * abs_sum + FLT_EPSILON * fabs(value) +
+                                                                    FLT_MIN;
+}
+
+/**
+* @brief Reference weighted sums of a float sinapsi and their tolerance.
+*
+* @param  w are the rows x cols weights, rows stored back to back
+* @param  bias is the bias of each row
+* @param  x is the input vector
+* @param  z is filled with the reference weighted sums
+* @param  tol is filled with the tolerance of each row
+* @param  rows is the number of rows
+* @param  cols is the number of columns
+*/
+static void weighted_ref(const float* w, const float* bias, const float* x,
+                        float* z, double* tol, int rows, int cols) {
+    int i, j;
+    double abs_sum;
+
+    gemv_ref(w, bias, x, z, rows, cols);
+
+    for (i = 0; i < rows; ++i) {
+        abs_sum = fabs(bias[i]);
+        for (j = 0; j < cols; ++j)
+            abs_sum += fabs(w[i * cols + j] * x[j]);
+        tol[i] = dot_tolerance(abs_sum, cols, z[i]);
+    }
+}
+
+/**
+* @brief Compare the outputs of a kernel with the reference ones.
+*
+* @param  z is the output of the kernel
+* @param  ref is the reference output
+* @param  tol is the tolerance of each output
+* @param  n is the number of outputs
+* @param  max_error is updated with the max error
+* @param  worst is updated with the max ratio of an error to its tolerance
+*/
+static void compare(const float* z, const float* ref, const double* tol,
+                                    int n, double* max_error, double* worst) {
+    int i;
+    double error;
+
+    for (i = 0; i < n; ++i) {
+        error = fabs((double) z[i] - ref[i]);
+        if (error > *max_error)
+            *max_error = error;
+        if (error / tol[i] > *worst)
+            *worst = error / tol[i];
+    }
+}
+
+/**
+* @brief Check dot_product against dot_product_ref.
+*/
+static void check_dot_product() {
+
+    int j, k, n;
+    float a[MAX_N], b[MAX_N];
+    float ref;
+    double abs_sum, error;
+    double max_error = 0, worst = 0;
+
+    for (k = 0; k < NUM_LENGTHS; ++k) {
+        n = lengths[k];
+        fill(a, n, -1, 1);
+        fill(b, n, -1, 1);
+
+        ref = dot_product_ref(a, b, n);
+        abs_sum = 0;
+        for (j = 0; j < n; ++j)
+            abs_sum += fabs(a[j] * b[j]);
+
+        error = fabs((double) dot_product(a, b, n) - ref);
+        if (error > max_error)
+            max_error = error;
+        if (error / dot_tolerance(abs_sum, n, ref) > worst)
+            worst = error / dot_tolerance(abs_sum, n, ref);
+    }
+
+    report("dot_product", max_error, worst);
+}
+
+/**
+* @brief Check gemv and gemm against gemv_ref.
+*/
+static void check_gemv() {
+
+    int b, k, n;
+    static float w[ROWS * MAX_N], x[BATCH * MAX_N];
+    float bias[ROWS], z[BATCH * ROWS], ref[BATCH * ROWS];
+    double tol[BATCH * ROWS];
+    double max_gemv = 0, worst_gemv = 0, max_gemm = 0, worst_gemm = 0;
+
+    for (k = 0; k < NUM_LENGTHS; ++k) {
+        n = lengths[k];
+        fill(w, ROWS * n, -1, 1);
+        fill(bias, ROWS, -1, 1);
+        fill(x, BATCH * n, 0, 1);
+
+        for (b = 0; b < BATCH; ++b)
+            weighted_ref(w, bias, x + b * n, ref + b * ROWS, tol + b * ROWS,
+                                                                    ROWS, n);
+
+        gemv(w, bias, x, z, ROWS, n);
+        compare(z, ref, tol, ROWS, &max_gemv, &worst_gemv);
+
+        gemm(w, bias, x, z, ROWS, n, BATCH);
+        compare(z, ref, tol, BATCH * ROWS, &max_gemm, &worst_gemm);
+    }
+
+    report("gemv", max_gemv, worst_gemv);
+    report("gemm", max_gemm, worst_gemm);
+}
+
+/**
+* @brief Check a gemv specialized on the number of columns.
+*
+* @param  name is the name of the kernel
+* @param  gemv_fn is the kernel
+* @param  cols is its number of columns
+*/
+static void check_gemv_fixed(const char* name, void (*gemv_fn)(const float*,
+                        const float*, const float*, float*, int), int cols) {
+    static float w[ROWS * MAX_N];
+    float x[MAX_N], bias[ROWS], z[ROWS], ref[ROWS];
+    double tol[ROWS];
+    double max_error = 0, worst = 0;
+
+    fill(w, ROWS * cols, -1, 1);
+    fill(bias, ROWS, -1, 1);
+    fill(x, cols, 0, 1);
+
+    weighted_ref(w, bias, x, ref, tol, ROWS, cols);
+    gemv_fn(w, bias, x, z, ROWS);
+    compare(z, ref, tol, ROWS, &max_error, &worst);
+
+    report(name, max_error, worst);
+}
+
+/**
+* @brief Check gemv_panels and gemm_panels against gemv_ref.
+*/
+static void check_panels() {
+
+    int b, n;
+    static float w[ROWS * MAX_N], panels[ROWS * MAX_N], x[BATCH * MAX_N];
+    float bias[ROWS], z[BATCH * ROWS], ref[BATCH * ROWS];
+    double tol[BATCH * ROWS];
+    double max_gemv = 0, worst_gemv = 0, max_gemm = 0, worst_gemm = 0;
+
+    for (n = NN_PANEL_COLS; n <= MAX_N; n *= 2) {
+        fill(w, ROWS * n, -1, 1);
+        fill(bias, ROWS, -1, 1);
+        fill(x, BATCH * n, 0, 1);
+        pack_panels(w, panels, ROWS, n);
+
+        for (b = 0; b < BATCH; ++b)
+            weighted_ref(w, bias, x + b * n, ref + b * ROWS, tol + b * ROWS,
+                                                                    ROWS, n);
+
+        gemv_panels(panels, bias, x, z, ROWS, n);
+        compare(z, ref, tol, ROWS, &max_gemv, &worst_gemv);
+
+        gemm_panels(panels, bias, x, z, ROWS, n, BATCH);
+        compare(z, ref, tol, BATCH * ROWS, &max_gemm, &worst_gemm);
+    }
+
+    report("gemv_panels", max_gemv, worst_gemv);
+    report("gemm_panels", max_gemm, worst_gemm);
+}
+
+/**
+* @brief Check the element-wise float kernels against a plain loop.
+*
+* vector_add and vector_sub are exact, axpy can round a * x[j] + y[j] once
+* instead of twice.
+*/
+static void check_elementwise() {
+
+    int j, k, n;
+    float a, x[MAX_N], y[MAX_N], add[MAX_N], sub[MAX_N], scaled[MAX_N];
+    double error, max_add = 0, max_axpy = 0, worst_axpy = 0;
+
+    for (k = 0; k < NUM_LENGTHS; ++k) {
+        n = lengths[k];
+        a = uniform(-1, 1);
+        fill(x, n, -1, 1);
+        fill(y, n, -1, 1);
+
+        memcpy(add, y, n * sizeof(float));
+        memcpy(sub, y, n * sizeof(float));
+        memcpy(scaled, y, n * sizeof(float));
+        vector_add(x, add, n);
+        vector_sub(x, sub, n);
+        axpy(a, x, scaled, n);
+
+        for (j = 0; j < n; ++j) {
+            error = fabs((double) add[j] - (y[j] + x[j])) +
+                                        fabs((double) sub[j] - (y[j] - x[j]));
+            if (error > max_add)
+                max_add = error;
+
+            error = fabs((double) scaled[j] - ((double) a * x[j] + y[j]));
+            if (error > max_axpy)
+                max_axpy = error;
+            error /= 2 * FLT_EPSILON * (fabs(a * x[j]) + fabs(y[j])) +
+                                                                    FLT_MIN;
+            if (error > worst_axpy)
+                worst_axpy = error;
+        }
+    }
+
+    report("vector_add/sub", max_add, (max_add == 0) ? 0 : 2);
+    report("axpy", max_axpy, worst_axpy);
+}
+
+/**
+* @brief Check the int8 kernels against a plain loop.
+*
+* The int32 sums are exact, gemv_i8 and gemm_i8 round only their
+* dequantization.
+*/
+static void check_i8() {
+
+    int i, j, b, k, n, sum;
+    static signed char w[ROWS * MAX_N], x[BATCH * MAX_N];
+    float scale[ROWS], x_scale[BATCH], bias[ROWS];
+    float z[BATCH * ROWS], ref[BATCH * ROWS];
+    double tol[BATCH * ROWS];
+    int y[MAX_N], add[MAX_N], sub[MAX_N];
+    double max_error = 0, worst = 0;
+    int dot_errors = 0, add_errors = 0;
+
+    for (k = 0; k < NUM_LENGTHS; ++k) {
+        n = lengths[k];
+        fill_i8(w, ROWS * n);
+        fill_i8(x, BATCH * n);
+        fill(scale, ROWS, 0.001f, 0.01f);
+        fill(x_scale, BATCH, 0.001f, 0.01f);
+        fill(bias, ROWS, -1, 1);
+
+        for (b = 0; b < BATCH; ++b)
+            for (i = 0; i < ROWS; ++i) {
+                sum = 0;
+                for (j = 0; j < n; ++j)
+                    sum += w[i * n + j] * x[b * n + j];
+
+                dot_errors += (dot_product_i8(w + i * n, x + b * n, n) !=
+                                                                        sum);
+
+                ref[b * ROWS + i] = (double) sum * scale[i] * x_scale[b] +
+                                                                    bias[i];
+                tol[b * ROWS + i] = 4 * FLT_EPSILON * (fabs((double) sum *
+                                scale[i] * x_scale[b]) + fabs(bias[i])) +
+                                                                    FLT_MIN;
+            }
+
+        gemv_i8(w, scale, bias, x, x_scale[0], z, ROWS, n);
+        compare(z, ref, tol, ROWS, &max_error, &worst);
+
+        gemm_i8(w, scale, bias, x, x_scale, z, ROWS, n, BATCH);
+        compare(z, ref, tol, BATCH * ROWS, &max_error, &worst);
+
+        for (j = 0; j < n; ++j)
+            y[j] = add[j] = sub[j] = rand_r(&seed) % 100000 - 50000;
+        vector_add_i8(x, add, n);
+        vector_sub_i8(x, sub, n);
+        for (j = 0; j < n; ++j)
+            add_errors += (add[j] != y[j] + x[j]) || (sub[j] != y[j] - x[j]);
+    }
+
+    report("dot_product_i8", dot_errors, dot_errors ? 2 : 0);
+    report("gemv_i8/gemm_i8", max_error, worst);
+    report("vector_add/sub_i8", add_errors, add_errors ? 2 : 0);
+}
+
+/**
+* @brief Check the fp16 conversions and kernels against a plain loop.
+*
+* Every finite half is converted to float and back unchanged, the products
+* of the fp16 kernels have the tolerance of the float ones.
+*/
+static void check_f16() {
+
+    int i, j, b, k, n;
+    unsigned int h;
+    static unsigned short w[ROWS * MAX_N];
+    static float wf[ROWS * MAX_N], x[BATCH * MAX_N];
+    float bias[ROWS], z[BATCH * ROWS], ref[BATCH * ROWS];
+    double tol[BATCH * ROWS];
+    float y[MAX_N], add[MAX_N], sub[MAX_N];
+    double max_error = 0, worst = 0, max_add = 0;
+    int conversion_errors = 0;
+
+    for (h = 0; h < 0x10000; ++h)
+        if ((h & 0x7C00) != 0x7C00 &&
+                        float_to_half(half_to_float((unsigned short) h)) != h)
+            conversion_errors++;
+
+    report("float_to_half", conversion_errors, conversion_errors ? 2 : 0);
+
+    for (k = 0; k < NUM_LENGTHS; ++k) {
+        n = lengths[k];
+        for (j = 0; j < ROWS * n; ++j) {
+            w[j] = float_to_half(uniform(-1, 1));
+            wf[j] = half_to_float(w[j]);
+        }
+        fill(bias, ROWS, -1, 1);
+        fill(x, BATCH * n, 0, 1);
+
+        for (b = 0; b < BATCH; ++b)
+            weighted_ref(wf, bias, x + b * n, ref + b * ROWS, tol + b * ROWS,
+                                                                    ROWS, n);
+
+        gemv_f16(w, bias, x, z, ROWS, n);
+        compare(z, ref, tol, ROWS, &max_error, &worst);
+
+        gemm_f16(w, bias, x, z, ROWS, n, BATCH);
+        compare(z, ref, tol, BATCH * ROWS, &max_error, &worst);
+
+        for (i = 0; i < ROWS; ++i) {
+            z[i] = dot_product_f16(w + i * n, x, n) + bias[i];
+            compare(z + i, ref + i, tol + i, 1, &max_error, &worst);
+        }
+
+        fill(y, n, -1, 1);
+        memcpy(add, y, n * sizeof(float));
+        memcpy(sub, y, n * sizeof(float));
+        vector_add_f16(w, add, n);
+        vector_sub_f16(w, sub, n);
+        for (j = 0; j < n; ++j)
+            max_add += fabs((double) add[j] - (y[j] + wf[j])) +
+                                        fabs((double) sub[j] - (y[j] - wf[j]));
+    }
+
+    report("dot/gemv/gemm_f16", max_error, worst);
+    report("vector_add/sub_f16", max_add, (max_add == 0) ? 0 : 2);
+}
+
+/**
+* @brief Check the fast activations against the exp of libm.
+*/
+static void check_activations() {
+
+    int j, k, n;
+    float z[MAX_N], y[MAX_N], ref[MAX_N];
+    double error, max_exp = 0, max_logistic = 0, max_softmax = 0;
+
+    for (j = 0; j < MAX_N; ++j)
+        z[j] = -87 + 175.0f * j / (MAX_N - 1);
+
+    vector_exp(z, y, MAX_N);
+    for (j = 0; j < MAX_N; ++j) {
+        error = fabs(y[j] - exp((double) z[j])) / exp((double) z[j]);
+        if (error > max_exp)
+            max_exp = error;
+    }
+    report("vector_exp", max_exp, max_exp / EXP_TOL);
+
+    for (k = 0; k < NUM_LENGTHS; ++k) {
+        n = lengths[k];
+
+        fill(z, n, -20, 20);
+        vector_logistic(z, y, n);
+        vector_logistic_ref(z, ref, n);
+        for (j = 0; j < n; ++j)
+            if (fabs(y[j] - ref[j]) > max_logistic)
+                max_logistic = fabs(y[j] - ref[j]);
+
+        fill(z, n, -30, 30);
+        vector_softmax(z, y, n);
+        vector_softmax_ref(z, ref, n);
+        for (j = 0; j < n; ++j)
+            if (fabs(y[j] - ref[j]) > max_softmax)
+                max_softmax = fabs(y[j] - ref[j]);
+    }
+
+    report("vector_logistic", max_logistic, max_logistic / LOGIST_TOL);
+    report("vector_softmax", max_softmax, max_softmax / SOFTMAX_TOL);
+}
+
+/**
+* @brief Check downsample_binarize against the plain area average.
+*
+* The sides 2, 4 and 8 times DIM take the vectorized kernels, the others
+* the portable loop. The result must be exact.
+*/
+static void check_downsample() {
+
+    int i, u, v, x, y, k, size;
+    int x0, x1, y0, y1;
+    unsigned int sum;
+    static unsigned char frame[FRAME_SIDE * (FRAME_SIDE + 8)];
+    unsigned char dst[DIM * DIM];
+    const int sizes[] = { DIM, 2 * DIM, 3 * DIM, 4 * DIM, 5 * DIM + 3,
+                                                    8 * DIM, FRAME_SIDE };
+    int errors = 0;
+
+    for (i = 0; i < (int) sizeof(frame); ++i)
+        frame[i] = rand_r(&seed) % 256;
+
+    for (k = 0; k < (int) (sizeof(sizes) / sizeof(sizes[0])); ++k) {
+        size = sizes[k];
+        downsample_binarize(frame + 3, FRAME_SIDE + 8, size, DIM, 128, dst,
+                                                                    1, DIM);
+
+        for (v = 0; v < DIM; ++v) {
+            y0 = v * size / DIM;
+            y1 = (y0 == (v + 1) * size / DIM) ? y0 + 1 : (v + 1) * size / DIM;
+
+            for (u = 0; u < DIM; ++u) {
+                x0 = u * size / DIM;
+                x1 = (x0 == (u + 1) * size / DIM) ? x0 + 1 :
+                                                        (u + 1) * size / DIM;
+                sum = 0;
+                for (y = y0; y < y1; ++y)
+                    for (x = x0; x < x1; ++x)
+                        sum += frame[3 + y * (FRAME_SIDE + 8) + x];
+
+                errors += dst[v + u * DIM] !=
+                                (sum < 128u * (x1 - x0) * (y1 - y0));
+            }
+        }
+    }
+
+    report("downsample_binarize", errors, errors ? 2 : 0);
+}
+
+/**< Check of each gemv_c<cols>. */
+#define CHECK_GEMV_FIXED(COLS)                                              \
+    check_gemv_fixed("gemv_c" #COLS, gemv_c##COLS, COLS);
+
+int main() {
+
+    printf("%s kernels\n", kernel_name());
+
+    check_dot_product();
+    check_gemv();
+    NN_FIXED_COLS(CHECK_GEMV_FIXED)
+    check_panels();
+    check_elementwise();
+    check_i8();
+    check_f16();
+    check_activations();
+    check_downsample();
+
+    if (failures > 0) {
+        printf("%d kernels out of tolerance!\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -94,6 +94,8 @@
 #define INIT_SATURATION 0
 #define INIT_SHARPNESS  0
 
+#define BINARY_THRESHOLD 120    /**< Gray level from which a pixel is white. */
+
 /**
 * NEURAL NETWORK CONSTANTS
 */
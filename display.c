@@ -335,6 +335,7 @@ int draw_display() {
     int acq_radius_local;          /**< Local radius of ROI. */
     char rec_char[2], rec_prob[6]; /**< MLP result. */
     network_target green_model;    /**< Active model. */
+    data_network_t* result;        /**< MLP result of the active model. */
     int actual_property;           /**< Cam properties. */
 
     /**< Default button color. */
@@ -363,7 +364,7 @@ int draw_display() {
 
     for (i = 0; i < CAM_HEIGHT; ++i) {
         for (j = 0; j < CAM_WIDTH; ++j) {
-            color = (capture_buffer[i * CAM_WIDTH + j] >= 120) 
+            color = (capture_buffer[i * CAM_WIDTH + j] >= BINARY_THRESHOLD)
                                                 ? white_color : black_color;
             putpixel(captured_image, j, i, color);
         }
@@ -400,9 +401,19 @@ int draw_display() {
 
     pthread_mutex_unlock(&ROI_image_mutex);
 
+    /**< Check the active model, in the all models mode its result is */
+    /**< already available. */
+    pthread_mutex_lock(&actual_model_mutex);
+    green_model = requested_model;
+    pthread_mutex_unlock(&actual_model_mutex);
+
     /**< Access the current result of the MLP.*/
     pthread_mutex_lock(&current_result_mutex);
 
+    result = (display_nn_data[current_result].all_models) ? 
+                    &display_nn_data[current_result].model_result[green_model] :
+                    &display_nn_data[current_result].result;
+
     acq_radius_local = display_nn_data[current_result].image_radius;
 
     /**< Display the acquired ROI image. */
@@ -418,10 +429,10 @@ int draw_display() {
             2 * input_center.radius, 2 * input_center.radius);
 
     /**< Recognized character. */
-    rec_char[0] = display_nn_data[current_result].result.rec_char;
+    rec_char[0] = result->rec_char;
 
     /**< Percentage of recognition. */
-    sprintf(rec_prob, "%2.2f", display_nn_data[current_result].result.prob);
+    sprintf(rec_prob, "%2.2f", result->prob);
 
     pthread_mutex_unlock(&current_result_mutex);
 
@@ -483,11 +494,7 @@ int draw_display() {
     textout_ex(display, normal_font, property_value[SHARPNESS],
                 prop_x_2, prop_y_2, BLACK, WHITE);
 
-    /**< Check the active model and make it green. */
-    pthread_mutex_lock(&actual_model_mutex);
-    green_model = requested_model;
-    pthread_mutex_unlock(&actual_model_mutex);
-
+    /**< Make the active model green. */
     model_color[green_model] = GREEN;
 
     /**< Draw text boxes. */
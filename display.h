@@ -68,6 +68,9 @@ typedef struct {
     int image_radius;           /**< ROI radius. */
 
     data_network_t result;      /**< Corresponding MLP result. */
+
+    int all_models;                 /**< 1 if model_result is filled. */
+    data_network_t model_result[3]; /**< MLP result of each model. */
 } display_network_t;
 
 /**< Struct that identify position and dimension of the ROI. */
@@ -49,14 +49,6 @@ int completed = 0;
 
 pthread_mutex_t completed_mutex;
 
-/**
-* LOCAL VARIABLE
-*/
-
-/**< images needed to the nn task */
-BITMAP* local_input;
-BITMAP* local_acquired;
-
 /**
 * LOCAL FUCNTION
 */
@@ -129,10 +121,6 @@ int init() {
 
     free(config);
 
-    /**< Allocate memory for the local images */
-    local_acquired  = create_bitmap(ROI_MAX, ROI_MAX);
-    local_input     = create_bitmap(INPUT_DIM, INPUT_DIM);
-
     /**< NN task init */
     error = init_networks();
     nn_error(error);
@@ -294,6 +282,11 @@ void * nn_task(void * arg)
     set_activation(id);
 
     int local_radius = 0; /**< Local radius of the ROI*/
+    int x, y, size;       /**< Position and side of the ROI in the frame*/
+    int all_models;       /**< Local value of the all models mode*/
+    int i, j;             /**< Loop counter*/
+    /**< Input image of the MLP, read from the camera buffer*/
+    unsigned char input[INPUT_DIM * INPUT_DIM];
     /**< Index of the array in which the taks have to write*/
     int index_result = 1; 
 
@@ -303,34 +296,54 @@ void * nn_task(void * arg)
         end = completed;
         pthread_mutex_unlock(&completed_mutex);
 
-        /**< Get the extracted ROI by the display task*/
+        /**< Get the ROI position, inside the camera frame*/
+        pthread_mutex_lock(&ROI_dim_mutex);
+
+        size = 2 * ROI_dim.radius;
+        x = ROI_dim.centerX - ROI_dim.radius;
+        y = ROI_dim.centerY - ROI_dim.radius - CAM_MRG_TOP;
+
+        pthread_mutex_unlock(&ROI_dim_mutex);
+
+        x = (x < 0) ? 0 : (x > CAM_WIDTH - size) ? CAM_WIDTH - size : x;
+        y = (y < 0) ? 0 : (y > CAM_HEIGHT - size) ? CAM_HEIGHT - size : y;
+
+        /**< Shrink the ROI of the frame to fit the input image*/
+        pthread_mutex_lock(&capture_buffer_mutex);
+        extract_input(capture_buffer, CAM_WIDTH, x, y, size, input);
+        pthread_mutex_unlock(&capture_buffer_mutex);
+
+        /**< Compute the MLP result, of all the models if requested*/
+        pthread_mutex_lock(&actual_model_mutex);
+        all_models = all_models_mode;
+        pthread_mutex_unlock(&actual_model_mutex);
+
+        if (all_models)
+            recognize_all_input(input);
+        else
+            recognize_input(input);
+
+        /**< Copy the images shown by the display in the global struct*/
         pthread_mutex_lock(&ROI_image_mutex);
 
         local_radius = extracted_ROI.radius;
-
-        /**< Copy it in the local image*/
-        blit(extracted_ROI.image, local_acquired, 0, 0, 0, 0, 
-            2 * local_radius, 2 * local_radius);
+        blit(extracted_ROI.image, display_nn_data[index_result].ROI, 
+                        0, 0, 0, 0, 2 * local_radius, 2 * local_radius);
 
         pthread_mutex_unlock(&ROI_image_mutex);
 
-        /**< Shrink the ROI to fit the input image*/
-        stretch_blit(local_acquired, local_input, 
-                            0, 0, 2 * local_radius, 2 * local_radius,
-                            0, 0, INPUT_DIM, INPUT_DIM);
-
-        /**< Compute the MLP result*/
-        recognize_character(local_input);
+        for (i = 0; i < INPUT_DIM; ++i)
+            for (j = 0; j < INPUT_DIM; ++j)
+                putpixel(display_nn_data[index_result].input_image, i, j,
+                            input[i * INPUT_DIM + j] ? BLACK : WHITE);
 
-        /**< Copy the result in the global struct*/
-        blit(local_acquired, display_nn_data[index_result].ROI, 0, 0, 0, 0, 
-                                            2 * local_radius, 2 * local_radius);
-        blit(local_input, display_nn_data[index_result].input_image, 0, 0, 0, 0, 
-                                                        INPUT_DIM, INPUT_DIM);
-        
         display_nn_data[index_result].result.rec_char = nn_result.rec_char;
         display_nn_data[index_result].result.prob     = nn_result.prob;
 
+        display_nn_data[index_result].all_models = all_models;
+        for (i = DIGITS; i <= MIXED; ++i)
+            display_nn_data[index_result].model_result[i] = nn_results[i];
+
         display_nn_data[index_result].image_radius = local_radius;
 
         /**< Update the current global index result*/
@@ -344,6 +357,11 @@ void * nn_task(void * arg)
         /**< Check deadline miss. */
         if (deadline_miss(id)) {   
             printf("%d) deadline missed! NN\n", id);
+
+            /**< Latencies of the stages of the models, if timed*/
+            for (i = DIGITS; i <= MIXED; ++i)
+                if (all_models || i == nn_result.model)
+                    print_stage_stats(i);
         }
         
         /**< Wait untill next activation. */
@@ -426,6 +444,11 @@ void nn_error(int return_value) {
                     "Error while loading weights values from file!");
             error++;
             break;
+        case NN_ERROR_NO_MEMORY:
+            fprintf(stderr, "NN_ERROR_NO_MEMORY ERROR - %s\n",
+                    "Error while allocating the models memory!");
+            error++;
+            break;
         default:
         break;
     }
@@ -454,16 +477,15 @@ int main()
     /**< Run. */
     wait_tasks();
 
-    /**< Free local images. */
-    destroy_bitmap(local_acquired);
-    destroy_bitmap(local_input);
-
     /**< Free all structures of the display task. */
     free_display();
 
     /**< Realese the camera module. */
     raspi_cam_release_capture();
 
+    /**< Free the models of the neural network. */
+    free_networks();
+
     allegro_exit();
     return 0;
 }
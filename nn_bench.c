@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "nn_handler.h"
+#include "nn_kernels.h"
+
+/**
+* @file nn_bench.c
+* @author Gianluca D'Amico
+* @brief Benchmark of the forward pass of the neural network models
+*
+* HANDLING MODEL BENCHMARK: It times the models of nn_handler without the
+* camera and the display, so it runs on the Raspberry Pi and on any host.
+*
+* Usage: nn_bench <output file> [inputs [idx3 images file]]
+*
+* Each ready model is fed with the given number of synthetic inputs, 2000 by
+* default, and with the same number of images of an EMNIST idx3 file if it
+* is given. Every input is timed twice: stage by stage on the caller alone,
+* then end to end by context_recognize_input with the workers of the model.
+* For each model, input set and stage the min, the median and the 99th
+* percentile of the latency are printed, with the layout of the weights of
+* the stage (csr, panels or dense), the ns per multiply-accumulate and the
+* GB/s of weights read at the median. The same values are written
+* to the output file as one JSON object per line.
+*
+* The EMNIST images are stored transposed, one column after the other, that
+* is the layout of the input image of the models, so their bytes are only
+* binarized. The result cache must be disabled at compile time, otherwise
+* the repeated inputs are not computed.
+*
+*/
+
+#define DEFAULT_INPUTS  2000    /**< Inputs of each set, if not given. */
+#define WARMUP_INPUTS   50      /**< Untimed inputs before each model. */
+#define BENCH_SIZE      (INPUT_DIM * INPUT_DIM) /**< Pixels of an input. */
+#define IDX3_MAGIC      0x803   /**< Magic number of an idx3 ubyte file. */
+#define IDX3_BLACK      128     /**< EMNIST level from which a pixel is set.*/
+#define MAX_NAME        24      /**< Max characters of a stage name. */
+
+/**< Latency statistics of a stage, in nanoseconds. */
+typedef struct {
+    long min;
+    long median;
+    long p99;
+} stats_t;
+
+/**
+* @brief Current time in nanoseconds.
+*
+* @return the monotonic time in nanoseconds
+*/
+static long now_ns() {
+
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+* @brief Compare two latencies for qsort.
+*/
+static int compare_long(const void* a, const void* b) {
+
+    long x = *(const long*) a;
+    long y = *(const long*) b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+* @brief Sort the latencies of a stage and compute their statistics.
+*
+* @param  samples are the n latencies, they are sorted
+* @param  n is the number of latencies
+* @param  stats is filled with the statistics
+*/
+static void compute_stats(long* samples, int n, stats_t* stats) {
+
+    qsort(samples, n, sizeof(long), compare_long);
+
+    stats->min = samples[0];
+    stats->median = samples[n / 2];
+    stats->p99 = samples[(long) n * 99 / 100];
+}
+
+/**
+* @brief Read a big-endian 32 bit integer of an idx file.
+*
+* @param  fp is the idx file
+* @param  value is the read integer
+* @return 0 if the integer is read, -1 otherwise
+*/
+static int read_be32(FILE* fp, int* value) {
+
+    unsigned char b[4];
+
+    if (fread(b, 1, 4, fp) != 4)
+        return -1;
+
+    *value = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    return 0;
+}
+
+/**
+* @brief Read the first images of an EMNIST idx3 file as input images.
+*
+* @param  file_name is the idx3 ubyte file
+* @param  inputs are filled with the binary images, back to back
+* @param  max_images is the max number of images read
+* @return the number of images read, -1 if the file cannot be read
+*/
+static int read_images(const char* file_name, unsigned char* inputs,
+                                                            int max_images) {
+    int i, k;
+    int magic, count, rows, cols;
+    unsigned char pixels[BENCH_SIZE];
+    FILE *fp;
+
+    fp = fopen(file_name, "rb");
+    if (fp == NULL)
+        return -1;
+
+    if (read_be32(fp, &magic) || read_be32(fp, &count) ||
+                    read_be32(fp, &rows) || read_be32(fp, &cols) ||
+                    magic != IDX3_MAGIC || rows != INPUT_DIM ||
+                    cols != INPUT_DIM) {
+        fclose(fp);
+        return -1;
+    }
+
+    if (count > max_images)
+        count = max_images;
+
+    for (k = 0; k < count; ++k) {
+        if (fread(pixels, 1, BENCH_SIZE, fp) != BENCH_SIZE)
+            break;
+
+        for (i = 0; i < BENCH_SIZE; ++i)
+            inputs[(long) k * BENCH_SIZE + i] = (pixels[i] >= IDX3_BLACK);
+    }
+
+    fclose(fp);
+    return k;
+}
+
+/**
+* @brief Name of a stage of a model.
+*
+* @param  stage is the stage, see bench_stages
+* @param  num_stages is the number of stages of the model
+* @param  name is filled with the name
+*/
+static void stage_name(int stage, int num_stages, char* name) {
+    if (stage == 0)
+        strcpy(name, "input");
+    else if (stage < num_stages - 2)
+        snprintf(name, MAX_NAME, "hidden%d", stage);
+    else if (stage == num_stages - 2)
+        strcpy(name, "output");
+    else
+        strcpy(name, "softmax");
+}
+
+/**
+* @brief Print the statistics of a stage on the standard output and on the
+* output file.
+*
+* @param  out is the output file
+* @param  model is the index of the model in the registry
+* @param  set is the name of the input set
+* @param  n is the number of inputs
+* @param  stage is the name of the stage
+* @param  layout is the layout of the weights of the stage, NULL if none
+* @param  stats are the latency statistics
+* @param  macs is the mean number of multiply-accumulates of the stage
+* @param  bytes is the mean number of bytes of weights read by the stage
+*/
+static void print_stage(FILE* out, int model, const char* set, int n,
+                        const char* stage, const char* layout,
+                        const stats_t* stats, double macs, double bytes) {
+    const char* precision;
+    int workers;
+
+    bench_model_info(model, &precision, &workers);
+
+    printf("%-8s %-9s %-10s %-6s %9ld %9ld %9ld", model_name(model), set,
+                    stage, (layout != NULL) ? layout : "-", stats->min,
+                    stats->median, stats->p99);
+    if (macs > 0)
+        printf(" %8.4f %7.2f", stats->median / macs, bytes / stats->median);
+    printf("\n");
+
+    fprintf(out, "{\"kernel\": \"%s\", \"model\": \"%s\", "
+            "\"precision\": \"%s\", \"workers\": %d, \"inputs\": \"%s\", "
+            "\"stage\": \"%s\", ", kernel_name(), model_name(model),
+            precision, (strcmp(stage, "end_to_end") == 0) ? workers : 1, set,
+            stage);
+
+    if (layout != NULL)
+        fprintf(out, "\"layout\": \"%s\", ", layout);
+    else
+        fprintf(out, "\"layout\": null, ");
+
+    fprintf(out, "\"samples\": %d, \"min_ns\": %ld, \"median_ns\": %ld, "
+            "\"p99_ns\": %ld, \"macs\": %.0f, ", n, stats->min, stats->median,
+            stats->p99, macs);
+
+    if (macs > 0)
+        fprintf(out, "\"ns_per_mac\": %.5f, \"gb_per_s\": %.3f}\n",
+                            stats->median / macs, bytes / stats->median);
+    else
+        fprintf(out, "\"ns_per_mac\": null, \"gb_per_s\": null}\n");
+}
+
+/**
+* @brief Time a model on a set of inputs and print its statistics.
+*
+* @param  out is the output file
+* @param  ctx is the context of the benchmark
+* @param  model is the index of the model in the registry
+* @param  set is the name of the input set
+* @param  inputs are the input images, back to back
+* @param  n is the number of inputs
+* @return 0 if the model is timed, -1 if the memory is not enough
+*/
+static int bench_model(FILE* out, nn_context_t* ctx, int model,
+                        const char* set, const unsigned char* inputs, int n) {
+    int i, s;
+    int num_stages = bench_stages(model);
+    long t, macs, bytes;
+    long *samples;              /**< Latencies of each stage, then the end
+                                                            to end ones. */
+    double *sum_macs, *sum_bytes;
+    double total_macs = 0, total_bytes = 0;
+    char name[MAX_NAME];
+    stats_t stats;
+    data_network_t result;
+
+    samples = malloc((size_t) (num_stages + 1) * n * sizeof(long));
+    sum_macs = calloc(num_stages, sizeof(double));
+    sum_bytes = calloc(num_stages, sizeof(double));
+    if (samples == NULL || sum_macs == NULL || sum_bytes == NULL) {
+        free(samples);
+        free(sum_macs);
+        free(sum_bytes);
+        return -1;
+    }
+
+    for (i = 0; i < WARMUP_INPUTS; ++i)
+        context_recognize_input(ctx, model,
+                                inputs + (long) (i % n) * BENCH_SIZE, &result);
+
+    for (i = 0; i < n; ++i) {
+        for (s = 0; s < num_stages; ++s) {
+            t = now_ns();
+            bench_run_stage(ctx, model, s, inputs + (long) i * BENCH_SIZE);
+            samples[(long) s * n + i] = now_ns() - t;
+
+            bench_stage_cost(ctx, model, s, &macs, &bytes);
+            sum_macs[s] += macs;
+            sum_bytes[s] += bytes;
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        t = now_ns();
+        context_recognize_input(ctx, model, inputs + (long) i * BENCH_SIZE,
+                                                                    &result);
+        samples[(long) num_stages * n + i] = now_ns() - t;
+    }
+
+    for (s = 0; s < num_stages; ++s) {
+        stage_name(s, num_stages, name);
+        compute_stats(samples + (long) s * n, n, &stats);
+        print_stage(out, model, set, n, name, bench_stage_layout(model, s),
+                            &stats, sum_macs[s] / n, sum_bytes[s] / n);
+        total_macs += sum_macs[s] / n;
+        total_bytes += sum_bytes[s] / n;
+    }
+
+    compute_stats(samples + (long) num_stages * n, n, &stats);
+    print_stage(out, model, set, n, "end_to_end", NULL, &stats, total_macs,
+                                                                total_bytes);
+
+    free(samples);
+    free(sum_macs);
+    free(sum_bytes);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+
+    int k, m;
+    int n = DEFAULT_INPUTS;
+    int num_sets = 1;
+    int count[2];                   /**< Inputs of each set. */
+    const char* set_name[2] = { "synthetic", "emnist" };
+    unsigned char* inputs[2] = { NULL, NULL };
+    unsigned int seed = 1;          /**< Fixed seed, repeatable inputs. */
+    nn_context_t* ctx;
+    FILE *out;
+
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <output file> [inputs [idx3 images "
+                                                    "file]]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2)
+        n = atoi(argv[2]);
+    if (n <= 0) {
+        fprintf(stderr, "Wrong number of inputs!\n");
+        return 1;
+    }
+
+    inputs[0] = malloc((size_t) n * BENCH_SIZE);
+    inputs[1] = malloc((size_t) n * BENCH_SIZE);
+    if (inputs[0] == NULL || inputs[1] == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+
+    for (k = 0; k < n; ++k)
+        bench_synthetic_input(inputs[0] + (long) k * BENCH_SIZE, &seed);
+    count[0] = n;
+
+    if (argc > 3) {
+        count[1] = read_images(argv[3], inputs[1], n);
+        if (count[1] <= 0) {
+            fprintf(stderr, "Error reading %s!\n", argv[3]);
+            return 1;
+        }
+        num_sets = 2;
+    }
+
+    out = fopen(argv[1], "w");
+    if (out == NULL) {
+        fprintf(stderr, "Error opening %s!\n", argv[1]);
+        return 1;
+    }
+
+    if (init_networks() != NN_SUCCESS || wait_models() != NN_SUCCESS) {
+        fprintf(stderr, "Error loading the models!\n");
+        return 1;
+    }
+
+    ctx = create_context();
+    if (ctx == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+    }
+
+    printf("%s kernels, latencies in ns\n", kernel_name());
+    printf("%-8s %-9s %-10s %-6s %9s %9s %9s %8s %7s\n", "model", "inputs",
+            "stage", "layout", "min", "median", "p99", "ns/MAC", "GB/s");
+
+    for (m = 0; m < count_models(); ++m) {
+        if (!model_ready(m))
+            continue;
+
+        for (k = 0; k < num_sets; ++k)
+            if (bench_model(out, ctx, m, set_name[k], inputs[k], count[k])) {
+                fprintf(stderr, "Out of memory!\n");
+                return 1;
+            }
+    }
+
+    fclose(out);
+    free_context(ctx);
+    free_networks();
+    free(inputs[0]);
+    free(inputs[1]);
+
+    return 0;
+}
@@ -1,27 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifndef NN_NO_ALLEGRO
 #include <allegro.h>
+#endif
 #include <math.h>
 #include <pthread.h>
 
 #include "nn_handler.h"
+#include "nn_kernels.h"
+#include "nn_pool.h"
+#include "nn_models.h"
 
 /**
 * @file nn_handler.h
 * @author Gianluca D'Amico
 * @brief File containing neural network handling functions
 *
-* HANDLING MODEL FUNCTIONS: It manages all the functions needed to load the
-* model weights of the neural network and to utilize the network.
+* HANDLING MODEL FUNCTIONS: It manages all the functions needed to utilize 
+* the neural network, the model weights are loaded by nn_models.c.
 *
-* At the start of the application, 3 different predefined models will be 
-* loaded, one for the recognition of digits, one for the recognition of 
-* letters, one for the recognition of both. Each model corresponds to different
-* sinapsi weights trained offline and saved in a txt file. This file include 
-* also the function needed to utilize the neural network in the application, 
-* taking the preprocessed images captured by the camera it will feed the active
-* network and compute the result of the recognition.
+* This file include the inference contexts and the forward pass of the 
+* models, taking the preprocessed images captured by the camera it will feed
+* the active network and compute the result of the recognition.
 *
 * @note Only one model is active at time.
 *
@@ -31,141 +33,179 @@
 * LOCAL DATA
 */
 
-/**< Neural network model size. */
-#define INPUT_SIZE INPUT_DIM * INPUT_DIM     /**< Input layer size. */
+#define ROW_BLOCK    16             /**< Rows of a layer shared by a worker 
+                                        are a multiple of a cache line. */
 
-#define DIGIT_HID_SIZE_1    64      /**< First hidden size of digits. */
-#define DIGIT_HID_SIZE_2    32      /**< Second hidden size of digits. */
-#define DIGIT_OUTPUT_SIZE   10      /**< Output layer size of digits. */
-#define LET_HID_SIZE        128     /**< Hidden layer size of letters. */
-#define LETTER_OUTPUT_SIZE  26      /**< Output layer size of letters. */
-#define MIX_HID_SIZE        512     /**< Hidden layer size of mixed. */
-#define MIXED_OUTPUT_SIZE   47      /**< Output layer size of mixed. */
+#define QUANT_REPORT_INPUTS 200     /**< Synthetic inputs used to compare the
+                                        int8 model with the float one. */
 
-#define HID_DIGITS   2              /**< Number of hidden layers of digits. */
-#define HID_LET_MIX  3              /**< Number of hidden layers of letters and 
-                                                                /**< mixed. */
+#define DELTA_MAX_UPDATES 64        /**< Consecutive incremental updates of the
+                                        first hidden layer before a full 
+                                        recompute bounds the rounding drift. */
 
-#define MAX_HID_SIZE 512            /**< Max hidden layer size of all models. */
-#define MAX_OUT_SIZE 47             /**< Max output layer size of all models. */
-#define MAX_HID_NUM  3              /**< Max number of hidden layers. */
+#define INPUT_WORDS  ((INPUT_SIZE + 31) / 32)  /**< Words of a bit-packed 
+                                                            input image. */
+#define CACHE_ENTRIES  (NN_RESULT_CACHE > 0 ? NN_RESULT_CACHE : 1)
+                                    /**< Entries of the result cache. */
+
+#define BATCH_SIZE   8              /**< Inputs fed together by 
+                                                    recognize_characters. */
 
 #define ERROR -1        /**< Error returning value. */
 #define SUCCESS 1       /**< Success returning value. */
 
-/**< Filename of digits model weights. */
-static const char digits_filename[30]   = "digits_2_64_32.txt";
+#define STAGE_FILL          0   /**< Stages of the timers, see stage_stats. */
+#define STAGE_INPUT         1
+#define STAGE_HIDDEN(k)     (2 + (k))   /**< k is the incoming hidden layer. */
+#define STAGE_OUTPUT(net)   ((net)->model->num_hidden + 1)
+#define STAGE_SOFTMAX(net)  ((net)->model->num_hidden + 2)
+#define STAGE_ARGMAX(net)   ((net)->model->num_hidden + 3)
 
-/**< Filename of letters model weights. */
-static const char letters_filename[30]  = "letters_3_128_128_128.txt";
+#if NN_TIMER_STAGES != MAX_HID_NUM + 4
+#error "NN_TIMER_STAGES does not match the max number of hidden layers"
+#endif
 
-/**< Filename of mixed model weights. */
-static const char mixed_filename[30]    = "mixed_3_512_512_512.txt";
+#define TIMER_SMOOTHING 16      /**< Runs of the moving average of the stage 
+                                                                latencies. */
 
 /**
 * LOCAL STRUTCS
 */
 
 /**
-* NEURAL NETWORK SINAPSI 
+* NEURAL NETWORK LAYER 
 */
 
-/**<Input sinapsi, the size of the Sinapsi is taken as the max of all sizes. */
-typedef  struct {
-    float weights[MAX_HID_SIZE][INPUT_SIZE];  /**< Weights of the connection.*/
-    float bias[MAX_HID_SIZE];                 /**< Bias of the connection. */
-
-    int card_in;   /**< Number of incoming neurons connetcted to the sinapsi.*/
-    int card_out;  /**< Number of outgoing neurons connetcted to the sinapsi.*/
-} sinapsi_in_t;
-
-// Hidden sinapsi, the size of the Sinapsi is taken as the maximum of all sizes
+/**< Layer of the network, its values are stored in the arena of the model.*/
 typedef struct {
-    float weights[MAX_HID_SIZE][MAX_HID_SIZE];/**< Weights of the connection.*/
-    float bias[MAX_HID_SIZE];                 /**< Bias of the connection. */
+    float *z_value;     /**< Weighted input of each neuron.*/
+    float *act_value;   /**< Activation value of each neruon.*/
 
-    int card_in;    /**< Number of incoming neurons connetcted to the sinapsi.*/
-    int card_out;   /**< Number of outgoing neurons connetcted to the sinapsi.*/
-} sinapsi_hid_t;
+    signed char *q_act_value;   /**< Int8 activation value of each neuron.*/
+    float q_scale;              /**< Scale of the int8 activation values.*/
 
-/**< Output sinapsi, the size of the Sinapsi is taken as the max of all sizes.*/
-typedef struct {
-    float weights[MAX_OUT_SIZE][MAX_HID_SIZE];/**< Weights of the connection.*/
-    float bias[MAX_OUT_SIZE];                 /**< Bias of the connection. */
+    float *batch_z_value;       /**< Weighted inputs of a batch, one row of
+                                                    num_neuron for each input.*/
+    float *batch_act_value;     /**< Activation values of a batch.*/
+    signed char *batch_q_act_value; /**< Int8 activation values of a batch.*/
+    float batch_q_scale[BATCH_SIZE];/**< Scale of each int8 row of a batch.*/
 
-    int card_in;   /**< Number of incoming neurons connetcted to the sinapsi.*/
-    int card_out;  /**< Number of outgoing neurons connetcted to the sinapsi.*/
-} sinapsi_out_t;
+    int num_neuron;     /**< Number of neurons of the layer.*/
+} layer_t;
 
 /**
-* NEURAL NETWORK LAYER 
+* NEURAL NETWORK STRUCT
 */
 
-/**< Input layer, the size of the Layer is taken as the maximum of all sizes.*/
-typedef struct {
-    float z_value[INPUT_SIZE];          /**< Weighted input of each neuron.*/
-    float act_value[INPUT_SIZE];        /**< Activation value of each neruon.*/
-
-    int num_neuron;     /**< Number of neurons of the layer.*/
-} layer_in_t;
+/**< Model fed by a context: the layers computed from the input of the 
+* caller, with the state kept from its previous frame.*/
+typedef struct network_s {
+    const model_t *model;       /**< Weights of the model.*/
+    unsigned int generation;    /**< Generation of the weights, see 
+                                                            context_net.*/
+
+    layer_t in_L;                   /**< Input layer.*/
+    layer_t hid_L[MAX_HID_NUM];     /**< Hidden layers.*/
+    layer_t out_L;                  /**< Output layer.*/
+
+    int *active_in;     /**< Indexes of the input neurons different from 0.*/
+    int num_active;     /**< Number of input neurons different from 0.*/
+
+    int *flipped_in;    /**< Indexes of the input neurons changed since the 
+                                                            previous frame.*/
+    int num_flipped;    /**< Number of input neurons changed.*/
+    int delta_valid;    /**< 1 if the first hidden layer matches the input 
+                                                        of the previous frame.*/
+    int delta_count;    /**< Incremental updates since the last full one.*/
+
+    int *q_sum;             /**< Int32 weighted sums of the int8 first 
+                                                                hidden layer.*/
+    int *batch_q_sum;       /**< Int32 weighted sums of a batch.*/
+
+#if NN_STAGE_TIMERS
+    long timer_start;       /**< Start of the timed inference.*/
+    long timer_last;        /**< End of the last timed stage.*/
+    long stage_ns[NN_TIMER_STAGES]; /**< Latency of each stage, -1 if it
+                                                            has not run.*/
+#endif
+
+    char *arena;        /**< Cache-line-aligned memory of all the arrays.*/
+    size_t arena_size;  /**< Size in bytes of the arena.*/
+} network_t;
 
-/**< Hidden layer, the size of the Layer is taken as the maximum of all sizes.*/
+#if NN_STAGE_TIMERS
+/**< Latencies of a stage of a model, updated by any thread without locks.*/
 typedef struct {
-    float z_value[MAX_HID_SIZE];        /**< Weighted input of each neuron.*/
-    float act_value[MAX_HID_SIZE];      /**< Activation value of each neruon.*/
-
-    int num_neuron;     /**< Number of neurons of the layer.*/
-} layer_hid_t;
-
-/**< Output layer, the size of the Layer is taken as the maximum of all sizes.*/
+    unsigned long count;        /**< Timed runs of the stage.*/
+    unsigned long last_ns;      /**< Latency of the last run.*/
+    unsigned long mean_ns;      /**< Moving average of the latency.*/
+    unsigned long max_ns;       /**< Max latency of the current window.*/
+    unsigned long prev_max_ns;  /**< Max latency of the previous window.*/
+} stage_timer_t;
+#endif
+
+/**< Result of a model for an input, kept by the cache of a context.*/
 typedef struct {
-    float z_value[MAX_OUT_SIZE];        /**< Weighted input of each neuron.*/
-    float act_value[MAX_OUT_SIZE];      /**< Activation value of each neruon.*/
+    unsigned long used;             /**< Last use of the entry, 0 if it 
+                                                        holds no result.*/
+    unsigned int hash;              /**< Hash of the input and the model.*/
+    unsigned int bits[INPUT_WORDS]; /**< Bit-packed binary input.*/
+    network_target model;           /**< Model which computed the result.*/
+    unsigned int generation;        /**< Generation of its weights.*/
+    int full_probability;           /**< 1 if the output layer is copied.*/
+    data_network_t result;          /**< Stored result.*/
+} cache_entry_t;
+
+/**< Inference context of a caller, each context can be used by one thread
+* at time while the models are shared by all of them.*/
+struct nn_context_s {
+    network_t net[NN_MAX_MODELS];   /**< Layers of each model.*/
+    network_target active_net;  /**< Model of the previous frame.*/
+    int ready[MIXED + 1];       /**< Models ready for the current frame of
+                                        context_recognize_all_characters.*/
+
+    unsigned int inference;     /**< Incremented at the start and at the end
+                                        of each inference, odd inside.*/
+    unsigned int waited;        /**< Odd inference waited by wait_contexts,
+                                                            0 if none.*/
+    struct nn_context_s* wait_next; /**< Next context waited by 
+                                                        wait_contexts.*/
+
+    cache_entry_t cache[CACHE_ENTRIES]; /**< Results of the recent inputs.*/
+    unsigned long cache_clock;      /**< Uses of the cache entries.*/
+    unsigned long cache_hits;       /**< Results found in the cache.*/
+    unsigned long cache_misses;     /**< Results computed by the models.*/
+
+    struct nn_context_s* next;  /**< Next context of the list.*/
+};
 
-    int num_neuron;     /**< Number of neurons of the layer.*/
-} layer_out_t;
+/**< Contexts created by create_context, the list is protected by a mutex. */
+static nn_context_t* context_list;
+static pthread_mutex_t context_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-/**
-* NEURAL NETWORK STRUCT
-*/
+/**< Context of the global recognition functions. */
+static nn_context_t* main_context;
 
-/**< Struct of each neural network model.*/
-typedef struct {
-    /**< Sinapsi from first layer to first hidden one.*/
-    sinapsi_in_t in_S;
-    /**< Sinapsi between consecutive hidden layers.*/
-    sinapsi_hid_t hid_S[MAX_HID_NUM-1];
-    /**< Sinapsi from last hidden layer to output one.*/
-    sinapsi_out_t out_S;
-
-    layer_in_t  in_L;                   /**< Input layer.*/
-    layer_hid_t hid_L[MAX_HID_NUM];     /**< Hidden layers.*/
-    layer_out_t out_L;                  /**< Output layer.*/
-
-    int num_hidden;     /**< Number of hidden layers of the model.*/
-} network_t;
+#if NN_STAGE_TIMERS
+/**< Latencies of the stages of each model, the last one is the whole 
+* inference. */
+static stage_timer_t stage_timer[NN_MAX_MODELS][NN_TIMER_STAGES + 1];
+#endif
 
-/**< Model container. */
-static network_t neural_network[3]; 
+/**< Models of the cascade, in order of escalation. */
+static network_target cascade_order[3] = NN_CASCADE_ORDER;
 
-/**< Actual active model. */
-static network_target active_net;
+/**< Percentage under which each model of the cascade escalates. */
+static float cascade_threshold[3] = NN_CASCADE_THRESHOLDS;
 
-/**< Mapping between output neuron of the network and character. */
-static const char digits_map[DIGIT_OUTPUT_SIZE] = 
-                        { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
+/**< Number of models of the cascade, 0 if the cascade is disabled. */
+static int cascade_stages = NN_CASCADE_STAGES;
 
-static const char letters_map[LETTER_OUTPUT_SIZE] = 
-                            { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 
-                              'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 
-                              'U', 'V', 'W', 'X', 'Y', 'Z'};
+/**< 1 if write_result copies the whole output layer. */
+static int full_probability = NN_FULL_PROBABILITY;
 
-static const char mixed_map[MIXED_OUTPUT_SIZE] =  
-                        { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 
-                          'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 
-                          'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 
-                          'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'd', 'e', 
-                          'f', 'g', 'h', 'n', 'q', 'r', 't'};
+/**< Name of each precision. */
+static const char precision_names[3][5] = { "fp32", "int8", "fp16" };
 
 /**
 * GLOBAL DATA
@@ -173,293 +213,515 @@ static const char mixed_map[MIXED_OUTPUT_SIZE] =
 
 network_target requested_model;      /**< Requested active model. */
 data_network_t nn_result;            /**< Result of the computation. */
+data_network_t nn_results[3];        /**< Result of each model. */
+int all_models_mode = NN_ALL_MODELS; /**< 1 if all the models are computed.*/
 
 /**
 * GLOBAL MUTEX
 */
 
-pthread_mutex_t actual_model_mutex;     /**< Active model.*/
+pthread_mutex_t actual_model_mutex;     /**< Active model and mode.*/
 
 /**
 * LOCAL FUNCTION DEFINITION
 */
 
 /**
-* @brief Initialization of all structs of digits model.
-*
-* This fuction assign every size to each struct of the digits model.
+* @brief Set the number of neurons of the layers of a network from its model.
 *
+* @param  net is the network whose model is already set
 */
-static void init_digits_net() {
-    neural_network[DIGITS].num_hidden   = HID_DIGITS;
-    neural_network[LETTERS].num_hidden  = HID_LET_MIX;
-    neural_network[MIXED].num_hidden    = HID_LET_MIX;
-
-    neural_network[DIGITS].in_S.card_in     = INPUT_SIZE;
-    neural_network[DIGITS].hid_S[0].card_in = DIGIT_HID_SIZE_1;
-    neural_network[DIGITS].out_S.card_in    = DIGIT_HID_SIZE_2;
+static void set_layer_sizes(network_t* net) {
 
-    neural_network[DIGITS].in_S.card_out        = DIGIT_HID_SIZE_1;
-    neural_network[DIGITS].hid_S[0].card_out    = DIGIT_HID_SIZE_2;
-    neural_network[DIGITS].out_S.card_out       = DIGIT_OUTPUT_SIZE;
+    int k;
+    const model_t* model = net->model;
 
-    neural_network[DIGITS].in_L.num_neuron      = INPUT_SIZE;
-    neural_network[DIGITS].hid_L[0].num_neuron  = DIGIT_HID_SIZE_1;
-    neural_network[DIGITS].hid_L[1].num_neuron  = DIGIT_HID_SIZE_2;
-    neural_network[DIGITS].out_L.num_neuron     = DIGIT_OUTPUT_SIZE;
+    net->in_L.num_neuron = model->in_S.card_in;
+    net->hid_L[0].num_neuron = model->in_S.card_out;
+    for (k = 0; k < model->num_hidden-1; ++k)
+        net->hid_L[k+1].num_neuron = model->hid_S[k].card_out;
+    net->out_L.num_neuron = model->out_S.card_out;
 }
 
 /**
-* @brief Initialization of all structs of letters model.
+* @brief Size in bytes of the arena needed by the layers of a network.
 *
-* This fuction assign every size to each struct of the letters model.
+* Each array of the layers is sized on the real cardinalities of the model
+* and it starts at the beginning of a cache line. The int8 arrays are always
+* included, so the network can be fed in every precision.
 *
+* @param  net is the network whose layer sizes are already set
+* @return the size of the arena
 */
-static void init_letters_net() {
-    neural_network[LETTERS].in_S.card_in     = INPUT_SIZE;
-    neural_network[LETTERS].hid_S[0].card_in = LET_HID_SIZE;
-    neural_network[LETTERS].hid_S[1].card_in = LET_HID_SIZE;
-    neural_network[LETTERS].out_S.card_in    = LET_HID_SIZE;
-
-    neural_network[LETTERS].in_S.card_out        = LET_HID_SIZE;
-    neural_network[LETTERS].hid_S[0].card_out    = LET_HID_SIZE;
-    neural_network[LETTERS].hid_S[1].card_out    = LET_HID_SIZE;
-    neural_network[LETTERS].out_S.card_out       = LETTER_OUTPUT_SIZE;
+static size_t arena_size(const network_t* net) {
+
+    int k;
+    size_t size = 0;
+    int num_hidden = net->model->num_hidden;
+
+    size += 2 * align_size(net->in_L.num_neuron * sizeof(float));
+    size += 2 * align_size(net->in_L.num_neuron * sizeof(int));
+    for (k = 0; k < num_hidden; ++k)
+        size += 2 * align_size(net->hid_L[k].num_neuron * sizeof(float));
+    size += 2 * align_size(net->out_L.num_neuron * sizeof(float));
+
+    /**< Batch rows of the layers, only the activations of the input one. */
+    size += align_size(BATCH_SIZE * net->in_L.num_neuron * sizeof(float));
+    for (k = 0; k < num_hidden; ++k)
+        size += 2 * align_size(BATCH_SIZE * net->hid_L[k].num_neuron * 
+                                                                sizeof(float));
+    size += 2 * align_size(BATCH_SIZE * net->out_L.num_neuron * sizeof(float));
+
+    /**< Int32 sums and int8 activations of the hidden layers. */
+    size += align_size(net->hid_L[0].num_neuron * sizeof(int));
+    size += align_size(BATCH_SIZE * net->hid_L[0].num_neuron * sizeof(int));
+    for (k = 0; k < num_hidden; ++k) {
+        size += align_size(net->hid_L[k].num_neuron);
+        size += align_size(BATCH_SIZE * net->hid_L[k].num_neuron);
+    }
 
-    neural_network[LETTERS].in_L.num_neuron      = INPUT_SIZE;
-    neural_network[LETTERS].hid_L[0].num_neuron  = LET_HID_SIZE;
-    neural_network[LETTERS].hid_L[1].num_neuron  = LET_HID_SIZE;
-    neural_network[LETTERS].hid_L[2].num_neuron  = LET_HID_SIZE;
-    neural_network[LETTERS].out_L.num_neuron     = LETTER_OUTPUT_SIZE;
+    return size;
 }
 
 /**
-* @brief Initialization of all structs of mixed model.
+* @brief Allocate the layers of a network fed with a model.
 *
-* This fuction assign every size to each struct of the mixed model.
+* A single cache-line-aligned block is allocated for the layers, the values
+* of each one are placed in it one after the other. The network starts with
+* no previous frame.
 *
+* @param  net is the network to be allocated
+* @param  model is the model fed by the network
+* @return an int to notify if the allocation is done correctly or not
 */
-static void init_mixed_net() {
-    neural_network[MIXED].in_S.card_in     = INPUT_SIZE;
-    neural_network[MIXED].hid_S[0].card_in = MIX_HID_SIZE;
-    neural_network[MIXED].hid_S[1].card_in = MIX_HID_SIZE;
-    neural_network[MIXED].out_S.card_in    = MIX_HID_SIZE;
+static int alloc_network(network_t* net, const model_t* model) {
+
+    int k;
+    size_t offset = 0;      /**< First free byte of the arena. */
+    char* arena;
+
+    memset(net, 0, sizeof(network_t));
+    net->model = model;
+    set_layer_sizes(net);
+
+    net->arena_size = arena_size(net);
+    if (posix_memalign((void**) &net->arena, CACHE_LINE, net->arena_size))
+        return ERROR;
+
+    arena = net->arena;
+    memset(arena, 0, net->arena_size);
+
+    net->in_L.z_value   = arena_take(arena, &offset, net->in_L.num_neuron);
+    net->in_L.act_value = arena_take(arena, &offset, net->in_L.num_neuron);
+    net->active_in = (int*) arena_take_bytes(arena, &offset, 
+                                        net->in_L.num_neuron * sizeof(int));
+    net->flipped_in = (int*) arena_take_bytes(arena, &offset, 
+                                        net->in_L.num_neuron * sizeof(int));
+
+    for (k = 0; k < model->num_hidden; ++k) {
+        net->hid_L[k].z_value   = arena_take(arena, &offset, 
+                                                    net->hid_L[k].num_neuron);
+        net->hid_L[k].act_value = arena_take(arena, &offset, 
+                                                    net->hid_L[k].num_neuron);
+    }
+
+    net->out_L.z_value   = arena_take(arena, &offset, net->out_L.num_neuron);
+    net->out_L.act_value = arena_take(arena, &offset, net->out_L.num_neuron);
+
+    net->in_L.batch_act_value = arena_take(arena, &offset, 
+                                        BATCH_SIZE * net->in_L.num_neuron);
+
+    for (k = 0; k < model->num_hidden; ++k) {
+        net->hid_L[k].batch_z_value   = arena_take(arena, &offset, 
+                                        BATCH_SIZE * net->hid_L[k].num_neuron);
+        net->hid_L[k].batch_act_value = arena_take(arena, &offset, 
+                                        BATCH_SIZE * net->hid_L[k].num_neuron);
+    }
+
+    net->out_L.batch_z_value   = arena_take(arena, &offset, 
+                                        BATCH_SIZE * net->out_L.num_neuron);
+    net->out_L.batch_act_value = arena_take(arena, &offset, 
+                                        BATCH_SIZE * net->out_L.num_neuron);
+
+    net->q_sum = (int*) arena_take_bytes(arena, &offset, 
+                                    net->hid_L[0].num_neuron * sizeof(int));
+    net->batch_q_sum = (int*) arena_take_bytes(arena, &offset, 
+                        BATCH_SIZE * net->hid_L[0].num_neuron * sizeof(int));
+
+    for (k = 0; k < model->num_hidden; ++k) {
+        net->hid_L[k].q_act_value = (signed char*) arena_take_bytes(arena, 
+                                            &offset, net->hid_L[k].num_neuron);
+        net->hid_L[k].batch_q_act_value = (signed char*) arena_take_bytes(
+                        arena, &offset, BATCH_SIZE * net->hid_L[k].num_neuron);
+    }
 
-    neural_network[MIXED].in_S.card_out        = MIX_HID_SIZE;
-    neural_network[MIXED].hid_S[0].card_out    = MIX_HID_SIZE;
-    neural_network[MIXED].hid_S[1].card_out    = MIX_HID_SIZE;
-    neural_network[MIXED].out_S.card_out       = MIXED_OUTPUT_SIZE;
+    return SUCCESS;
+}
 
-    neural_network[MIXED].in_L.num_neuron      = INPUT_SIZE;
-    neural_network[MIXED].hid_L[0].num_neuron  = MIX_HID_SIZE;
-    neural_network[MIXED].hid_L[1].num_neuron  = MIX_HID_SIZE;
-    neural_network[MIXED].hid_L[2].num_neuron  = MIX_HID_SIZE;
-    neural_network[MIXED].out_L.num_neuron     = MIXED_OUTPUT_SIZE;
+/**
+* @brief Release the layers of a network.
+*
+* @param  net is the network to be released
+*/
+static void free_network(network_t* net) {
+    free(net->arena);
+    net->arena = NULL;
 }
 
 /**
-* @brief Loading of weights and bias of input sinapsi.
+* @brief Hidden Activation function of the neural network.
 *
-* The file from which the weigths are loaded must have a specific pattern.
-* Each weights to the same outgoing neuron are separeted by a '_' .After them 
-* ther is the value of the bias between two '\n', then other weights follow in 
-* the same pattern. At the end of the file there is the accurancy of the model
-* and the relative accurancy for each symbol. If the pattern is not followed, 
-* the function return an ERROR code.
+* It computes the logistic function of each value of a layer, with the fast
+* polynomial exp or with the libm one if NN_LIBM_ACTIVATION is defined.
 *
-* @param  fp is the file descriptor whic contain the weights
-* @param  target specificy which model must be loaded {DIGITS, LETTERS, MIXED}
-* @return an int to notify if the loading is done correctly or not
+* @param  z_value input values for the logistic function computation
+* @param  act_value output values of the logistic function
+* @param  n is the number of neurons of the layer
 */
-static int load_input_sinapsi(FILE* fp, network_target target) {
+static void logistic_function(const float* z_value, float* act_value, int n) {
+#if defined(NN_LIBM_ACTIVATION)
+    vector_logistic_ref(z_value, act_value, n);
+#else
+    vector_logistic(z_value, act_value, n);
+#endif
+}
 
-    int i, j;
-    int char_count = 0;     /**< Counter for the characters read. */
-    char ch;                /**< Character read. */
-    char string[10] = "";   /**< String to contain the characters read. */
+/**
+* @brief Activation function of the hidden layers of a model.
+*
+* @param  model is the model whose activation function is computed
+* @param  z_value input values for the activation function computation
+* @param  act_value output values of the activation function
+* @param  n is the number of neurons of the layer
+*/
+static void hidden_activation(const model_t* model, const float* z_value, 
+                                                    float* act_value, int n) {
+    int i;
 
-    for (i = 0; i < neural_network[target].in_S.card_out; ++i) {
+    if (model->activation == ACT_RELU) {
+        for (i = 0; i < n; ++i)
+            act_value[i] = (z_value[i] > 0) ? z_value[i] : 0;
+    }
+    else {
+        logistic_function(z_value, act_value, n);
+    }
+}
 
-        for (j = 0; j < neural_network[target].in_S.card_in; ++j) {
+/**
+* @brief Output Activation function of the neural network.
+*
+* It computes the softmax function of the values of the output layer, the max
+* of z_value is subtracted before the exp to avoid its explosion. The fast 
+* polynomial exp is used unless NN_LIBM_ACTIVATION is defined.
+*
+* @param  z_value input values for the softmax function computation
+* @param  act_value output values of the softmax function
+* @param  n is the number of neurons of the output layer
+*/
+static void softmax(const float* z_value, float* act_value, int n) {
+#if defined(NN_LIBM_ACTIVATION)
+    vector_softmax_ref(z_value, act_value, n);
+#else
+    vector_softmax(z_value, act_value, n);
+#endif
+}
 
-            ch = fgetc(fp);
 
-            while(ch != '_' && ch != '\n') {
-                string[char_count] = ch;
-                char_count++;
-                if (char_count > 10)
-                    return ERROR;
-                ch = fgetc(fp);
-            }
+#if NN_STAGE_TIMERS
+/**
+* @brief Current time of the stage timers.
+*
+* @return the monotonic time in nanoseconds
+*/
+static long timer_ns() {
 
-            string[char_count] = '\0';
-            neural_network[target].in_S.weights[i][j] = atof(string);
+    struct timespec t;
 
-            char_count = 0;
-        }
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
 
-        while((ch = fgetc(fp)) != '\n') {
-            string[char_count] = ch;
-            char_count++;
-            if (char_count > 10)
-                return ERROR;
-        }  
+/**
+* @brief Start the timers of an inference of a model.
+*
+* @param  net is the model to be fed
+*/
+static void start_timers(network_t* net) {
 
-        string[char_count] = '\0';
-        neural_network[target].in_S.bias[i] = atof(string);
+    int s;
 
-        char_count = 0;
-    }
+    for (s = 0; s < NN_TIMER_STAGES; ++s)
+        net->stage_ns[s] = -1;
 
-    return SUCCESS;
+    net->timer_start = net->timer_last = timer_ns();
 }
 
 /**
-* @brief Loading of weights and bias of hiddens sinapsi.
+* @brief End a stage of the timed inference of a model.
 *
-* The file from which the weigths are loaded must have a specific pattern.
-* Each weights to the same outgoing neuron are separeted by a '_' .After them 
-* ther is the value of the bias between two '\n', then other weights follow in 
-* the same pattern. At the end of the file there is the accurancy of the model
-* and the relative accurancy for each symbol. If the pattern is not followed, 
-* the function return an ERROR code.
+* The stage lasts from the end of the previous one, or from the restart of
+* the timers.
 *
-* @param  fp is the file descriptor whic contain the weights
-* @param  target specificy which model must be loaded {DIGITS, LETTERS, MIXED}
-* @return an int to notify if the loading is done correctly or not
+* @param  net is the model to be fed
+* @param  stage is the ended stage
 */
-static int load_hidden_sinapsi(FILE* fp, network_target target) {
+static void mark_timer(network_t* net, int stage) {
 
-    int i, j, k;
-    int char_count = 0;     /**< Counter for the characters read. */
-    char ch;                /**< Character read. */
-    char string[10];        /**< String to contain the characters read. */
+    long now = timer_ns();
 
-    for (k = 0; k < neural_network[target].num_hidden-1; ++k) {
-
-        for (i = 0; i < neural_network[target].hid_S[k].card_out; ++i) {
-
-            for (j = 0; j < neural_network[target].hid_S[k].card_in; ++j) {
-
-                ch = fgetc(fp);
-
-                while(ch != '_' && ch != '\n') {
-                    string[char_count] = ch;
-                    char_count++;
-                    ch = fgetc(fp);
-                    if (char_count > 10)
-                        return ERROR;
-                }
+    net->stage_ns[stage] = now - net->timer_last;
+    net->timer_last = now;
+}
 
-                string[char_count] = '\0';
-                neural_network[target].hid_S[k].weights[i][j] = atof(string);
+/**
+* @brief Add a latency to the statistics of a stage.
+*
+* It can be called by several threads at the same time: each field is 
+* updated atomically, the moving average and the max with a compare and 
+* swap loop. The max of the current window is moved to the previous one 
+* every NN_TIMER_WINDOW runs.
+*
+* @param  timer is the statistics of the stage
+* @param  ns is the latency of the stage
+*/
+static void update_timer(stage_timer_t* timer, unsigned long ns) {
 
-                char_count = 0;
-            }
+    unsigned long count, mean, max;
 
-            while((ch = fgetc(fp)) != '\n') {
-                string[char_count] = ch;
-                char_count++;
-                if (char_count > 10)
-                    return ERROR;
-            }  
+    count = __atomic_add_fetch(&timer->count, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&timer->last_ns, ns, __ATOMIC_RELAXED);
 
-            string[char_count] = '\0';
-            neural_network[target].hid_S[k].bias[i] = atof(string);
+    mean = __atomic_load_n(&timer->mean_ns, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&timer->mean_ns, &mean, 
+                (count == 1) ? ns : mean + ((long) ns - (long) mean) / 
+                TIMER_SMOOTHING, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
 
-            char_count = 0;
-        }
-    }
+    max = __atomic_load_n(&timer->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&timer->max_ns, &max, 
+                                ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
 
-    return SUCCESS;
+    if (count % NN_TIMER_WINDOW == 0)
+        __atomic_store_n(&timer->prev_max_ns, __atomic_exchange_n(
+                    &timer->max_ns, 0, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
 }
 
 /**
-* @brief Loading of weights and bias of output sinapsi.
+* @brief Add the stages of the timed inference of a model to its 
+* statistics.
 *
-* The file from which the weigths are loaded must have a specific pattern.
-* Each weights to the same outgoing neuron are separeted by a '_' .After them 
-* ther is the value of the bias between two '\n', then other weights follow in 
-* the same pattern. At the end of the file there is the accurancy of the model
-* and the relative accurancy for each symbol. If the pattern is not followed, 
-* the function return an ERROR code.
+* The stages which have not run are skipped, the whole inference lasts from
+* the start of the timers until now.
 *
-* @param  fp is the file descriptor whic contain the weights
-* @param  target specificy which model must be loaded {DIGITS, LETTERS, MIXED}
-* @return an int to notify if the loading is done correctly or not
+* @param  target is the index of the model in the registry
+* @param  net is the fed model
 */
-static int load_out_sinapsi(FILE* fp, network_target target) {
+static void record_timers(int target, const network_t* net) {
 
-    int i, j;
-    int char_count = 0;     /**< Counter for the characters read. */
-    char ch;                /**< Character read. */
-    char string[10];        /**< String to contain the characters read. */
+    int s;
 
-    for (i = 0; i < neural_network[target].out_S.card_out; ++i) {
+    for (s = 0; s < NN_TIMER_STAGES; ++s)
+        if (net->stage_ns[s] >= 0)
+            update_timer(&stage_timer[target][s], net->stage_ns[s]);
 
-        for (j = 0; j < neural_network[target].out_S.card_in; ++j) {
+    update_timer(&stage_timer[target][NN_TIMER_STAGES], 
+                                            timer_ns() - net->timer_start);
+}
 
-            ch = fgetc(fp);
+/**< Timers of the stages, see stage_stats. */
+#define TIMER_START(net)            start_timers(net)
+#define TIMER_RESTART(net)          ((net)->timer_last = timer_ns())
+#define TIMER_MARK(net, stage)      mark_timer(net, stage)
+#define TIMER_RECORD(target, net)   record_timers(target, net)
+#else
+#define TIMER_START(net)            ((void) 0)
+#define TIMER_RESTART(net)          ((void) 0)
+#define TIMER_MARK(net, stage)      ((void) 0)
+#define TIMER_RECORD(target, net)   ((void) 0)
+#endif
+
+/**< End of a stage shared by the workers, marked by the first one. */
+#define WORKER_MARK(net, worker, stage)                                     \
+    do { if ((worker) == 0) TIMER_MARK(net, stage); } while (0)
 
-            while(ch != '_' && ch != '\n') {
-                string[char_count] = ch;
-                char_count++;
-                if (char_count > 10)
-                    return ERROR;
-                ch = fgetc(fp);
-            }
+/**
+* @brief Rows of a layer computed by a worker.
+*
+* The rows are split in contiguous shares, each one a multiple of ROW_BLOCK
+* so that two workers never write the same cache line. The last workers can
+* receive an empty share.
+*
+* @param  rows is the number of neurons of the layer
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers sharing the layer
+* @param  first is the first row of the worker
+* @param  last is the row after the last one of the worker
+*/
+static void worker_rows(int rows, int worker, int num_workers, int* first, 
+                                                                int* last) {
+    int share = (rows + num_workers - 1) / num_workers;
 
-            string[char_count] = '\0';
-            neural_network[target].out_S.weights[i][j] = atof(string);
+    share = (share + ROW_BLOCK - 1) / ROW_BLOCK * ROW_BLOCK;
 
-            char_count = 0;
-        }
+    *first = worker * share;
+    *last = *first + share;
 
-        while((ch = fgetc(fp)) != '\n') {
-            string[char_count] = ch;
-            char_count++;
-            if (char_count > 10)
-                return ERROR;
-        } 
+    if (*first > rows)
+        *first = rows;
+    if (*last > rows)
+        *last = rows;
+}
 
-        string[char_count] = '\0';
-        neural_network[target].out_S.bias[i] = atof(string);
+/**
+* @brief Quantize the activation values of a layer to int8.
+*
+* @param  in is the layer to be quantized
+* @param  n is the number of neurons of the layer
+*/
+static void quantize_layer(layer_t* in, int n) {
+    in->q_scale = quantize_i8(in->act_value, in->q_act_value, n);
+}
 
-        char_count = 0;
+/**
+* @brief Weighted sums of a sinapsi in the precision of the model.
+*
+* In float precision it is a plain gemv, in fp16 precision the weights are
+* widened to float inside the gemv. In int8 precision the activation of the
+* incoming layer, already quantized by quantize_layer, is multiplied by the
+* int8 weights on int32 and each sum is dequantized before adding the bias.
+* A sparse sinapsi adds only its non-zero weights, the fp16 ones are already
+* widened. Only the rows from first to last are computed.
+*
+* @param  net is the model to be fed
+* @param  sinapsi is the sinapsi between the two layers
+* @param  in is the incoming layer
+* @param  z_value is the weighted input of the outgoing layer
+* @param  first is the first row to be computed
+* @param  last is the row after the last one to be computed
+*/
+static void weighted_sum(const network_t* net, const sinapsi_t* sinapsi, 
+                    const layer_t* in, float* z_value, int first, int last) {
+
+    int card_in = sinapsi->card_in;
+
+    if (sinapsi->row_start != NULL) {
+        if (net->model->precision == NN_INT8)
+            spmv_i8(sinapsi->row_start + first, sinapsi->col_index, 
+                        sinapsi->sq_weights, sinapsi->q_scale + first, 
+                        sinapsi->bias + first, in->q_act_value, in->q_scale,
+                        z_value + first, last - first);
+        else
+            spmv(sinapsi->row_start + first, sinapsi->col_index, 
+                        sinapsi->s_weights, sinapsi->bias + first, 
+                        in->act_value, z_value + first, last - first);
+        return;
     }
 
-    return SUCCESS;
+    switch (net->model->precision) {
+        case NN_INT8:
+            gemv_i8(sinapsi->q_weights + first * card_in, 
+                        sinapsi->q_scale + first, sinapsi->bias + first, 
+                        in->q_act_value, in->q_scale, z_value + first, 
+                        last - first, card_in);
+            break;
+        case NN_FP16:
+            gemv_f16(sinapsi->h_weights + first * card_in, 
+                        sinapsi->bias + first, in->act_value, z_value + first,
+                        last - first, card_in);
+            break;
+        default:
+            if (sinapsi->p_weights != NULL)
+                gemv_panels(sinapsi->p_weights + first * card_in, 
+                        sinapsi->bias + first, in->act_value, z_value + first,
+                        last - first, card_in);
+            else
+                gemv(sinapsi->weights + first * card_in, sinapsi->bias + first,
+                        in->act_value, z_value + first, last - first, card_in);
+            break;
+    }
 }
 
 /**
-* @brief Hidden Activation function of the neural network.
+* @brief Dequantize the int32 sums of the int8 first hidden layer.
 *
-* It computes the logistic function of the input value.
+* @param  net is the model to be fed
+* @param  first is the first row to be dequantized
+* @param  last is the row after the last one to be dequantized
+*/
+static void dequantize_in_layer(network_t* net, int first, int last) {
+
+    int i;
+    const sinapsi_t* in_S = &net->model->in_S;
+
+    for (i = first; i < last; ++i)
+        net->hid_L[0].z_value[i] = net->q_sum[i] * in_S->q_scale[i] + 
+                                                                in_S->bias[i];
+}
+
+/**
+* @brief Search the first value of a sparse column from a row.
 *
-* @param  z input value for the logistic function computation
-* @return logistic function of the value in input
+* @param  index are the sorted rows of the values
+* @param  lo is the first value of the search
+* @param  hi is the value after the last one of the search
+* @param  row is the searched row
+* @return the first value whose row is not lower than row, hi if none
 */
-static float logistic_function(float z) {
-    return 1 / (1 + exp(-z));
+static int sparse_search(const short* index, int lo, int hi, int row) {
+
+    int mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (index[mid] < row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
 }
 
 /**
-* @brief Output Activation function of the neural network.
+* @brief Add a column of the sparse input sinapsi to the first hidden layer.
 *
-* It computes the softmax function of the input value, it is used only in the
-* output layer of the neural network.
+* The values of the column are sorted by row, the ones of the rows from 
+* first to last are found by a binary search when the column is shared by 
+* many workers. In int8 precision they are added to the int32 sums, or 
+* subtracted if a is negative, otherwise they are scaled by a and added to 
+* the weighted inputs.
 *
-* @param  z input value for the softmax function computation
-* @param  sum of all exponatial of ouput z_value
-* @param  max of all exponatial of ouput z_value, is neede to avoid the 
-*         explosion of the exp
-* @return softmax function of the value in input
+* @param  net is the model to be fed
+* @param  j is the input neuron of the column
+* @param  a is the scale of the column
+* @param  q_sum are the int32 sums of the int8 precision
+* @param  z_value are the weighted inputs of the other precisions
+* @param  first is the first row to be updated
+* @param  last is the row after the last one to be updated
 */
-static float softmax(float z, float sum, float max) {
-    return (exp(z + max) / (sum) );
+static void add_sparse_column(const network_t* net, int j, float a, 
+                            int* q_sum, float* z_value, int first, int last) {
+    const sinapsi_t* in_S = &net->model->in_S;
+    int begin = in_S->row_start[j];
+    int end = in_S->row_start[j+1];
+
+    if (first > 0)
+        begin = sparse_search(in_S->col_index, begin, end, first);
+    if (last < in_S->card_out)
+        end = sparse_search(in_S->col_index, begin, end, last);
+
+    if (net->model->precision != NN_INT8)
+        sparse_axpy(a, in_S->col_index + begin, in_S->s_weights + begin, 
+                                                    z_value, end - begin);
+    else if (a > 0)
+        sparse_add_i8(in_S->col_index + begin, in_S->sq_weights + begin, 
+                                                        q_sum, end - begin);
+    else
+        sparse_sub_i8(in_S->col_index + begin, in_S->sq_weights + begin, 
+                                                        q_sum, end - begin);
 }
 
-
 /**
 * @brief Feed forward result from input layer to first hidden one.
 *
@@ -468,30 +730,196 @@ static float softmax(float z, float sum, float max) {
 * bias and assign it to the z_value of the relative outgoing neuron. Then it 
 * compute the logistic function (activation function) of the z_value and assign 
 * it to the act_value of the relative outgoing neuron.
+*
+* The input image is binary and only a small part of its pixels is set, so the
+* weighted sums are computed adding to the bias only the columns of the input
+* sinapsi of the active neurons listed in active_in. In int8 precision the 
+* columns are summed on int32. In int8 and fp16 precision every active input
+* counts as 1. Each worker adds only its share of the columns. The columns 
+* of a sparse sinapsi are added by add_sparse_column.
+*
+* @param  net is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void propagate_from_in_layer(network_t* net, int worker, 
+                                                            int num_workers) {
+    int j, k;
+    int first, last, rows;
+    const sinapsi_t* in_S = &net->model->in_S;
+    int card_out = in_S->card_out;
+    float* z_value = net->hid_L[0].z_value;
+
+    worker_rows(card_out, worker, num_workers, &first, &last);
+    rows = last - first;
+
+    if (in_S->row_start != NULL) {
+        if (net->model->precision == NN_INT8)
+            memset(net->q_sum + first, 0, rows * sizeof(int));
+        else
+            memcpy(z_value + first, in_S->bias + first, 
+                                                        rows * sizeof(float));
+
+        for (k = 0; k < net->num_active; ++k) {
+            j = net->active_in[k];
+            add_sparse_column(net, j, (net->model->precision == NN_FP32) ? 
+                                net->in_L.act_value[j] : 1, net->q_sum, 
+                                z_value, first, last);
+        }
+
+        if (net->model->precision == NN_INT8)
+            dequantize_in_layer(net, first, last);
+    }
+    else switch (net->model->precision) {
+        case NN_INT8:
+            memset(net->q_sum + first, 0, rows * sizeof(int));
+
+            for (k = 0; k < net->num_active; ++k)
+                vector_add_i8(in_S->q_weights + 
+                                net->active_in[k] * card_out + first, 
+                                net->q_sum + first, rows);
+
+            dequantize_in_layer(net, first, last);
+            break;
+        case NN_FP16:
+            memcpy(z_value + first, in_S->bias + first, 
+                                                        rows * sizeof(float));
+
+            for (k = 0; k < net->num_active; ++k)
+                vector_add_f16(in_S->h_weights + 
+                                net->active_in[k] * card_out + first, 
+                                z_value + first, rows);
+            break;
+        default:
+            memcpy(z_value + first, in_S->bias + first, 
+                                                        rows * sizeof(float));
+
+            /**< z_value = [sum of ( weight * activation value )] + bias. */
+            for (k = 0; k < net->num_active; ++k) {
+                j = net->active_in[k];
+
+                if (net->in_L.act_value[j] == 1)
+                    vector_add(in_S->weights + j * card_out + first, 
+                                                        z_value + first, rows);
+                else
+                    axpy(net->in_L.act_value[j], 
+                                in_S->weights + j * card_out + first, 
+                                z_value + first, rows);
+            }
+            break;
+    }
+
+    hidden_activation(net->model, z_value + first, 
+                                    net->hid_L[0].act_value + first, rows);
+
+    pool_barrier(num_workers);
+}
+
+/**
+* @brief Update the first hidden layer from the pixels changed since the 
+* previous frame.
+*
+* The z_value of the first hidden layer still holds the weighted sums of the
+* previous input, so for each binary input neuron listed in flipped_in the 
+* column of the input sinapsi is added if the pixel has been set or 
+* subtracted if it has been cleared. Then the logistic function is computed 
+* again on the updated z_value. In int8 precision the columns are added to 
+* the int32 sums, which are exact and are dequantized again. Each worker 
+* updates only its share of the columns.
+*
+* @param  net is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
 */
-static void propagate_from_in_layer() {
+static void update_from_in_layer(network_t* net, int worker, int num_workers) {
+
+    int j, k;
+    int first, last, rows;
+    int set;            /**< 1 if the pixel has been set, 0 if cleared. */
+    const sinapsi_t* in_S = &net->model->in_S;
+    int card_out = in_S->card_out;
+    float* z_value = net->hid_L[0].z_value;
+
+    worker_rows(card_out, worker, num_workers, &first, &last);
+    rows = last - first;
+
+    for (k = 0; k < net->num_flipped; ++k) {
+        j = net->flipped_in[k];
+        set = (net->in_L.act_value[j] == 1);
+
+        if (in_S->row_start != NULL) {
+            add_sparse_column(net, j, set ? 1 : -1, net->q_sum, z_value, 
+                                                                first, last);
+            continue;
+        }
+
+        switch (net->model->precision) {
+            case NN_INT8:
+                if (set)
+                    vector_add_i8(in_S->q_weights + j * card_out + first,
+                                                    net->q_sum + first, rows);
+                else
+                    vector_sub_i8(in_S->q_weights + j * card_out + first,
+                                                    net->q_sum + first, rows);
+                break;
+            case NN_FP16:
+                if (set)
+                    vector_add_f16(in_S->h_weights + j * card_out + first,
+                                                        z_value + first, rows);
+                else
+                    vector_sub_f16(in_S->h_weights + j * card_out + first,
+                                                        z_value + first, rows);
+                break;
+            default:
+                if (set)
+                    vector_add(in_S->weights + j * card_out + first, 
+                                                        z_value + first, rows);
+                else
+                    vector_sub(in_S->weights + j * card_out + first, 
+                                                        z_value + first, rows);
+                break;
+        }
+    }
 
-    int i, j, k;
-    float sum_up;       /**< Weighted sum of all incoming neurons. */
+    if (net->model->precision == NN_INT8)
+        dequantize_in_layer(net, first, last);
 
-    for (i = 0; i < neural_network[active_net].in_S.card_out; ++i) {
+    hidden_activation(net->model, z_value + first, 
+                                    net->hid_L[0].act_value + first, rows);
 
-        sum_up=0;
-        
-        /**< The sum_up is computed as:. */
-        /**< sum_up = [sum of ( weight * activation value )] + bias. */
-        for (j = 0; j < neural_network[active_net].in_S.card_in; ++j) 
-            sum_up += neural_network[active_net].in_S.weights[i][j] * 
-                                neural_network[active_net].in_L.act_value[j];    
-        
-        sum_up += neural_network[active_net].in_S.bias[i];
+    pool_barrier(num_workers);
+}
 
-        neural_network[active_net].hid_L[0].z_value[i] = sum_up;
-        neural_network[active_net].hid_L[0].act_value[i] = 
-                                                    logistic_function(sum_up);
+/**
+* @brief Feed forward result from a hidden layer to the next one.
+*
+* @param  net is the model to be fed
+* @param  k is the index of the incoming hidden layer
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void propagate_hid_layer(network_t* net, int k, int worker, 
+                                                            int num_workers) {
+    int first, last;
+
+    if (net->model->precision == NN_INT8) {
+        if (worker == 0)
+            quantize_layer(&net->hid_L[k], net->model->hid_S[k].card_in);
+        pool_barrier(num_workers);
     }
-    
-    return;
+
+    worker_rows(net->model->hid_S[k].card_out, worker, num_workers, 
+                                                        &first, &last);
+
+    /**< z_value = [sum of ( weight * activation value )] + bias. */
+    weighted_sum(net, &net->model->hid_S[k], &net->hid_L[k], 
+                                net->hid_L[k+1].z_value, first, last);
+
+    hidden_activation(net->model, net->hid_L[k+1].z_value + first, 
+                        net->hid_L[k+1].act_value + first, last - first);
+
+    pool_barrier(num_workers);
+    WORKER_MARK(net, worker, STAGE_HIDDEN(k));
 }
 
 /**
@@ -503,31 +931,21 @@ static void propagate_from_in_layer() {
 * the relative outgoing neuron. Then it compute the logistic function 
 * (activation function) of the z_value and assign it to the act_value of the 
 * relative outgoing neuron.
+*
+* Each worker computes its share of the rows of every layer, then it waits
+* the others before the next layer. In int8 precision the worker 0 quantizes
+* the incoming layer before the others start.
+*
+* @param  net is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
 */
-static void propagate_into_hid_layer() {
-
-    int i, j, k;
-    float sum_up;       /**< Weighted sum of all incoming neurons. */
-
-    for (k = 0; k < neural_network[active_net].num_hidden-1; ++k) {
-
-        /**< The sum_up is computed as:. */
-        /**< sum_up = [sum of ( weight * activation value )] + bias. */
-        for (i = 0; i < neural_network[active_net].hid_S[k].card_out; ++i) {
+static void propagate_into_hid_layer(network_t* net, int worker, 
+                                                            int num_workers) {
+    int k;
 
-            sum_up=0;
-            
-            for (j = 0; j < neural_network[active_net].hid_S[k].card_in; ++j) 
-                sum_up += neural_network[active_net].hid_S[k].weights[i][j] * 
-                            neural_network[active_net].hid_L[k].act_value[j];    
-            
-            sum_up += neural_network[active_net].hid_S[k].bias[i];
-
-            neural_network[active_net].hid_L[k+1].z_value[i] = sum_up;
-            neural_network[active_net].hid_L[k+1].act_value[i] = 
-                                                    logistic_function(sum_up);
-        }
-    }
+    for (k = 0; k < net->model->num_hidden-1; ++k)
+        propagate_hid_layer(net, k, worker, num_workers);
 
     return;
 }
@@ -537,210 +955,1997 @@ static void propagate_into_hid_layer() {
 *
 * For each neuron in the output layer, the fuction computes the weighted
 * sum of the incoming neurons based on the connection value plus the related
-* bias and assign it to the z_value of the relative outgoing neuron. Then it 
-* compute the logistic function (activation function) of the z_value and assign 
-* it to the act_value of the relative outgoing neuron using the softmax 
-* function.
+* bias and assign it to the z_value of the relative outgoing neuron. Each 
+* worker computes its share of the rows, the softmax function needs all of 
+* them and it is computed by forward_pass when the workers have finished.
+*
+* @param  net is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
 */
-static void propagate_to_out_layer() {
-
-    int i, j, k;
-    float sum_up;               /**< Weighted sum of all incoming neurons. */
-    float sum_softmax = 0;      /**< Sum of exp( z_value + max(z_value) ). */
-    float max_softmax = 0;      /**< Max of all z_value. */
-
-    int hid_num = neural_network[active_net].num_hidden;
-
-    for (i = 0; i < neural_network[active_net].out_S.card_out; ++i) {
-
-        sum_up=0;
-
-        /**< The sum_up is computed as:. */
-        /**< sum_up = [sum of ( weight * activation value )] + bias. */
-        for (j = 0; j < neural_network[active_net].out_S.card_in; ++j) 
-            sum_up += neural_network[active_net].out_S.weights[i][j] * 
-                    neural_network[active_net].hid_L[hid_num-1].act_value[j];    
-        
-        sum_up += neural_network[active_net].out_S.bias[i];
-
-        neural_network[active_net].out_L.z_value[i] = sum_up;
-        if (max_softmax < sum_up) {
-            max_softmax = sum_up;
-        }
-
+static void propagate_to_out_layer(network_t* net, int worker, 
+                                                            int num_workers) {
+    int first, last;
+    int hid_num = net->model->num_hidden;
+    const sinapsi_t* out_S = &net->model->out_S;
+
+    if (net->model->precision == NN_INT8) {
+        if (worker == 0)
+            quantize_layer(&net->hid_L[hid_num-1], out_S->card_in);
+        pool_barrier(num_workers);
     }
 
-    for (i = 0; i < neural_network[active_net].out_S.card_out; ++i) {
-        sum_softmax += exp(neural_network[active_net].out_L.z_value[i] +
-                                                                max_softmax);
-    }
+    worker_rows(out_S->card_out, worker, num_workers, &first, &last);
 
-    for (i = 0; i < neural_network[active_net].out_S.card_out; ++i) {
-        neural_network[active_net].out_L.act_value[i] = softmax(
-                                neural_network[active_net].out_L.z_value[i], 
-                                sum_softmax, 
-                                max_softmax);
-    }
+    /**< z_value = [sum of ( weight * activation value )] + bias. */
+    weighted_sum(net, out_S, &net->hid_L[hid_num-1], net->out_L.z_value,
+                                                                first, last);
 
     return;
 }
 
 /**
-* GLOBAL FUNCTIONS
+* @brief Layer of a specialized pass, from a hidden layer to the next one.
+*
+* Same computation of an iteration of propagate_into_hid_layer in float
+* precision, the weighted sums are computed by a gemv specialized on the
+* number of columns of the sinapsi, or on its panels if it is packed.
+*
+* @param  s is the sinapsi between the layers
+* @param  in is the incoming layer
+* @param  out is the outgoing layer
+* @param  gemv_fn is the gemv specialized on s->card_in columns
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
 */
+static inline void fixed_hid_layer(const sinapsi_t* s, const layer_t* in,
+                layer_t* out, void (*gemv_fn)(const float*, const float*,
+                const float*, float*, int), int worker, int num_workers) {
+    int first, last;
+
+    worker_rows(s->card_out, worker, num_workers, &first, &last);
+
+    if (s->p_weights != NULL)
+        gemv_panels(s->p_weights + (size_t) first * s->card_in, 
+                        s->bias + first, in->act_value, out->z_value + first,
+                        last - first, s->card_in);
+    else
+        gemv_fn(s->weights + (size_t) first * s->card_in, s->bias + first,
+                        in->act_value, out->z_value + first, last - first);
+
+    logistic_function(out->z_value + first, out->act_value + first,
+                                                                last - first);
+
+    pool_barrier(num_workers);
+}
 
 /**
-* @brief Initialize all 3 models.
+* @brief Output layer of a specialized pass, without the softmax function.
 *
-* Using the function defined before, this function load all the weights 
-* and bias of all models after initialize the structs of all of them. 
-* It also active the DIGITS one.
-*
-* @param  change specificy which model must be active {DIGITS, LETTERS, MIXED}
+* @param  s is the sinapsi from the last hidden layer
+* @param  in is the last hidden layer
+* @param  out is the output layer
+* @param  gemv_fn is the gemv specialized on s->card_in columns
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
 */
-int init_networks() {
+static inline void fixed_out_layer(const sinapsi_t* s, const layer_t* in,
+                layer_t* out, void (*gemv_fn)(const float*, const float*,
+                const float*, float*, int), int worker, int num_workers) {
+    int first, last;
 
-    /**< File descriptor. */
-    FILE *fp;
-    int result;
+    worker_rows(s->card_out, worker, num_workers, &first, &last);
+
+    gemv_fn(s->weights + (size_t) first * s->card_in, s->bias + first,
+                        in->act_value, out->z_value + first, last - first);
+}
+
+/**< Name of the gemv specialized on C columns, C can be a macro. */
+#define GEMV_COLS(C)    GEMV_COLS_(C)
+#define GEMV_COLS_(C)   gemv_c##C
+
+/**< Hidden and output layers of a float model with 2 hidden layers. */
+#define DEFINE_HIDDEN_PASS_2(NAME, H1, H2)                                  \
+static void NAME(network_t* net, int worker, int num_workers) {             \
+    const model_t* model = net->model;                                      \
+    fixed_hid_layer(&model->hid_S[0], &net->hid_L[0], &net->hid_L[1],       \
+                                    GEMV_COLS(H1), worker, num_workers);    \
+    WORKER_MARK(net, worker, STAGE_HIDDEN(0));                              \
+    fixed_out_layer(&model->out_S, &net->hid_L[1], &net->out_L,             \
+                                    GEMV_COLS(H2), worker, num_workers);    \
+}
 
-    /**< Initilize all 3 different model structures. */
-    init_digits_net();
-    init_letters_net();
-    init_mixed_net();
+/**< Hidden and output layers of a float model with 3 hidden layers. */
+#define DEFINE_HIDDEN_PASS_3(NAME, H1, H2, H3)                              \
+static void NAME(network_t* net, int worker, int num_workers) {             \
+    const model_t* model = net->model;                                      \
+    fixed_hid_layer(&model->hid_S[0], &net->hid_L[0], &net->hid_L[1],       \
+                                    GEMV_COLS(H1), worker, num_workers);    \
+    WORKER_MARK(net, worker, STAGE_HIDDEN(0));                              \
+    fixed_hid_layer(&model->hid_S[1], &net->hid_L[1], &net->hid_L[2],       \
+                                    GEMV_COLS(H2), worker, num_workers);    \
+    WORKER_MARK(net, worker, STAGE_HIDDEN(1));                              \
+    fixed_out_layer(&model->out_S, &net->hid_L[2], &net->out_L,             \
+                                    GEMV_COLS(H3), worker, num_workers);    \
+}
 
-    fp = fopen(digits_filename, "r");
+/**< 784-64-32-10 */
+DEFINE_HIDDEN_PASS_2(digits_hidden_pass, DIGIT_HID_SIZE_1, DIGIT_HID_SIZE_2)
+/**< 784-128-128-128-26 */
+DEFINE_HIDDEN_PASS_3(letters_hidden_pass, LET_HID_SIZE, LET_HID_SIZE,
+                                                                LET_HID_SIZE)
+/**< 784-512-512-512-47 */
+DEFINE_HIDDEN_PASS_3(mixed_hidden_pass, MIX_HID_SIZE, MIX_HID_SIZE,
+                                                                MIX_HID_SIZE)
 
-    if (fp == NULL)
-        return NN_ERROR_NO_FILE;
+/**< Topology of a model with a specialized pass. */
+typedef struct {
+    int num_hidden;                 /**< Number of hidden layers.*/
+    int hid_size[MAX_HID_NUM];      /**< Size of each hidden layer.*/
+    int out_size;                   /**< Size of the output layer.*/
+    hidden_pass_t pass;             /**< Specialized hidden pass.*/
+} topology_t;
+
+/**< Topologies known at compile time. */
+static const topology_t known_topology[] = {
+    { 2, { DIGIT_HID_SIZE_1, DIGIT_HID_SIZE_2 }, DIGIT_OUTPUT_SIZE,
+                                                        digits_hidden_pass },
+    { 3, { LET_HID_SIZE, LET_HID_SIZE, LET_HID_SIZE }, LETTER_OUTPUT_SIZE,
+                                                        letters_hidden_pass },
+    { 3, { MIX_HID_SIZE, MIX_HID_SIZE, MIX_HID_SIZE }, MIXED_OUTPUT_SIZE,
+                                                        mixed_hidden_pass }
+};
 
-    /**< Load weights and bias of the DIGITS model. */
-    result = load_input_sinapsi(fp, DIGITS);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
+/**
+* @brief Generic hidden and output layers of a model of any topology.
+*
+* @param  net is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void generic_hidden_pass(network_t* net, int worker, int num_workers) {
+    propagate_into_hid_layer(net, worker, num_workers);
+    propagate_to_out_layer(net, worker, num_workers);
+}
 
-    result = load_hidden_sinapsi(fp, DIGITS);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
+/**
+* @brief Select the hidden pass of a model from its topology.
+*
+* The specialized pass is used only if the layers of the model match exactly
+* one of the known topologies, use the logistic activation and their hidden
+* and output sinapsi are dense, otherwise the generic one is used. Defining
+* NN_GENERIC_FORWARD disables the specialized passes.
+*
+* @param  model is the model
+*/
+static void select_hidden_pass(model_t* model) {
+    int i, k;
+    int match;
+
+    model->hidden_pass = generic_hidden_pass;
+
+#ifndef NN_GENERIC_FORWARD
+    for (i = 0; i < (int) (sizeof(known_topology) / sizeof(topology_t)); 
+                                                                        ++i) {
+        match = model->activation == ACT_LOGISTIC &&
+                model->out_S.row_start == NULL &&
+                model->num_hidden == known_topology[i].num_hidden &&
+                model->in_S.card_out == known_topology[i].hid_size[0] &&
+                model->out_S.card_out == known_topology[i].out_size;
+
+        for (k = 0; match && k < model->num_hidden-1; ++k)
+            match = model->hid_S[k].row_start == NULL &&
+                    model->hid_S[k].card_out == 
+                                            known_topology[i].hid_size[k+1];
+
+        if (match) {
+            model->hidden_pass = known_topology[i].pass;
+            return;
+        }
+    }
+#endif
+}
 
-    result = load_out_sinapsi(fp, DIGITS);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
+/**
+* @brief Hidden and output layers of the forward pass of a worker.
+*
+* Only the float precision has a specialized pass, the int8 and the fp16
+* models, and the float ones while they are checked by report_quantization,
+* use the generic layers.
+*
+* @param  net is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void propagate_hidden(network_t* net, int worker, int num_workers) {
+    if (net->model->precision == NN_FP32)
+        net->model->hidden_pass(net, worker, num_workers);
+    else
+        generic_hidden_pass(net, worker, num_workers);
+}
 
-    fclose(fp);
+/**
+* @brief Share of a worker of the full forward pass.
+*
+* @param  arg is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void forward_job(void* arg, int worker, int num_workers) {
+    network_t* net = (network_t*) arg;
 
-    fp = fopen(letters_filename, "r");
+    propagate_from_in_layer(net, worker, num_workers);
+    WORKER_MARK(net, worker, STAGE_INPUT);
+    propagate_hidden(net, worker, num_workers);
+}
 
-    /**< Load weights and bias of the LETTERS model. */
-    result = load_input_sinapsi(fp, LETTERS);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
-    result = load_hidden_sinapsi(fp, LETTERS);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
-    result = load_out_sinapsi(fp, LETTERS);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
+/**
+* @brief Share of a worker of the forward pass after an incremental update.
+*
+* @param  arg is the model to be fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void update_job(void* arg, int worker, int num_workers) {
+    network_t* net = (network_t*) arg;
 
-    fclose(fp);
+    update_from_in_layer(net, worker, num_workers);
+    WORKER_MARK(net, worker, STAGE_INPUT);
+    propagate_hidden(net, worker, num_workers);
+}
 
-    fp = fopen(mixed_filename, "r");
+/**
+* @brief Feed forward the input layer until the output one.
+*
+* The layers are shared by num_workers workers, then the softmax function is
+* computed on the whole output layer. With a single worker nothing is run on
+* the pool, so it can be called by a job of the pool.
+*
+* @param  net is the model to be fed
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void forward_pass(network_t* net, int num_workers) {
+    pool_run(forward_job, net, num_workers);
+    TIMER_MARK(net, STAGE_OUTPUT(net));
 
-    /**< Load weights and bias of the MIXED model. */
-    result = load_input_sinapsi(fp, MIXED);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
-    result = load_hidden_sinapsi(fp, MIXED);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
-    result = load_out_sinapsi(fp, MIXED);
-    if (result == ERROR)
-        return NN_ERROR_READING_FILE;
+    softmax(net->out_L.z_value, net->out_L.act_value, net->out_L.num_neuron);
+    TIMER_MARK(net, STAGE_SOFTMAX(net));
 
-    fclose(fp);
+    net->delta_valid = 1;
+    net->delta_count = 0;
+}
 
-    active_net = DIGITS;
+/**
+* @brief Feed forward the input layer after an incremental update of the
+* first hidden layer.
+*
+* @param  net is the model to be fed
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void update_pass(network_t* net, int num_workers) {
+    pool_run(update_job, net, num_workers);
+    TIMER_MARK(net, STAGE_OUTPUT(net));
 
-    pthread_mutex_init(&actual_model_mutex, NULL);
+    softmax(net->out_L.z_value, net->out_L.act_value, net->out_L.num_neuron);
+    TIMER_MARK(net, STAGE_SOFTMAX(net));
 
-    return NN_SUCCESS;
-};
+    net->delta_count++;
+}
 
 /**
-* @brief Compute the output of the active neural network.
+* @brief Fill the input layer of a model with a binary image.
 *
-* Utilizing the fuction defined before, this function compute the output of
-* the neural network corresponding to the input image. It will use
-* the requested network model (protected by a mutex), feeding the image to its 
-* input layer and fowarding it until the output one. The result is passed 
-* filling a specific global struct (protected by a mutex) containg the 
-* character recognized by the network with the relative percentage.
+* It lists the active pixels and the ones changed since the previous frame
+* of the same model.
 *
+* @param  net is the model to be fed
+* @param  pixels are the INPUT_SIZE pixels of the image, 1 if black
 */
+static void fill_input(network_t* net, const unsigned char* pixels) {
 
-void recognize_character(BITMAP* image) {
+    int i;
 
-    int i, j;           /**< Loop counter. */
+    net->num_active = 0;
+    net->num_flipped = 0;
 
-    float max_prob = 0;         /**< Max value of the resulting prob. */
-    int max_prob_index = -1;    /**< Neuron with the max prob. */
+    for (i = 0; i < INPUT_SIZE; ++i) {
+        if (net->in_L.act_value[i] != pixels[i])
+            net->flipped_in[net->num_flipped++] = i;
 
-    /**< Read the requested active model. */
-    pthread_mutex_lock(&actual_model_mutex);
-    active_net = requested_model;
-    pthread_mutex_unlock(&actual_model_mutex);
+        net->in_L.z_value[i]   = pixels[i];
+        net->in_L.act_value[i] = pixels[i];
 
-    /**< Fill the input layer of the active model. */
-    for (i = 0; i < INPUT_DIM; ++i) {
-        for (j = 0; j < INPUT_DIM; ++j) {            
-            if (getpixel(image, i, j) == BLACK) {
-                neural_network[active_net].in_L.z_value[i*INPUT_DIM + j]   = 1;
-                neural_network[active_net].in_L.act_value[i*INPUT_DIM + j] = 1;
-            }
-            else {
-                neural_network[active_net].in_L.z_value[i*INPUT_DIM + j]   = 0;
-                neural_network[active_net].in_L.act_value[i*INPUT_DIM + j] = 0;
-            }
-            
-            
-        }
+        if (pixels[i])
+            net->active_in[net->num_active++] = i;
     }
+}
 
-    propagate_from_in_layer();
+/**
+* @brief Compute the output layer of a model from its filled input layer.
+*
+* The previous first hidden layer is updated when few pixels changed and
+* nothing has to be computed if the input is the same, otherwise the full
+* forward pass is computed.
+*
+* @param  net is the model to be fed
+* @param  num_workers is the number of workers of the forward pass
+*/
+static void infer(network_t* net, int num_workers) {
+    if (net->delta_valid && net->num_flipped < net->num_active &&
+                                        net->delta_count < DELTA_MAX_UPDATES) {
+        if (net->num_flipped > 0)
+            update_pass(net, num_workers);
+    }
+    else {
+        forward_pass(net, num_workers);
+    }
+}
 
-    propagate_into_hid_layer();
+/**
+* @brief Share of a worker of the inference of all the models.
+*
+* Each worker computes whole models on its own, the models are assigned to
+* the workers in turn.
+*
+* @param  arg is the context whose models are fed
+* @param  worker is the index of the worker
+* @param  num_workers is the number of workers
+*/
+static void all_models_job(void* arg, int worker, int num_workers) {
 
-    propagate_to_out_layer();
+    int i;
+    nn_context_t* ctx = (nn_context_t*) arg;
 
-    /**< Search the max probability among all output neuron. */
-    for (i = 0; i <  neural_network[active_net].out_L.num_neuron; ++i) {
-        if (max_prob < neural_network[active_net].out_L.act_value[i]) {
-            max_prob = neural_network[active_net].out_L.act_value[i];
-            max_prob_index = i;
+    for (i = MIXED - worker; i >= DIGITS; i -= num_workers)
+        if (ctx->ready[i]) {
+            /**< The wait of the worker is not part of a stage. */
+            TIMER_RESTART(&ctx->net[i]);
+            infer(&ctx->net[i], 1);
         }
+}
+
+/**
+* @brief Weighted sums of a sinapsi for a batch in the precision of the model.
+*
+* It is the batch version of weighted_sum, the rows of the batch are fed to
+* a gemm so that each row of weights is read once for the whole batch. In 
+* int8 precision each row of the incoming layer is quantized on its own.
+*
+* @param  net is the model to be fed
+* @param  sinapsi is the sinapsi between the two layers
+* @param  in is the incoming layer
+* @param  z_value is the batch of weighted inputs of the outgoing layer
+* @param  n is the number of inputs of the batch
+*/
+static void batch_weighted_sum(const network_t* net, const sinapsi_t* sinapsi,
+                                        layer_t* in, float* z_value, int n) {
+    int b;
+    int card_in = sinapsi->card_in;
+
+    if (sinapsi->row_start != NULL && net->model->precision != NN_INT8) {
+        spmm(sinapsi->row_start, sinapsi->col_index, sinapsi->s_weights, 
+                                sinapsi->bias, in->batch_act_value, z_value, 
+                                sinapsi->card_out, card_in, n);
+        return;
     }
 
-    /**< Write the output of the network in the global varible. */
-    switch(active_net) {
-        case DIGITS:
-            if(max_prob_index >= 0) {
-                nn_result.rec_char = digits_map[max_prob_index];
-                nn_result.prob = max_prob * 100;
-            }
+    switch (net->model->precision) {
+        case NN_INT8:
+            for (b = 0; b < n; ++b)
+                in->batch_q_scale[b] = quantize_i8(
+                                            in->batch_act_value + b * card_in,
+                                            in->batch_q_act_value + b * card_in,
+                                            card_in);
+            if (sinapsi->row_start != NULL)
+                spmm_i8(sinapsi->row_start, sinapsi->col_index, 
+                        sinapsi->sq_weights, sinapsi->q_scale, sinapsi->bias,
+                        in->batch_q_act_value, in->batch_q_scale, z_value, 
+                        sinapsi->card_out, card_in, n);
+            else
+                gemm_i8(sinapsi->q_weights, sinapsi->q_scale, sinapsi->bias, 
+                        in->batch_q_act_value, in->batch_q_scale, z_value, 
+                        sinapsi->card_out, card_in, n);
             break;
-        case LETTERS:
-            if(max_prob_index >= 0) {
-                nn_result.rec_char = letters_map[max_prob_index];
-                nn_result.prob = max_prob * 100;
-            }
-            break;
-        case MIXED:
-            if(max_prob_index >= 0) {
-                nn_result.rec_char = mixed_map[max_prob_index];
-                nn_result.prob = max_prob * 100;
-            }
+        case NN_FP16:
+            gemm_f16(sinapsi->h_weights, sinapsi->bias, in->batch_act_value, 
+                                    z_value, sinapsi->card_out, card_in, n);
             break;
         default:
+            if (sinapsi->p_weights != NULL)
+                gemm_panels(sinapsi->p_weights, sinapsi->bias, 
+                                in->batch_act_value, z_value, 
+                                sinapsi->card_out, card_in, n);
+            else
+                gemm(sinapsi->weights, sinapsi->bias, in->batch_act_value, 
+                                z_value, sinapsi->card_out, card_in, n);
             break;
     }
-}
\ No newline at end of file
+}
+
+/**
+* @brief Feed forward a batch from input layer to first hidden one.
+*
+* The input sinapsi is stored by columns, so each column is read once and 
+* added to the weighted sums of every input of the batch whose pixel is set.
+* As in propagate_from_in_layer, in int8 precision the columns are summed on
+* int32, in int8 and fp16 precision every active input counts as 1 and the
+* columns of a sparse sinapsi are added by add_sparse_column.
+*
+* @param  net is the model to be fed
+* @param  n is the number of inputs of the batch
+*/
+static void batch_propagate_from_in_layer(network_t* net, int n) {
+
+    int i, j, b;
+    float pixel;
+    const sinapsi_t* in_S = &net->model->in_S;
+    int card_in = in_S->card_in;
+    int card_out = in_S->card_out;
+    float* z_value = net->hid_L[0].batch_z_value;
+
+    for (b = 0; b < n; ++b) {
+        if (net->model->precision == NN_INT8)
+            memset(net->batch_q_sum + b * card_out, 0, card_out * sizeof(int));
+        else
+            memcpy(z_value + b * card_out, in_S->bias, 
+                                                    card_out * sizeof(float));
+    }
+
+    /**< z_value = [sum of ( weight * activation value )] + bias. */
+    for (j = 0; j < card_in; ++j) {
+        for (b = 0; b < n; ++b) {
+            pixel = net->in_L.batch_act_value[b * card_in + j];
+            if (pixel == 0)
+                continue;
+
+            if (in_S->row_start != NULL) {
+                add_sparse_column(net, j, 
+                            (net->model->precision == NN_FP32) ? pixel : 1, 
+                            net->batch_q_sum + b * card_out, 
+                            z_value + b * card_out, 0, card_out);
+                continue;
+            }
+
+            switch (net->model->precision) {
+                case NN_INT8:
+                    vector_add_i8(in_S->q_weights + j * card_out, 
+                                    net->batch_q_sum + b * card_out, card_out);
+                    break;
+                case NN_FP16:
+                    vector_add_f16(in_S->h_weights + j * card_out, 
+                                            z_value + b * card_out, card_out);
+                    break;
+                default:
+                    axpy(pixel, in_S->weights + j * card_out, 
+                                            z_value + b * card_out, card_out);
+                    break;
+            }
+        }
+    }
+
+    if (net->model->precision == NN_INT8)
+        for (b = 0; b < n; ++b)
+            for (i = 0; i < card_out; ++i)
+                z_value[b * card_out + i] = 
+                        net->batch_q_sum[b * card_out + i] * 
+                        in_S->q_scale[i] + in_S->bias[i];
+
+    hidden_activation(net->model, z_value, net->hid_L[0].batch_act_value, 
+                                                                n * card_out);
+}
+
+/**
+* @brief Feed forward a batch from the input layer until the output one.
+*
+* It is the batch version of forward_pass, the rows of the batch are stored
+* back to back in the batch arrays of each layer. The values of the single
+* input kept for the next frame are not modified.
+*
+* @param  net is the model to be fed
+* @param  n is the number of inputs of the batch
+*/
+static void batch_forward_pass(network_t* net, int n) {
+
+    int b, k;
+    int hid_num = net->model->num_hidden;
+    int card_out;
+
+    batch_propagate_from_in_layer(net, n);
+
+    for (k = 0; k < hid_num-1; ++k) {
+        batch_weighted_sum(net, &net->model->hid_S[k], &net->hid_L[k], 
+                                            net->hid_L[k+1].batch_z_value, n);
+        hidden_activation(net->model, net->hid_L[k+1].batch_z_value, 
+                                        net->hid_L[k+1].batch_act_value, 
+                                        n * net->hid_L[k+1].num_neuron);
+    }
+
+    batch_weighted_sum(net, &net->model->out_S, &net->hid_L[hid_num-1], 
+                                                net->out_L.batch_z_value, n);
+
+    card_out = net->model->out_S.card_out;
+    for (b = 0; b < n; ++b)
+        softmax(net->out_L.batch_z_value + b * card_out, 
+                        net->out_L.batch_act_value + b * card_out, card_out);
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Read a binary image from the input bitmap.
+*
+* @param  image is the input image of INPUT_DIM x INPUT_DIM
+* @param  pixels are the INPUT_SIZE pixels of the image, 1 if black
+*/
+static void read_input(BITMAP* image, unsigned char* pixels) {
+
+    int i, j;
+
+    for (i = 0; i < INPUT_DIM; ++i)
+        for (j = 0; j < INPUT_DIM; ++j)
+            pixels[i*INPUT_DIM + j] = (getpixel(image, i, j) == BLACK);
+}
+#endif
+
+/**
+* @brief Character of an output neuron of a model.
+*
+* @param  target is the index of the model in the registry
+* @param  index is the output neuron
+* @return the character of the neuron
+*/
+static char output_char(network_target target, int index) {
+    return registry_model(target)->labels[index];
+}
+
+/**
+* @brief Write the recognized characters of an output layer.
+*
+* It searches the NN_TOP_K max probabilities among all output neurons and 
+* maps them to the characters of the model, the first one is also written
+* as the recognized character. The whole output layer is copied in the 
+* result if the full probability copy is enabled. The result is not 
+* modified if every probability is 0.
+*
+* @param  target is the model which computed the probabilities
+* @param  prob is the act_value of the output layer
+* @param  result is the struct filled with the characters and percentages
+* @return 1 if the result is written, 0 otherwise
+*/
+static int write_result(network_target target, const float* prob, 
+                                                    data_network_t* result) {
+    int i, k;
+    int num_out = registry_model(target)->out_S.card_out;
+    int top[NN_TOP_K];          /**< Neurons with the max probs, sorted. */
+    int num_top = 0;
+
+    /**< Insert each output neuron in the sorted list of the max ones. */
+    for (i = 0; i < num_out; ++i) {
+        if (num_top < NN_TOP_K)
+            k = num_top++;
+        else if (prob[i] > prob[top[NN_TOP_K-1]])
+            k = NN_TOP_K-1;
+        else
+            continue;
+
+        while (k > 0 && prob[i] > prob[top[k-1]]) {
+            top[k] = top[k-1];
+            --k;
+        }
+        top[k] = i;
+    }
+
+    if (num_top == 0 || prob[top[0]] <= 0)
+        return 0;
+
+    /**< Write the output of the network in the result. */
+    result->model = target;
+    result->rec_char = output_char(target, top[0]);
+    result->prob = prob[top[0]] * 100;
+
+    result->num_top = num_top;
+    for (k = 0; k < num_top; ++k) {
+        result->top_char[k] = output_char(target, top[k]);
+        result->top_prob[k] = prob[top[k]] * 100;
+    }
+
+    if (full_probability) {
+        memcpy(result->prob_vector, prob, num_out * sizeof(float));
+        result->num_prob = num_out;
+    }
+    else {
+        result->num_prob = 0;
+    }
+
+    return 1;
+}
+
+/**
+* @brief Pack a binary input image in bits.
+*
+* @param  pixels are the INPUT_SIZE pixels of the image, 1 if black
+* @param  bits are the INPUT_WORDS words of the packed image
+*/
+static void pack_input(const unsigned char* pixels, unsigned int* bits) {
+
+    int i;
+
+    memset(bits, 0, INPUT_WORDS * sizeof(unsigned int));
+
+    for (i = 0; i < INPUT_SIZE; ++i)
+        bits[i / 32] |= (unsigned int) pixels[i] << (i % 32);
+}
+
+/**
+* @brief FNV-1a hash of a packed input image and of a model.
+*
+* @param  target is the model
+* @param  bits is the packed input image
+* @return the hash
+*/
+static unsigned int input_hash(network_target target, 
+                                                const unsigned int* bits) {
+    int i;
+    unsigned int hash = 2166136261u ^ (unsigned int) target;
+
+    for (i = 0; i < INPUT_WORDS; ++i)
+        hash = (hash ^ bits[i]) * 16777619u;
+
+    return hash;
+}
+
+/**
+* @brief Entry of the result cache of a model for an input.
+*
+* An entry matches only if its result has been computed by the same weights
+* of the model, from the same input and with the same copy of the output 
+* layer. The hash is compared first, the whole input only if it is equal.
+*
+* @param  ctx is the context of the cache
+* @param  net is the model of the context, fed with the live weights
+* @param  target is the model
+* @param  bits is the packed input image
+* @param  hash is the hash of the input and of the model
+* @return the entry, NULL if the cache has no result for the input
+*/
+static cache_entry_t* cache_find(nn_context_t* ctx, const network_t* net,
+                            network_target target, const unsigned int* bits,
+                            unsigned int hash) {
+    int i;
+    cache_entry_t* entry;
+
+    for (i = 0; i < CACHE_ENTRIES; ++i) {
+        entry = &ctx->cache[i];
+
+        if (entry->used != 0 && entry->hash == hash && 
+                entry->model == target && 
+                entry->generation == net->model->generation &&
+                entry->full_probability == full_probability &&
+                memcmp(entry->bits, bits, sizeof(entry->bits)) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/**
+* @brief Search the result of a model for an input in the cache.
+*
+* The hits and the misses of the context are counted.
+*
+* @param  ctx is the context of the cache
+* @param  net is the model of the context, fed with the live weights
+* @param  target is the model
+* @param  bits is the packed input image
+* @param  result is the struct filled with the stored result on a hit
+* @return 1 if the result is found, 0 otherwise
+*/
+static int cache_lookup(nn_context_t* ctx, const network_t* net, 
+                        network_target target, const unsigned int* bits, 
+                        data_network_t* result) {
+
+    cache_entry_t* entry;
+
+    if (NN_RESULT_CACHE == 0)
+        return 0;
+
+    entry = cache_find(ctx, net, target, bits, input_hash(target, bits));
+
+    if (entry != NULL) {
+        entry->used = ++ctx->cache_clock;
+        *result = entry->result;
+        __atomic_fetch_add(&ctx->cache_hits, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+
+    __atomic_fetch_add(&ctx->cache_misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+* @brief Store the result of a model for an input in the cache.
+*
+* The result replaces the one of the same input, if any, otherwise the one
+* of the least recently used entry.
+*
+* @param  ctx is the context of the cache
+* @param  net is the model of the context, fed with the live weights
+* @param  target is the model
+* @param  bits is the packed input image
+* @param  result is the result computed by the model
+*/
+static void cache_store(nn_context_t* ctx, const network_t* net, 
+                        network_target target, const unsigned int* bits, 
+                        const data_network_t* result) {
+    int i;
+    unsigned int hash;
+    cache_entry_t* entry;
+
+    if (NN_RESULT_CACHE == 0)
+        return;
+
+    hash = input_hash(target, bits);
+    entry = cache_find(ctx, net, target, bits, hash);
+
+    /**< The empty entries are the least recently used ones. */
+    if (entry == NULL) {
+        entry = &ctx->cache[0];
+        for (i = 1; i < CACHE_ENTRIES; ++i)
+            if (ctx->cache[i].used < entry->used)
+                entry = &ctx->cache[i];
+    }
+
+    entry->used = ++ctx->cache_clock;
+    entry->hash = hash;
+    memcpy(entry->bits, bits, sizeof(entry->bits));
+    entry->model = target;
+    entry->generation = net->model->generation;
+    entry->full_probability = full_probability;
+    entry->result = *result;
+}
+
+/**
+* @brief Compute a group of images of a batch and store their results.
+*
+* @param  ctx is the context of the caller
+* @param  net is the model of the context, its batch input rows are filled
+* @param  target is the model
+* @param  n is the number of images of the group
+* @param  group is the index in results of each image of the group
+* @param  bits are the packed images of the group
+* @param  results is the array of the results of the batch
+*/
+static void compute_group(nn_context_t* ctx, network_t* net, 
+            network_target target, int n, const int* group, 
+            unsigned int (*bits)[INPUT_WORDS], data_network_t* results) {
+    int b;
+
+    batch_forward_pass(net, n);
+
+    for (b = 0; b < n; ++b)
+        if (write_result(target, net->out_L.batch_act_value + 
+                        b * net->out_L.num_neuron, &results[group[b]]))
+            cache_store(ctx, net, target, bits[b], &results[group[b]]);
+}
+
+/**
+* @brief Draw a synthetic handwritten-like character.
+*
+* A few random thick strokes are drawn in the central part of the image, so
+* that the fraction of black pixels is similar to the one of the real 
+* characters.
+*
+* @param  pixels are the INPUT_SIZE pixels of the image, 1 if black
+* @param  seed is the state of the random generator
+*/
+static void synthetic_image(unsigned char* pixels, unsigned int* seed) {
+
+    int i, s, x, y, index;
+    int x_0, y_0, x_1, y_1;
+    int num_strokes = 2 + rand_r(seed) % 3;
+
+    memset(pixels, 0, INPUT_SIZE);
+
+    for (s = 0; s < num_strokes; ++s) {
+        x_0 = 4 + rand_r(seed) % (INPUT_DIM - 9);
+        y_0 = 4 + rand_r(seed) % (INPUT_DIM - 9);
+        x_1 = 4 + rand_r(seed) % (INPUT_DIM - 9);
+        y_1 = 4 + rand_r(seed) % (INPUT_DIM - 9);
+
+        for (i = 0; i <= 2 * INPUT_DIM; ++i) {
+            x = x_0 + (x_1 - x_0) * i / (2 * INPUT_DIM);
+            y = y_0 + (y_1 - y_0) * i / (2 * INPUT_DIM);
+
+            /**< Each point of the stroke is a 2x2 square. */
+            for (index = 0; index < 4; ++index)
+                pixels[(x + index / 2) * INPUT_DIM + y + index % 2] = 1;
+        }
+    }
+}
+
+/**
+* @brief Fill the input layer with a synthetic handwritten-like character.
+*
+* @param  net is the model to be fed
+* @param  seed is the state of the random generator
+*/
+static void synthetic_input(network_t* net, unsigned int* seed) {
+
+    unsigned char pixels[INPUT_SIZE];   /**< Binary input image. */
+
+    synthetic_image(pixels, seed);
+    fill_input(net, pixels);
+}
+
+/**
+* @brief Compare the int8 or fp16 model with the float one.
+*
+* The same synthetic inputs are fed to the model in both precisions and the
+* agreement of the recognized characters and the largest difference of the
+* output probabilities are printed. The float pass uses a copy of the model,
+* which shares its weights.
+*
+* @param  model is the model to be compared, its precision is already set
+* @param  num_workers is the number of workers of the forward passes
+*/
+static void report_quantization(const model_t* model, int num_workers) {
+
+    int i, k;
+    int ref_index, q_index;         /**< Recognized neurons. */
+    int agreement = 0;              /**< Inputs with the same result. */
+    float delta, max_delta = 0;     /**< Probability differences. */
+    float sum_delta = 0;
+    unsigned int seed = 1;          /**< Fixed seed, repeatable reports. */
+    model_t ref_model = *model;     /**< Float copy of the model. */
+    network_t test_net;             /**< Layers fed with the inputs. */
+    network_t* net = &test_net;
+    float* ref_prob;
+
+    ref_model.precision = NN_FP32;
+
+    if (alloc_network(net, model) == ERROR)
+        return;
+
+    ref_prob = (float*) malloc(net->out_L.num_neuron * sizeof(float));
+    if (ref_prob == NULL) {
+        free_network(net);
+        return;
+    }
+
+    for (k = 0; k < QUANT_REPORT_INPUTS; ++k) {
+        synthetic_input(net, &seed);
+
+        net->model = &ref_model;
+        forward_pass(net, num_workers);
+        memcpy(ref_prob, net->out_L.act_value, 
+                                    net->out_L.num_neuron * sizeof(float));
+
+        net->model = model;
+        forward_pass(net, num_workers);
+
+        ref_index = q_index = 0;
+        for (i = 0; i < net->out_L.num_neuron; ++i) {
+            if (ref_prob[i] > ref_prob[ref_index])
+                ref_index = i;
+            if (net->out_L.act_value[i] > net->out_L.act_value[q_index])
+                q_index = i;
+
+            delta = fabsf(ref_prob[i] - net->out_L.act_value[i]);
+            sum_delta += delta;
+            if (delta > max_delta)
+                max_delta = delta;
+        }
+
+        agreement += (ref_index == q_index);
+    }
+
+    printf("%s %s model: %.2f%% same result, prob delta max %.2f%% "
+            "mean %.4f%% on %d synthetic inputs\n", model->name,
+            precision_names[model->precision],
+            100.0 * agreement / QUANT_REPORT_INPUTS, 100 * max_delta,
+            100 * sum_delta / (QUANT_REPORT_INPUTS * net->out_L.num_neuron),
+            QUANT_REPORT_INPUTS);
+
+    free(ref_prob);
+    free_network(net);
+}
+
+/**
+* @brief Mark the start of an inference of a context.
+*
+* The weights replaced by reload_model are released only when no context
+* is inside an inference started before the swap.
+*
+* @param  ctx is the context
+*/
+static void begin_inference(nn_context_t* ctx) {
+    __atomic_add_fetch(&ctx->inference, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+* @brief Mark the end of an inference of a context.
+*
+* @param  ctx is the context
+*/
+static void end_inference(nn_context_t* ctx) {
+    __atomic_add_fetch(&ctx->inference, 1, __ATOMIC_RELEASE);
+}
+
+/**
+* @brief Network of a context fed with the current weights of a model.
+*
+* It must be called inside an inference. If the weights have been reloaded
+* since the previous frame of the context, the first hidden layer kept from
+* it is discarded. A reload is detected by the generation of the weights, 
+* not by their address: the new weights can be allocated where the replaced
+* ones were freed.
+*
+* @param  ctx is the context
+* @param  target is the index of the model in the registry
+* @return the network of the model
+*/
+static network_t* context_net(nn_context_t* ctx, int target) {
+
+    network_t* net = &ctx->net[target];
+    const model_t* model = live_weights(target);
+
+    if (net->generation != model->generation) {
+        net->generation = model->generation;
+        net->delta_valid = 0;
+    }
+
+    net->model = model;
+    return net;
+}
+
+/**
+* @brief Wait the end of the inferences running on the replaced weights.
+*
+* Each context inside an inference when the function is called is waited 
+* until its inference ends, the following ones already use the new weights.
+* The contexts are listed under context_mutex and waited without it, so
+* create_context and free_context are not blocked. A waited context is 
+* marked, free_context waits the mark to be cleared before releasing it. 
+* The reloads are serialized, so one call at time uses wait_next.
+*/
+static void wait_contexts() {
+
+    unsigned int count;
+    struct timespec pause = { 0, 1000000 };     /**< 1 ms between checks. */
+    nn_context_t *ctx, *next;
+    nn_context_t* waited = NULL;                /**< Contexts to wait. */
+
+    pthread_mutex_lock(&context_mutex);
+    for (ctx = context_list; ctx != NULL; ctx = ctx->next) {
+        count = __atomic_load_n(&ctx->inference, __ATOMIC_SEQ_CST);
+
+        if (count % 2) {
+            __atomic_store_n(&ctx->waited, count, __ATOMIC_RELAXED);
+            ctx->wait_next = waited;
+            waited = ctx;
+        }
+    }
+    pthread_mutex_unlock(&context_mutex);
+
+    for (ctx = waited; ctx != NULL; ctx = next) {
+        next = ctx->wait_next;
+        count = ctx->waited;
+
+        while (__atomic_load_n(&ctx->inference, __ATOMIC_ACQUIRE) == count)
+            nanosleep(&pause, NULL);
+
+        __atomic_store_n(&ctx->waited, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**< Functions of the forward pass used by the registry of the models. */
+static const model_hooks_t forward_hooks = { 
+    report_quantization, select_hidden_pass, wait_contexts 
+};
+
+/**
+* GLOBAL FUNCTIONS
+*/
+
+/**
+* @brief Configure the cascade mode of recognize_character.
+*
+* Each frame is fed to order[0] first, and it escalates to the next model of
+* the order while the percentage of the recognized character is below the
+* threshold of the model. The threshold of the last model is not used. It 
+* can be called at any time, num_stages equal to 0 disables the cascade.
+*
+* @param  order are the models of the cascade, each one at most once
+* @param  threshold are the percentages [0, 100] of each model
+* @param  num_stages is the number of models of the cascade [0, 3]
+*/
+void set_cascade(const network_target* order, const float* threshold, 
+                                                            int num_stages) {
+    int i;
+
+    if (num_stages < 0)
+        num_stages = 0;
+    if (num_stages > MIXED + 1)
+        num_stages = MIXED + 1;
+
+    pthread_mutex_lock(&actual_model_mutex);
+    for (i = 0; i < num_stages; ++i) {
+        cascade_order[i] = order[i];
+        cascade_threshold[i] = threshold[i];
+    }
+    cascade_stages = num_stages;
+    pthread_mutex_unlock(&actual_model_mutex);
+}
+
+/**
+* @brief Enable the copy of the whole output layer in the results.
+*
+* It must be called before the recognition starts, the copy is disabled by
+* default unless NN_FULL_PROBABILITY is defined to 1.
+*
+* @param  enable is 1 to copy the output layer, 0 to write only the top ones
+*/
+void set_full_probability(int enable) {
+    full_probability = enable;
+}
+
+/**
+* @brief Character of an output neuron of a model.
+*
+* It maps the indexes of prob_vector to the characters of the model.
+*
+* @param  target is the model {DIGITS, LETTERS, MIXED}
+* @param  index is the output neuron
+* @return the character of the neuron, '\0' if the index is not valid
+*/
+char output_character(network_target target, int index) {
+    if (index < 0 || index >= registry_model(target)->out_S.card_out)
+        return '\0';
+
+    return output_char(target, index);
+}
+
+/**
+* @brief Initialize the models of the registry.
+*
+* Using the function defined before, this function load all the weights 
+* and bias of all models after initialize the structs of all of them. 
+* The models are registered by models_init (see nn_models.c), only the 
+* requested model is loaded before the function returns, the other ones are
+* loaded by a background thread (see model_ready).
+*
+* @return NN_SUCCESS or an error code of nn_handler.h
+*/
+int init_networks() {
+
+    int result;
+    int workers;        /**< Workers available for the forward pass. */
+    network_target first = requested_model;
+
+    /**< Create the workers shared by the large models. */
+    workers = pool_init(NN_MAX_WORKERS, PRIO_NN);
+
+    /**< The requested model is needed by the first frame, load it now. */
+    if (first < DIGITS || first > MIXED)
+        first = DIGITS;
+
+    result = models_init(first, workers, &forward_hooks);
+    if (result != NN_SUCCESS)
+        return result;
+
+    /**< Context of the global recognition functions. */
+    main_context = create_context();
+    if (main_context == NULL)
+        return NN_ERROR_NO_MEMORY;
+
+    pthread_mutex_init(&actual_model_mutex, NULL);
+
+    /**< Load the other models while the recognition starts. */
+    return models_start();
+};
+
+/**
+* @brief Release the memory of the models of the registry.
+*
+* The watch of the model files and the background loading are stopped 
+* before, the model being loaded is completed.
+*/
+void free_networks() {
+
+    models_free();
+    pool_free();
+
+    free_context(main_context);
+    main_context = NULL;
+}
+
+/**
+* @brief Create an inference context.
+*
+* The context holds the layers of each model fed with the images of its 
+* caller and the first hidden layers kept from its previous frame, while the
+* weights are shared by all the contexts. Different threads can run the 
+* recognition at the same time, each one on its own context. The models 
+* shared by many workers run one at time on the pool. It must be called 
+* after init_networks.
+*
+* @return the context, NULL if there is not enough memory
+*/
+nn_context_t* create_context() {
+
+    int i;
+    nn_context_t* ctx = (nn_context_t*) calloc(1, sizeof(nn_context_t));
+
+    if (ctx == NULL)
+        return NULL;
+
+    for (i = 0; i < count_models(); ++i) {
+        if (alloc_network(&ctx->net[i], registry_model(i)) == ERROR) {
+            free_context(ctx);
+            return NULL;
+        }
+    }
+
+    ctx->active_net = DIGITS;
+
+    pthread_mutex_lock(&context_mutex);
+    ctx->next = context_list;
+    context_list = ctx;
+    pthread_mutex_unlock(&context_mutex);
+
+    return ctx;
+}
+
+/**
+* @brief Release an inference context.
+*
+* It must be called outside an inference of the context. If a reload is 
+* still checking the end of its last inference, see wait_contexts, the 
+* release waits for it.
+*
+* @param  ctx is the context created by create_context
+*/
+void free_context(nn_context_t* ctx) {
+
+    int i;
+    nn_context_t** link;
+    struct timespec pause = { 0, 1000000 };     /**< 1 ms between checks. */
+
+    if (ctx == NULL)
+        return;
+
+    pthread_mutex_lock(&context_mutex);
+    for (link = &context_list; *link != NULL; link = &(*link)->next) {
+        if (*link == ctx) {
+            *link = ctx->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&context_mutex);
+
+    /**< A reload can still be reading the counter of its last inference. */
+    while (__atomic_load_n(&ctx->waited, __ATOMIC_ACQUIRE))
+        nanosleep(&pause, NULL);
+
+    for (i = 0; i < NN_MAX_MODELS; ++i)
+        free_network(&ctx->net[i]);
+
+    free(ctx);
+}
+
+/**
+* @brief Read the input image of the network from a gray frame.
+*
+* The square ROI of the frame is cropped, area-averaged down to INPUT_DIM x 
+* INPUT_DIM and binarized with BINARY_THRESHOLD in a single pass over its
+* pixels, so the camera buffer is fed to the models without any bitmap.
+* The pixels are written in the layout of the input layer: the pixel of 
+* column x and row y is input[x * INPUT_DIM + y].
+*
+* @param  frame is the first pixel of the frame, 8-bit gray levels
+* @param  stride is the distance in pixels between two rows of the frame
+* @param  x is the left column of the ROI, inside the frame
+* @param  y is the top row of the ROI, inside the frame
+* @param  size is the side of the ROI in pixels, inside the frame
+* @param  input are the INPUT_SIZE pixels of the image, 1 if black
+*/
+void extract_input(const unsigned char* frame, int stride, int x, int y, 
+                                        int size, unsigned char* input) {
+    downsample_binarize(frame + y * stride + x, stride, size, INPUT_DIM, 
+                            BINARY_THRESHOLD, input, 1, INPUT_DIM);
+}
+
+/**
+* @brief Compute the output of a model for an image of a context.
+*
+* The image is fed to the input layer of the model and forwarded until the
+* output one, the result is written in the struct of the caller. A change of
+* model discards the first hidden layer kept from the previous frame. If the
+* model is still loading, the first model computes the result in its place.
+* A result already computed for the same image is taken from the cache.
+*
+* @param  ctx is the context of the caller
+* @param  target is the model {DIGITS, LETTERS, MIXED}
+* @param  input are the INPUT_SIZE pixels of the image, see extract_input
+* @param  result is the struct filled with the recognized character
+*/
+void context_recognize_input(nn_context_t* ctx, network_target target, 
+                        const unsigned char* input, data_network_t* result) {
+
+    unsigned int bits[INPUT_WORDS];     /**< Packed input image. */
+    network_t* net;
+
+    begin_inference(ctx);
+
+    target = usable_model(target);
+    net = context_net(ctx, target);
+
+    if (ctx->active_net != target)
+        net->delta_valid = 0;
+    ctx->active_net = target;
+
+    pack_input(input, bits);
+
+    /**< Fill the input layer of the model and compute its output. */
+    if (!cache_lookup(ctx, net, target, bits, result)) {
+        TIMER_START(net);
+        fill_input(net, input);
+        TIMER_MARK(net, STAGE_FILL);
+        infer(net, net->model->num_workers);
+
+        if (write_result(target, net->out_L.act_value, result))
+            cache_store(ctx, net, target, bits, result);
+        TIMER_MARK(net, STAGE_ARGMAX(net));
+        TIMER_RECORD(target, net);
+    }
+
+    end_inference(ctx);
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of a model for an image of a context.
+*
+* See context_recognize_input.
+*
+* @param  ctx is the context of the caller
+* @param  target is the model {DIGITS, LETTERS, MIXED}
+* @param  image is the input image of INPUT_DIM x INPUT_DIM
+* @param  result is the struct filled with the recognized character
+*/
+void context_recognize_character(nn_context_t* ctx, network_target target, 
+                                    BITMAP* image, data_network_t* result) {
+
+    unsigned char pixels[INPUT_SIZE];   /**< Binary input image. */
+
+    read_input(image, pixels);
+    context_recognize_input(ctx, target, pixels, result);
+}
+#endif
+
+/**
+* @brief Compute the output of the models of a cascade for an image of a 
+* context.
+*
+* The models are computed in order until the percentage of one of them 
+* reaches its threshold, the last one is always accepted. The result of the
+* last computed model is written. The models still loading are skipped, if 
+* none is ready the first model is used. The result of each model can be 
+* taken from the cache.
+*
+* @param  ctx is the context of the caller
+* @param  order are the models of the cascade, each one at most once
+* @param  threshold are the percentages [0, 100] of each model
+* @param  num_stages is the number of models of the cascade [1, 3]
+* @param  input are the INPUT_SIZE pixels of the image, see extract_input
+* @param  result is the struct filled with the recognized character
+*/
+void context_recognize_cascade_input(nn_context_t* ctx, 
+                    const network_target* order, const float* threshold, 
+                    int num_stages, const unsigned char* input, 
+                    data_network_t* result) {
+
+    int i;
+    int computed = 0;                   /**< Number of computed models. */
+    unsigned int bits[INPUT_WORDS];     /**< Packed input image. */
+    network_t* net;
+
+    begin_inference(ctx);
+
+    pack_input(input, bits);
+
+    for (i = 0; i < num_stages; ++i) {
+        if (!wait_model(order[i], NN_LOAD_WAIT_MS))
+            continue;
+
+        net = context_net(ctx, order[i]);
+
+        if (!cache_lookup(ctx, net, order[i], bits, result)) {
+            TIMER_START(net);
+            fill_input(net, input);
+            TIMER_MARK(net, STAGE_FILL);
+            infer(net, net->model->num_workers);
+
+            if (write_result(order[i], net->out_L.act_value, result))
+                cache_store(ctx, net, order[i], bits, result);
+            TIMER_MARK(net, STAGE_ARGMAX(net));
+            TIMER_RECORD(order[i], net);
+        }
+        ++computed;
+
+        if (result->prob >= threshold[i])
+            break;
+    }
+
+    end_inference(ctx);
+
+    if (computed == 0)
+        context_recognize_input(ctx, fallback_model(), input, result);
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of the models of a cascade for an image of a 
+* context.
+*
+* See context_recognize_cascade_input.
+*
+* @param  ctx is the context of the caller
+* @param  order are the models of the cascade, each one at most once
+* @param  threshold are the percentages [0, 100] of each model
+* @param  num_stages is the number of models of the cascade [1, 3]
+* @param  image is the input image of INPUT_DIM x INPUT_DIM
+* @param  result is the struct filled with the recognized character
+*/
+void context_recognize_cascade(nn_context_t* ctx, const network_target* order,
+                            const float* threshold, int num_stages, 
+                            BITMAP* image, data_network_t* result) {
+
+    unsigned char pixels[INPUT_SIZE];   /**< Binary input image. */
+
+    read_input(image, pixels);
+    context_recognize_cascade_input(ctx, order, threshold, num_stages, 
+                                                            pixels, result);
+}
+#endif
+
+/**
+* @brief Compute the output of all the models for an image of a context.
+*
+* The same input image is fed to the 3 models, which are computed at the 
+* same time by different workers of the pool, each model on a single one. 
+* Since every model is fed with every frame, each one keeps its first hidden
+* layer for the incremental update of the next frame. The models still
+* loading are not waited, their results are empty. The models whose result
+* is in the cache are not computed.
+*
+* @param  ctx is the context of the caller
+* @param  input are the INPUT_SIZE pixels of the image, see extract_input
+* @param  results are the 3 structs filled with the result of each model
+*/
+void context_recognize_all_input(nn_context_t* ctx, 
+                    const unsigned char* input, data_network_t* results) {
+
+    int i;
+    unsigned int bits[INPUT_WORDS];     /**< Packed input image. */
+    int hit[MIXED + 1] = { 0 };         /**< Results found in the cache. */
+    network_t* net;
+
+    begin_inference(ctx);
+
+    pack_input(input, bits);
+
+    /**< Only the models to be computed are ready for all_models_job. */
+    for (i = DIGITS; i <= MIXED; ++i) {
+        ctx->ready[i] = model_ready(i);
+        if (!ctx->ready[i])
+            continue;
+
+        net = context_net(ctx, i);
+        hit[i] = cache_lookup(ctx, net, i, bits, &results[i]);
+        if (hit[i]) {
+            ctx->ready[i] = 0;
+        }
+        else {
+            TIMER_START(net);
+            fill_input(net, input);
+            TIMER_MARK(net, STAGE_FILL);
+        }
+    }
+
+    pool_run(all_models_job, ctx, MIXED + 1);
+
+    for (i = DIGITS; i <= MIXED; ++i) {
+        if (hit[i]) {
+            ctx->ready[i] = 1;
+        }
+        else if (ctx->ready[i]) {
+            /**< The wait of the other models is not part of a stage. */
+            TIMER_RESTART(&ctx->net[i]);
+
+            if (write_result(i, ctx->net[i].out_L.act_value, &results[i]))
+                cache_store(ctx, &ctx->net[i], i, bits, &results[i]);
+            TIMER_MARK(&ctx->net[i], STAGE_ARGMAX(&ctx->net[i]));
+            TIMER_RECORD(i, &ctx->net[i]);
+        }
+        else {
+            memset(&results[i], 0, sizeof(data_network_t));
+            results[i].model = i;
+        }
+    }
+
+    end_inference(ctx);
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of all the models for an image of a context.
+*
+* See context_recognize_all_input.
+*
+* @param  ctx is the context of the caller
+* @param  image is the input image of INPUT_DIM x INPUT_DIM
+* @param  results are the 3 structs filled with the result of each model
+*/
+void context_recognize_all_characters(nn_context_t* ctx, BITMAP* image, 
+                                                    data_network_t* results) {
+
+    unsigned char pixels[INPUT_SIZE];   /**< Binary input image. */
+
+    read_input(image, pixels);
+    context_recognize_all_input(ctx, pixels, results);
+}
+#endif
+
+/**
+* @brief Compute the output of a model for a batch of input images of a 
+* context.
+*
+* The images are fed to the model in groups of BATCH_SIZE: each layer is 
+* computed as a small gemm, so the weights are streamed from memory once per
+* group instead of once per image. The layers kept for the next frame of the
+* context are not touched, the batch uses its own arrays. The images whose
+* result is in the cache are not fed to the model.
+*
+* @param  ctx is the context of the caller
+* @param  target is the model {DIGITS, LETTERS, MIXED}
+* @param  inputs are the INPUT_SIZE pixels of each image, back to back
+* @param  num_inputs is the number of images
+* @param  results is the array of num_inputs results, in the same order
+*/
+void context_recognize_inputs(nn_context_t* ctx, network_target target,
+                                const unsigned char* inputs, int num_inputs,
+                                data_network_t* results) {
+
+    int i, k;                       /**< Loop counter. */
+    int n = 0;                      /**< Size of the current group. */
+    int group[BATCH_SIZE];          /**< Image of each row of the group. */
+    const unsigned char* pixels;                /**< Binary input image. */
+    unsigned int bits[BATCH_SIZE][INPUT_WORDS]; /**< Packed images. */
+    float* in;                      /**< Input row of an image. */
+    network_t* net;
+
+    begin_inference(ctx);
+
+    target = usable_model(target);
+    net = context_net(ctx, target);
+
+    for (k = 0; k < num_inputs; ++k) {
+        pixels = inputs + (size_t) k * INPUT_SIZE;
+        pack_input(pixels, bits[n]);
+
+        if (cache_lookup(ctx, net, target, bits[n], &results[k]))
+            continue;
+
+        /**< Fill one input row for each image of the group. */
+        in = net->in_L.batch_act_value + n * net->in_L.num_neuron;
+        for (i = 0; i < INPUT_SIZE; ++i)
+            in[i] = pixels[i];
+        group[n++] = k;
+
+        if (n == BATCH_SIZE) {
+            compute_group(ctx, net, target, n, group, bits, results);
+            n = 0;
+        }
+    }
+
+    if (n > 0)
+        compute_group(ctx, net, target, n, group, bits, results);
+
+    end_inference(ctx);
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of a model for a batch of images of a context.
+*
+* The images are read in groups of BATCH_SIZE, see context_recognize_inputs.
+*
+* @param  ctx is the context of the caller
+* @param  target is the model {DIGITS, LETTERS, MIXED}
+* @param  images are the num_images input images of INPUT_DIM x INPUT_DIM
+* @param  num_images is the number of images
+* @param  results is the array of num_images results, in the same order
+*/
+void context_recognize_characters(nn_context_t* ctx, network_target target,
+                BITMAP** images, int num_images, data_network_t* results) {
+
+    int i, k, n;                    /**< Loop counters, size of the group. */
+    unsigned char pixels[BATCH_SIZE * INPUT_SIZE];  /**< Binary images. */
+
+    for (k = 0; k < num_images; k += n) {
+        n = num_images - k < BATCH_SIZE ? num_images - k : BATCH_SIZE;
+
+        for (i = 0; i < n; ++i)
+            read_input(images[k + i], pixels + i * INPUT_SIZE);
+
+        context_recognize_inputs(ctx, target, pixels, n, results + k);
+    }
+}
+#endif
+
+/**
+* @brief Compute the output of the active neural network.
+*
+* Utilizing the fuction defined before, this function compute the output of
+* the neural network corresponding to the input image. It will use
+* the requested network model (protected by a mutex), feeding the image to its 
+* input layer and fowarding it until the output one. The result is passed 
+* filling a specific global struct (protected by a mutex) containg the 
+* character recognized by the network with the relative percentage.
+*
+* In the cascade mode the requested model is ignored: the models of the 
+* cascade are computed in order until the percentage of one of them reaches
+* its threshold, and the result of the last computed model is written.
+*
+* The global functions share a single context, so only one thread at time 
+* can call them.
+*
+* @param  input are the INPUT_SIZE pixels of the image, see extract_input
+*/
+void recognize_input(const unsigned char* input) {
+
+    int i;                              /**< Loop counter. */
+    network_target target;              /**< Requested model. */
+
+    int num_stages;                     /**< Local copy of the cascade. */
+    network_target order[3];
+    float threshold[3];
+
+    /**< Read the requested active model and copy the cascade, they can be */
+    /**< changed by the other tasks. */
+    pthread_mutex_lock(&actual_model_mutex);
+    target = requested_model;
+
+    num_stages = cascade_stages;
+    for (i = 0; i < num_stages; ++i) {
+        order[i] = cascade_order[i];
+        threshold[i] = cascade_threshold[i];
+    }
+    pthread_mutex_unlock(&actual_model_mutex);
+
+    /**< Write the output of the network in the global varible. */
+    if (num_stages > 0)
+        context_recognize_cascade_input(main_context, order, threshold, 
+                                            num_stages, input, &nn_result);
+    else
+        context_recognize_input(main_context, target, input, &nn_result);
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of the active neural network for an image.
+*
+* See recognize_input.
+*
+* @param  image is the input image of INPUT_DIM x INPUT_DIM
+*/
+void recognize_character(BITMAP* image) {
+
+    unsigned char pixels[INPUT_SIZE];   /**< Binary input image. */
+
+    read_input(image, pixels);
+    recognize_input(pixels);
+}
+#endif
+
+/**
+* @brief Compute the output of all the neural networks.
+*
+* The result of each model is written in its slot of nn_results, the one of
+* the requested model is also written in nn_result.
+*
+* @param  input are the INPUT_SIZE pixels of the image, see extract_input
+*/
+void recognize_all_input(const unsigned char* input) {
+
+    network_target target;              /**< Requested model. */
+
+    pthread_mutex_lock(&actual_model_mutex);
+    target = requested_model;
+    pthread_mutex_unlock(&actual_model_mutex);
+
+    context_recognize_all_input(main_context, input, nn_results);
+
+    /**< Every model has been fed, no first hidden layer is discarded. */
+    if (!main_context->ready[target])
+        target = fallback_model();
+    main_context->active_net = target;
+    nn_result = nn_results[target];
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of all the neural networks for an image.
+*
+* See recognize_all_input.
+*
+* @param  image is the input image of INPUT_DIM x INPUT_DIM
+*/
+void recognize_all_characters(BITMAP* image) {
+
+    unsigned char pixels[INPUT_SIZE];   /**< Binary input image. */
+
+    read_input(image, pixels);
+    recognize_all_input(pixels);
+}
+#endif
+
+/**
+* @brief Model with the most confident result of recognize_all_characters.
+*
+* @return the model whose slot of nn_results has the highest probability
+*/
+network_target most_confident_model() {
+
+    int i;
+    network_target best = DIGITS;
+
+    for (i = LETTERS; i <= MIXED; ++i)
+        if (nn_results[i].prob > nn_results[best].prob)
+            best = i;
+
+    return best;
+}
+
+#ifndef NN_NO_ALLEGRO
+/**
+* @brief Compute the output of the requested neural network for a batch.
+*
+* Each image is handled as in recognize_character, see 
+* context_recognize_characters.
+*
+* @param  images are the num_images input images of INPUT_DIM x INPUT_DIM
+* @param  num_images is the number of images
+* @param  results is the array of num_images results, in the same order
+*/
+void recognize_characters(BITMAP** images, int num_images, 
+                                                    data_network_t* results) {
+
+    network_target target;              /**< Requested model. */
+
+    pthread_mutex_lock(&actual_model_mutex);
+    target = requested_model;
+    pthread_mutex_unlock(&actual_model_mutex);
+
+    context_recognize_characters(main_context, target, images, num_images, 
+                                                                    results);
+}
+#endif
+
+/**
+* @brief Hits and misses of the result cache of a context.
+*
+* The counters can be read by any thread while the context is used.
+*
+* @param  ctx is the context of the cache
+* @param  hits is filled with the results found in the cache
+* @param  misses is filled with the results computed by the models
+*/
+void context_cache_stats(nn_context_t* ctx, unsigned long* hits, 
+                                                    unsigned long* misses) {
+    *hits = __atomic_load_n(&ctx->cache_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&ctx->cache_misses, __ATOMIC_RELAXED);
+}
+
+/**
+* @brief Hits and misses of the result cache of the global recognition 
+* functions.
+*
+* @param  hits is filled with the results found in the cache
+* @param  misses is filled with the results computed by the models
+*/
+void cache_stats(unsigned long* hits, unsigned long* misses) {
+    *hits = *misses = 0;
+
+    if (main_context != NULL)
+        context_cache_stats(main_context, hits, misses);
+}
+
+/**
+* @brief Rolling latency statistics of the stages of a model.
+*
+* The stages are, in order: the fill of the input layer, the input layer, 
+* the hidden layers after the first one, the output layer, the softmax and 
+* the argmax, which writes the result and stores it in the cache. An 
+* incremental update of the first hidden layer counts as the input layer, 
+* the inferences answered by the cache are not timed. The whole inference
+* also includes the waits outside the stages, as the one of the other 
+* models in the all models mode. The statistics are
+* read while the other threads update them, so the fields of a stage can
+* come from different inferences.
+*
+* @param  model is the index of the model in the registry
+* @param  stages is filled with the statistics of each stage, it has room 
+*         for NN_TIMER_STAGES of them
+* @param  total is filled with the statistics of the whole inferences
+* @return the number of stages of the model, 0 if the timers are disabled
+*/
+int stage_stats(int model, nn_stage_stats_t* stages, nn_stage_stats_t* total) {
+#if NN_STAGE_TIMERS
+    int s;
+    int num_stages;
+    stage_timer_t* timer;
+    nn_stage_stats_t* stats;
+    unsigned long prev_max;
+
+    if (model < 0 || model >= count_models())
+        return 0;
+
+    num_stages = registry_model(model)->num_hidden + 4;
+
+    for (s = 0; s <= NN_TIMER_STAGES; ++s) {
+        if (s < NN_TIMER_STAGES && s >= num_stages)
+            continue;
+
+        timer = &stage_timer[model][s];
+        stats = (s < NN_TIMER_STAGES) ? &stages[s] : total;
+
+        stats->count = __atomic_load_n(&timer->count, __ATOMIC_RELAXED);
+        stats->last_ns = __atomic_load_n(&timer->last_ns, __ATOMIC_RELAXED);
+        stats->mean_ns = __atomic_load_n(&timer->mean_ns, __ATOMIC_RELAXED);
+        stats->max_ns = __atomic_load_n(&timer->max_ns, __ATOMIC_RELAXED);
+        prev_max = __atomic_load_n(&timer->prev_max_ns, __ATOMIC_RELAXED);
+        if (prev_max > stats->max_ns)
+            stats->max_ns = prev_max;
+    }
+
+    return num_stages;
+#else
+    (void) model;
+    (void) stages;
+    (void) total;
+    return 0;
+#endif
+}
+
+/**
+* @brief Print the latency statistics of the stages of a model.
+*
+* For each stage the last, the mean and the max latency are printed in 
+* microseconds. Nothing is printed if the timers are disabled.
+*
+* @param  model is the index of the model in the registry
+*/
+void print_stage_stats(int model) {
+
+    int s;
+    int num_stages;
+    nn_stage_stats_t stages[NN_TIMER_STAGES];
+    nn_stage_stats_t total;
+
+    num_stages = stage_stats(model, stages, &total);
+    if (num_stages == 0)
+        return;
+
+    printf("%s stages, last/mean/max us:", model_name(model));
+
+    for (s = 0; s < num_stages; ++s) {
+        if (s == STAGE_FILL)
+            printf(" fill");
+        else if (s == STAGE_INPUT)
+            printf(" input");
+        else if (s < num_stages - 3)
+            printf(" hidden%d", s - 1);
+        else if (s == num_stages - 3)
+            printf(" output");
+        else if (s == num_stages - 2)
+            printf(" softmax");
+        else
+            printf(" argmax");
+
+        printf(" %.1f/%.1f/%.1f", stages[s].last_ns / 1000.0, 
+                    stages[s].mean_ns / 1000.0, stages[s].max_ns / 1000.0);
+    }
+
+    printf(" total %.1f/%.1f/%.1f\n", total.last_ns / 1000.0, 
+                            total.mean_ns / 1000.0, total.max_ns / 1000.0);
+}
+
+#ifdef NN_BENCH
+/**
+* BENCHMARK FUNCTIONS
+*
+* Used by nn_bench to time each stage of the forward pass on its own. The 
+* stages are run by the caller alone, with the generic kernel of each layer.
+*/
+
+/**
+* @brief Bytes of the weights read by a sinapsi for a number of values.
+*
+* @param  sinapsi is the sinapsi
+* @param  precision is the precision of its model
+* @param  values is the number of weights read
+* @return the bytes of the values, with their column index if it is sparse
+*/
+static long sinapsi_bytes(const sinapsi_t* sinapsi, nn_precision precision,
+                                                                long values) {
+    long size = (precision == NN_INT8) ? 1 : sizeof(float);
+
+    if (sinapsi->row_start != NULL)
+        return values * (size + sizeof(short));
+
+    if (precision == NN_FP16)
+        size = sizeof(unsigned short);
+
+    return values * size;
+}
+
+/**
+* @brief Sinapsi computed by a stage of the forward pass of a model.
+*
+* @param  model is the model
+* @param  stage is the stage, see bench_stages
+* @return the sinapsi of the stage, NULL for the softmax stage
+*/
+static const sinapsi_t* stage_sinapsi(const model_t* model, int stage) {
+    if (stage == 0)
+        return &model->in_S;
+    if (stage < model->num_hidden)
+        return &model->hid_S[stage-1];
+    if (stage == model->num_hidden)
+        return &model->out_S;
+    return NULL;
+}
+
+/**
+* @brief Number of stages of the forward pass of a model.
+*
+* Stage 0 computes the first hidden layer from the input image, stage k 
+* computes the hidden layer k, stage num_hidden the output layer and the 
+* last one the softmax function and the recognized characters.
+*
+* @param  model is the index of the model in the registry
+* @return the number of stages
+*/
+int bench_stages(int model) {
+    return live_weights(model)->num_hidden + 2;
+}
+
+/**
+* @brief Run a stage of the forward pass of a ready model on a context.
+*
+* The stages must be run in order for each input, the input image is used 
+* only by stage 0.
+*
+* @param  ctx is the context of the caller
+* @param  model is the index of the model in the registry
+* @param  stage is the stage, see bench_stages
+* @param  input are the INPUT_SIZE pixels of the image, see extract_input
+*/
+void bench_run_stage(nn_context_t* ctx, int model, int stage, 
+                                                const unsigned char* input) {
+    network_t* net;
+    data_network_t result;
+    int num_hidden;
+
+    begin_inference(ctx);
+
+    net = context_net(ctx, model);
+    num_hidden = net->model->num_hidden;
+
+    if (stage == 0) {
+        fill_input(net, input);
+        net->delta_valid = 0;
+        propagate_from_in_layer(net, 0, 1);
+    }
+    else if (stage < num_hidden) {
+        propagate_hid_layer(net, stage - 1, 0, 1);
+    }
+    else if (stage == num_hidden) {
+        propagate_to_out_layer(net, 0, 1);
+    }
+    else {
+        softmax(net->out_L.z_value, net->out_L.act_value, 
+                                                    net->out_L.num_neuron);
+        write_result(model, net->out_L.act_value, &result);
+    }
+
+    end_inference(ctx);
+}
+
+/**
+* @brief Work of the last run of a stage of a model on a context.
+*
+* The input stage adds only the columns of the active pixels. The bytes are
+* the ones of the weights and of the bias read by the stage.
+*
+* @param  ctx is the context of the caller
+* @param  model is the index of the model in the registry
+* @param  stage is the stage, see bench_stages
+* @param  macs is filled with the multiply-accumulates of the stage
+* @param  bytes is filled with the bytes of the weights read by the stage
+*/
+void bench_stage_cost(nn_context_t* ctx, int model, int stage, long* macs, 
+                                                                long* bytes) {
+    int k;
+    const network_t* net = &ctx->net[model];
+    const model_t* m = net->model;
+    const sinapsi_t* sinapsi = stage_sinapsi(m, stage);
+
+    *macs = *bytes = 0;
+
+    if (sinapsi == NULL)
+        return;
+
+    if (stage == 0) {
+        for (k = 0; k < net->num_active; ++k)
+            *macs += (sinapsi->row_start == NULL) ? sinapsi->card_out :
+                                sinapsi->row_start[net->active_in[k] + 1] -
+                                sinapsi->row_start[net->active_in[k]];
+    }
+    else {
+        *macs = (sinapsi->row_start == NULL) ? 
+                        (long) sinapsi->card_out * sinapsi->card_in :
+                        sinapsi->row_start[sinapsi->card_out];
+    }
+
+    *bytes = sinapsi_bytes(sinapsi, m->precision, *macs) + 
+                                        sinapsi->card_out * sizeof(float);
+}
+
+/**
+* @brief Storage of the weights of a stage of a ready model.
+*
+* A sparse sinapsi is computed by the CSR kernels, a packed one by the panel
+* kernels and the others by the dense kernels of the precision of the model.
+*
+* @param  model is the index of the model in the registry
+* @param  stage is the stage, see bench_stages
+* @return "csr", "panels" or "dense", NULL for the softmax stage
+*/
+const char* bench_stage_layout(int model, int stage) {
+
+    const sinapsi_t* sinapsi = stage_sinapsi(live_weights(model), stage);
+
+    if (sinapsi == NULL)
+        return NULL;
+    if (sinapsi->row_start != NULL)
+        return "csr";
+    if (sinapsi->p_weights != NULL)
+        return "panels";
+
+    return "dense";
+}
+
+/**
+* @brief Precision and workers of the forward pass of a ready model.
+*
+* @param  model is the index of the model in the registry
+* @param  precision is filled with the name of its precision
+* @param  workers is filled with the workers of its forward pass
+*/
+void bench_model_info(int model, const char** precision, int* workers) {
+    *precision = precision_names[live_weights(model)->precision];
+    *workers = live_weights(model)->num_workers;
+}
+
+/**
+* @brief Synthetic handwritten-like input image.
+*
+* @param  input is filled with the INPUT_SIZE pixels of the image
+* @param  seed is the state of the random generator
+*/
+void bench_synthetic_input(unsigned char* input, unsigned int* seed) {
+    synthetic_image(input, seed);
+}
+#endif
@@ -17,7 +17,85 @@
 * taking the preprocessed images captured by the camera it will feed the active
 * network and compute the result of the recognition.
 *
-* @note Only one model is active at time.
+* @note Only one model is active at time, unless the all models mode is set:
+* then every frame is fed to the 3 models at the same time.
+*
+* The weights of the models are read-only after init_networks, the layers 
+* fed with the images belong to an inference context. The context_ functions
+* take the context of the caller, so different threads can recognize at the 
+* same time with their own contexts. The other recognition functions use the
+* requested model and the global results with a context of their own.
+*
+* MODEL FILES: every file of NN_MODEL_DIR which starts with a model header is
+* loaded in the registry of the models. The header describes the model and
+* it is followed by the weights in the format of save_file of MLP/NN.c:
+*
+*   nn_model
+*   name mixed
+*   layers 3 784 256 47
+*   activation logistic
+*   labels 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabdefghnqrt
+*   end
+*
+* layers gives the number of layers and their sizes, the first one is the
+* input image and the last one has one label for each neuron. The activation
+* of the hidden layers is logistic or relu, the output one is a softmax. A
+* model named digits, letters or mixed replaces the default one, the others 
+* are added after them and can be used by the context_ functions through the
+* index returned by find_model. The default models not found in the 
+* directory are loaded from their files without header.
+*
+* MODEL LOADING: init_networks reads the headers of all the models but only
+* the weights of the requested one, which is used for the first frames. The 
+* other models are loaded by a background thread, model_ready tells if one
+* of them can be used. A recognition function called with a model still 
+* loading waits it for NN_LOAD_WAIT_MS, then it falls back to the first 
+* model: the model field of the result tells which model has been used. 
+* Defining NN_BACKGROUND_LOADING to 0 loads every model in init_networks.
+*
+* HOT RELOAD: while the application runs, the model directory and the 
+* working directory are watched with inotify. When the file of a model is
+* rewritten or moved in place, its new weights are loaded in background and
+* replace the old ones with an atomic swap, the old ones are released after
+* the inferences which use them. The structure of a model cannot change 
+* without a restart. reload_model does the same on request. Defining 
+* NN_HOT_RELOAD to 0 disables the watch.
+*
+* SPARSE MODELS: the weights of a model whose absolute value is below 
+* NN_PRUNE_THRESHOLD are set to zero when it is loaded, the embedded weights
+* are not pruned. Then each sinapsi with at most NN_SPARSE_DENSITY non-zero 
+* weights is stored in CSR format and its dense weights are released, the 
+* forward pass adds only its non-zero weights. The others stay dense, the
+* ones between two hidden layers of a float model are packed in panels of
+* rows when they are loaded, so each pass on the activations of a layer 
+* computes several outputs. The model files keep the dense layout.
+*
+* RESULT CACHE: each context keeps the last results of its models in a 
+* cache of NN_RESULT_CACHE entries, keyed by the bit-packed input image and
+* the model, the least recently used result is replaced. When the camera 
+* points at a still page the same image comes back every period and its 
+* result is taken from the cache without feeding the model. The results of
+* the old weights of a reloaded model are never used. cache_stats and 
+* context_cache_stats read the hits and the misses of the cache.
+*
+* INPUT IMAGE: extract_input reads the input image straight from the gray 
+* frame of the camera, averaging each pixel of the input over its area of 
+* the ROI, and the _input functions recognize it. The functions which take
+* a bitmap of INPUT_DIM x INPUT_DIM are kept for the other callers.
+*
+* STAGE TIMERS: defining NN_STAGE_TIMERS to 1 times each stage of the 
+* inferences of a single image: the fill of the input layer, each layer, the
+* softmax and the argmax which writes the result. Each model keeps rolling
+* statistics of its stages, updated without locks by every context, which
+* stage_stats reads at any time. The statistics cover the inferences of 
+* recognize_input, recognize_all_input and of their context_ versions. With
+* NN_STAGE_TIMERS to 0, the default, the timers are not compiled.
+*
+* BENCHMARK: nn_bench times the models without the camera and the display.
+* It builds this file with NN_NO_ALLEGRO, which leaves out the bitmap 
+* functions, and NN_BENCH, which adds the bench_ functions running each 
+* stage of the forward pass on its own. With NN_SYNTHETIC_WEIGHTS a default
+* model whose file is missing gets repeatable random weights.
 *
 */
 
@@ -30,35 +108,332 @@
 #define NN_SUCCESS              0
 #define NN_ERROR_NO_FILE        1
 #define NN_ERROR_READING_FILE   2
+#define NN_ERROR_NO_MEMORY      3
 
 /**
 * GLOBAL DATA
 */
 
+/**< Numerical precision of the weights used by a model.*/
+typedef enum {
+    NN_FP32 = 0,        /**< Float weights and activations.*/
+    NN_INT8,            /**< Int8 weights and activations, int32 sums.*/
+    NN_FP16             /**< Fp16 weights, float activations and sums.*/
+} nn_precision;
+
+/**< Default precision of each model, it can be overridden at compile time.*/
+#ifndef DIGITS_PRECISION
+#define DIGITS_PRECISION    NN_FP32
+#endif
+#ifndef LETTERS_PRECISION
+#define LETTERS_PRECISION   NN_FP32
+#endif
+#ifndef MIXED_PRECISION
+#define MIXED_PRECISION     NN_FP32
+#endif
+
+/**< Max number of threads sharing the forward pass of a large model, the 
+* small ones always run on the caller. It can be overridden at compile time.*/
+#ifndef NN_MAX_WORKERS
+#define NN_MAX_WORKERS      4
+#endif
+
+/**< Default of the all models mode, it can be overridden at compile time.*/
+#ifndef NN_ALL_MODELS
+#define NN_ALL_MODELS       0
+#endif
+
+/**< Number of most probable characters written in each result.*/
+#ifndef NN_TOP_K
+#define NN_TOP_K            3
+#endif
+
+/**< Max number of output neurons of a model, it can be overridden at compile
+* time.*/
+#ifndef NN_MAX_OUTPUTS
+#define NN_MAX_OUTPUTS      47
+#endif
+
+/**< Max number of models of the registry, the 3 default ones included.*/
+#ifndef NN_MAX_MODELS
+#define NN_MAX_MODELS       8
+#endif
+
+/**< Directory scanned by init_networks for the model files, it can be 
+* overridden at compile time.*/
+#ifndef NN_MODEL_DIR
+#define NN_MODEL_DIR        "models"
+#endif
+
+/**< Loading of the models in background, it can be overridden at compile
+* time.*/
+#ifndef NN_BACKGROUND_LOADING
+#define NN_BACKGROUND_LOADING   1
+#endif
+
+/**< Max waiting time in milliseconds of a model still loading, before the
+* first model is used in its place. It can be overridden at compile time.*/
+#ifndef NN_LOAD_WAIT_MS
+#define NN_LOAD_WAIT_MS         50
+#endif
+
+/**< Watch of the model files, it can be overridden at compile time.*/
+#ifndef NN_HOT_RELOAD
+#define NN_HOT_RELOAD           1
+#endif
+
+/**< Weights below this absolute value are pruned at load time, 0 disables
+* the pruning. It can be overridden at compile time.*/
+#ifndef NN_PRUNE_THRESHOLD
+#define NN_PRUNE_THRESHOLD      0.0f
+#endif
+
+/**< Max fraction of non-zero weights of a sparse sinapsi, it can be
+* overridden at compile time. On the pruned stock models the sparse kernels
+* are faster than the 4-wide vector ones below about 0.05, than the 8-wide
+* AVX ones below about 0.03, so the default follows the kernel set of
+* nn_kernels.c.*/
+#ifndef NN_SPARSE_DENSITY
+#if defined(__AVX__) && !defined(NN_KERNELS_SCALAR)
+#define NN_SPARSE_DENSITY       0.03f
+#else
+#define NN_SPARSE_DENSITY       0.05f
+#endif
+#endif
+
+/**< Results kept by the cache of each context, 0 disables the cache. It can
+* be overridden at compile time.*/
+#ifndef NN_RESULT_CACHE
+#define NN_RESULT_CACHE         16
+#endif
+
+/**< Timers of the stages of the inferences, it can be overridden at 
+* compile time.*/
+#ifndef NN_STAGE_TIMERS
+#define NN_STAGE_TIMERS         0
+#endif
+
+/**< Inferences of a model after which the max latency of its stages 
+* restarts, it can be overridden at compile time.*/
+#ifndef NN_TIMER_WINDOW
+#define NN_TIMER_WINDOW         256
+#endif
+
+/**< Max stages of an inference: the input fill, the input layer, 5 hidden
+* layers, the output layer, the softmax and the argmax.*/
+#define NN_TIMER_STAGES         10
+
+/**< Default of the copy of the output layer, it can be overridden at compile
+* time.*/
+#ifndef NN_FULL_PROBABILITY
+#define NN_FULL_PROBABILITY 0
+#endif
+
+/**< Default cascade of recognize_character, it can be overridden at compile
+* time. The cascade is disabled with 0 stages, the thresholds are the 
+* percentages under which each model escalates to the next one.*/
+#ifndef NN_CASCADE_STAGES
+#define NN_CASCADE_STAGES       0
+#endif
+#ifndef NN_CASCADE_ORDER
+#define NN_CASCADE_ORDER        { DIGITS, MIXED, LETTERS }
+#endif
+#ifndef NN_CASCADE_THRESHOLDS
+#define NN_CASCADE_THRESHOLDS   { 90.0f, 90.0f, 90.0f }
+#endif
+
 /**< Struct that identify actual input and output.*/
 typedef struct {
     char rec_char;          /**< Recognized character.*/
     float prob;             /**< Recognition accurancy.*/
+    network_target model;   /**< Model which recognized the character.*/
+
+    int num_top;                    /**< Valid entries of the top lists.*/
+    char top_char[NN_TOP_K];        /**< Most probable characters, sorted.*/
+    float top_prob[NN_TOP_K];       /**< Their percentages.*/
+
+    int num_prob;                   /**< Valid entries of prob_vector, 0 if
+                                        the copy is disabled.*/
+    float prob_vector[NN_MAX_OUTPUTS];  /**< Probability [0, 1] of each 
+                                            output neuron of the model.*/
 } data_network_t;
 
+/**< Rolling latency statistics of a stage of the inferences of a model.*/
+typedef struct {
+    unsigned long count;    /**< Timed runs of the stage.*/
+    unsigned long last_ns;  /**< Latency of the last run.*/
+    unsigned long mean_ns;  /**< Moving average of the latency.*/
+    unsigned long max_ns;   /**< Max latency, over NN_TIMER_WINDOW runs at
+                                least.*/
+} nn_stage_stats_t;
+
+/**< Inference context of a caller: the layers of each model fed with its 
+* images and the state kept from its previous frame.*/
+typedef struct nn_context_s nn_context_t;
+
 /**< Requested active model. */
 extern network_target requested_model;
 /**< Result of the computation. */
 extern data_network_t nn_result;
+/**< Result of each model in the all models mode. */
+extern data_network_t nn_results[3];
+/**< 1 if all the models are computed, protected by actual_model_mutex. */
+extern int all_models_mode;
 
 /**
 * GLOBAL MUTEX
 */
-extern pthread_mutex_t actual_model_mutex;          /**< Active model.*/
+extern pthread_mutex_t actual_model_mutex;  /**< Active model and mode.*/
 
 /**
 * GLOBAL FUNCTION PROTOTYPES
 */
 
+/**< Select the precision of a model, it must be called before init_networks. */
+void set_model_precision(network_target target, nn_precision precision);
+
+/**< Configure the cascade mode of recognize_character. */
+void set_cascade(const network_target* order, const float* threshold, 
+                                                            int num_stages);
+
+/**< Enable the copy of the whole output layer in the results. */
+void set_full_probability(int enable);
+
+/**< Character of an output neuron of a model. */
+char output_character(network_target target, int index);
+
 /**< Initialize all the 3 differet model and load the corresponding weights. */
 int init_networks();
 
+/**< Number of models of the registry, DIGITS, LETTERS and MIXED included. */
+int count_models();
+
+/**< Index of the model with the given name, -1 if it is not loaded. */
+int find_model(const char* name);
+
+/**< Name of a model of the registry. */
+const char* model_name(int model);
+
+/**< Check if a model has been loaded and can be used. */
+int model_ready(int model);
+
+/**< Wait the end of the background loading of all the models. */
+int wait_models();
+
+/**< Replace the weights of a model with the ones of its file. */
+int reload_model(int model);
+
+/**< Release the memory of all the models. */
+void free_networks();
+
+/**< Create an inference context, it must be called after init_networks. */
+nn_context_t* create_context();
+
+/**< Release an inference context. */
+void free_context(nn_context_t* ctx);
+
+/**< Binary input image of the network from a square ROI of a gray frame. */
+void extract_input(const unsigned char* frame, int stride, int x, int y, 
+                                        int size, unsigned char* input);
+
+/**< Compute the output of a model for an input image of a context. */
+void context_recognize_input(nn_context_t* ctx, network_target target, 
+                        const unsigned char* input, data_network_t* result);
+
+/**< Compute the output of the models of a cascade for an input image of a
+* context. */
+void context_recognize_cascade_input(nn_context_t* ctx, 
+                    const network_target* order, const float* threshold, 
+                    int num_stages, const unsigned char* input, 
+                    data_network_t* result);
+
+/**< Compute the output of the 3 models for an input image of a context. */
+void context_recognize_all_input(nn_context_t* ctx, 
+                    const unsigned char* input, data_network_t* results);
+
+/**< Compute the output of a model for a batch of input images of a 
+* context. */
+void context_recognize_inputs(nn_context_t* ctx, network_target target,
+                                const unsigned char* inputs, int num_inputs,
+                                data_network_t* results);
+
+/**< Hits and misses of the result cache of a context. */
+void context_cache_stats(nn_context_t* ctx, unsigned long* hits, 
+                                                    unsigned long* misses);
+
+/**< Compute the output of the active neural network for an input image.*/
+void recognize_input(const unsigned char* input);
+
+/**< Compute the output of all the neural networks for an input image.*/
+void recognize_all_input(const unsigned char* input);
+
+/**< Model with the most confident result of recognize_all_characters.*/
+network_target most_confident_model();
+
+/**< Hits and misses of the result cache of the global recognition 
+* functions. */
+void cache_stats(unsigned long* hits, unsigned long* misses);
+
+/**< Rolling latency statistics of the stages of a model, return the number
+* of stages. */
+int stage_stats(int model, nn_stage_stats_t* stages, nn_stage_stats_t* total);
+
+/**< Print the latency statistics of the stages of a model. */
+void print_stage_stats(int model);
+
+#ifdef NN_BENCH
+/**< Number of stages of the forward pass of a model. */
+int bench_stages(int model);
+
+/**< Run a stage of the forward pass of a ready model on a context. */
+void bench_run_stage(nn_context_t* ctx, int model, int stage, 
+                                                const unsigned char* input);
+
+/**< Work of the last run of a stage of a model on a context. */
+void bench_stage_cost(nn_context_t* ctx, int model, int stage, long* macs, 
+                                                                long* bytes);
+
+/**< Storage of the weights of a stage of a ready model. */
+const char* bench_stage_layout(int model, int stage);
+
+/**< Precision and workers of the forward pass of a ready model. */
+void bench_model_info(int model, const char** precision, int* workers);
+
+/**< Synthetic handwritten-like input image. */
+void bench_synthetic_input(unsigned char* input, unsigned int* seed);
+#endif
+
+/**< Functions which take a bitmap of INPUT_DIM x INPUT_DIM, they need the
+* allegro.h included by the caller. */
+#ifndef NN_NO_ALLEGRO
+/**< Compute the output of a model for an image of a context. */
+void context_recognize_character(nn_context_t* ctx, network_target target, 
+                                    BITMAP* image, data_network_t* result);
+
+/**< Compute the output of the models of a cascade for an image of a 
+* context. */
+void context_recognize_cascade(nn_context_t* ctx, const network_target* order,
+                            const float* threshold, int num_stages, 
+                            BITMAP* image, data_network_t* result);
+
+/**< Compute the output of the 3 models for an image of a context. */
+void context_recognize_all_characters(nn_context_t* ctx, BITMAP* image, 
+                                                    data_network_t* results);
+
+/**< Compute the output of a model for a batch of images of a context. */
+void context_recognize_characters(nn_context_t* ctx, network_target target,
+                BITMAP** images, int num_images, data_network_t* results);
+
 /**< Compute the output of the active neural network.*/
 void recognize_character(BITMAP* input_image);
 
-#endif
\ No newline at end of file
+/**< Compute the output of all the neural networks at the same time.*/
+void recognize_all_characters(BITMAP* input_image);
+
+/**< Compute the output of the requested neural network for a batch of 
+* images, it must not be called by two threads at the same time.*/
+void recognize_characters(BITMAP** images, int num_images, 
+                                                    data_network_t* results);
+#endif
+
+#endif
@@ -0,0 +1,1861 @@
+/**
+* @file nn_kernels.c
+* @author Gianluca D'Amico
+* @brief File containing the vectorized kernels of the neural network
+*
+* HANDLING MODEL KERNELS: It contains the low level loops used by the forward
+* pass of the neural network.
+*
+* The kernel set is selected at compile time from the target flags: NEON on
+* the Raspberry Pi, AVX or SSE on x86 hosts and a portable C loop elsewhere.
+* Defining NN_KERNELS_SCALAR forces the portable loop on every target.
+*
+*/
+
+#include <string.h>
+#include <math.h>
+
+#include "nn_kernels.h"
+
+/**
+* LOCAL CONSTANTS
+*/
+
+/**< Range of the fast exponential, 2^n stays a normal float. */
+#define EXP_MIN     -87.0f
+#define EXP_MAX     88.0f
+
+/**< 1 / ln(2) and ln(2) split in an exact high part and a low part. */
+#define EXP_LOG2E   1.44269504088896341f
+#define EXP_LN2_HI  0.693359375f
+#define EXP_LN2_LO  -2.12194440e-4f
+
+/**< Coefficients of the polynomial p(r) = 1 + r + r^2 (P0 + r (P1 + ...)).*/
+#define EXP_P5      1.9875691500e-4f
+#define EXP_P4      1.3981999507e-3f
+#define EXP_P3      8.3334519073e-3f
+#define EXP_P2      4.1665795894e-2f
+#define EXP_P1      1.6666665459e-1f
+#define EXP_P0      5.0000001201e-1f
+
+/**< Max side of the output of the specialized downsampling kernels. */
+#define DOWNSAMPLE_MAX_DIM  64
+
+#if defined(NN_KERNELS_SCALAR)
+#define KERNEL_NAME "scalar"
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define KERNEL_NEON
+#define KERNEL_NAME "neon"
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define KERNEL_AVX
+#define KERNEL_NAME "avx"
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define KERNEL_SSE
+#define KERNEL_NAME "sse"
+#else
+#define KERNEL_NAME "scalar"
+#endif
+
+/**< The fp16 kernels need the hardware conversion: the fp16 NEON extension
+* on ARM (-mfp16-format=ieee on 32 bit) and F16C on x86. */
+#if defined(KERNEL_NEON) && defined(__ARM_FP16_FORMAT_IEEE) && \
+                                    (defined(__aarch64__) || (__ARM_FP & 2))
+#define KERNEL_NEON_F16
+#elif defined(KERNEL_AVX) && defined(__F16C__)
+#define KERNEL_AVX_F16
+#endif
+
+/**< The int8 kernels on x86 need the integer instructions of SSE2. */
+#if (defined(KERNEL_AVX) || defined(KERNEL_SSE)) && defined(__SSE2__)
+#include <emmintrin.h>
+#define KERNEL_SSE2_INT
+#endif
+
+/**
+* LOCAL FUNCTIONS
+*/
+
+/**
+* @brief Fast exponential of a single float.
+*
+* Same algorithm of the vectorized versions, it is used for the tails of the
+* vectors and on the targets without SIMD.
+*/
+static inline float scalar_exp(float x) {
+    float fx, p;
+    int n;
+    unsigned int bits;
+    float pow2n;
+
+    x = (x < EXP_MIN) ? EXP_MIN : ((x > EXP_MAX) ? EXP_MAX : x);
+
+    /**< n = floor(x / ln(2) + 0.5). */
+    fx = x * EXP_LOG2E + 0.5f;
+    n = (int) fx;
+    if ((float) n > fx)
+        n--;
+    fx = (float) n;
+
+    x = x - fx * EXP_LN2_HI;
+    x = x - fx * EXP_LN2_LO;
+
+    p = EXP_P5 * x + EXP_P4;
+    p = p * x + EXP_P3;
+    p = p * x + EXP_P2;
+    p = p * x + EXP_P1;
+    p = p * x + EXP_P0;
+    p = p * x * x + x + 1;
+
+    /**< Multiply by 2^n building the exponent bits. */
+    bits = (unsigned int) (n + 127) << 23;
+    memcpy(&pow2n, &bits, sizeof(pow2n));
+
+    return p * pow2n;
+}
+
+#if defined(KERNEL_NEON)
+
+/**
+* @brief Multiply and accumulate of 4 lanes.
+*/
+static inline float32x4_t neon_mac(float32x4_t acc, float32x4_t a,
+                                                            float32x4_t b) {
+#if defined(__ARM_FEATURE_FMA)
+    return vfmaq_f32(acc, a, b);
+#else
+    return vmlaq_f32(acc, a, b);
+#endif
+}
+
+/**
+* @brief Horizontal sum of 4 lanes.
+*/
+static inline float neon_sum(float32x4_t v) {
+#if defined(__aarch64__)
+    return vaddvq_f32(v);
+#else
+    float32x2_t sum = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#endif
+}
+
+/**
+* @brief Horizontal sum of 4 int32 lanes.
+*/
+static inline int neon_sum_s32(int32x4_t v) {
+#if defined(__aarch64__)
+    return vaddvq_s32(v);
+#else
+    int32x2_t sum = vadd_s32(vget_low_s32(v), vget_high_s32(v));
+    return vget_lane_s32(vpadd_s32(sum, sum), 0);
+#endif
+}
+
+/**
+* @brief Fast exponential of 4 lanes.
+*/
+static inline float32x4_t neon_exp(float32x4_t x) {
+    float32x4_t fx, p;
+    int32x4_t n;
+
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(EXP_MIN)), vdupq_n_f32(EXP_MAX));
+
+    /**< n = floor(x / ln(2) + 0.5). */
+    fx = vmlaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(EXP_LOG2E));
+    n = vcvtq_s32_f32(fx);
+    n = vsubq_s32(n, vreinterpretq_s32_u32(
+                    vshrq_n_u32(vcgtq_f32(vcvtq_f32_s32(n), fx), 31)));
+    fx = vcvtq_f32_s32(n);
+
+    x = vmlsq_f32(x, fx, vdupq_n_f32(EXP_LN2_HI));
+    x = vmlsq_f32(x, fx, vdupq_n_f32(EXP_LN2_LO));
+
+    p = vmlaq_f32(vdupq_n_f32(EXP_P4), x, vdupq_n_f32(EXP_P5));
+    p = vmlaq_f32(vdupq_n_f32(EXP_P3), x, p);
+    p = vmlaq_f32(vdupq_n_f32(EXP_P2), x, p);
+    p = vmlaq_f32(vdupq_n_f32(EXP_P1), x, p);
+    p = vmlaq_f32(vdupq_n_f32(EXP_P0), x, p);
+    p = vmlaq_f32(vaddq_f32(x, vdupq_n_f32(1)), vmulq_f32(x, x), p);
+
+    /**< Multiply by 2^n building the exponent bits. */
+    return vmulq_f32(p, vreinterpretq_f32_s32(
+                            vshlq_n_s32(vaddq_s32(n, vdupq_n_s32(127)), 23)));
+}
+
+/**
+* @brief Division of 4 lanes.
+*/
+static inline float32x4_t neon_div(float32x4_t a, float32x4_t b) {
+#if defined(__aarch64__)
+    return vdivq_f32(a, b);
+#else
+    /**< Reciprocal estimate refined by two Newton-Raphson steps. */
+    float32x4_t inv = vrecpeq_f32(b);
+    inv = vmulq_f32(vrecpsq_f32(b, inv), inv);
+    inv = vmulq_f32(vrecpsq_f32(b, inv), inv);
+    return vmulq_f32(a, inv);
+#endif
+}
+
+#if defined(KERNEL_NEON_F16)
+/**
+* @brief Load of 4 fp16 values widened to float.
+*/
+static inline float32x4_t neon_load_f16(const unsigned short* p) {
+    return vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(p)));
+}
+#endif
+
+#elif defined(KERNEL_AVX)
+
+/**
+* @brief Multiply and accumulate of 8 lanes.
+*/
+static inline __m256 avx_mac(__m256 acc, __m256 a, __m256 b) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, acc);
+#else
+    return _mm256_add_ps(acc, _mm256_mul_ps(a, b));
+#endif
+}
+
+/**
+* @brief Horizontal sum of 8 lanes.
+*/
+static inline float avx_sum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                                                _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+
+#if defined(KERNEL_AVX_F16)
+/**
+* @brief Load of 8 fp16 values widened to float.
+*/
+static inline __m256 avx_load_f16(const unsigned short* p) {
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) p));
+}
+#endif
+
+#elif defined(KERNEL_SSE)
+
+/**
+* @brief Horizontal sum of 4 lanes.
+*/
+static inline float sse_sum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 0x55));
+    return _mm_cvtss_f32(v);
+}
+
+#endif
+
+#if defined(KERNEL_SSE2_INT)
+
+/**
+* @brief Sign extension of the low 8 int8 lanes to int16.
+*/
+static inline __m128i sse2_lo_s16(__m128i v) {
+    return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+/**
+* @brief Sign extension of the high 8 int8 lanes to int16.
+*/
+static inline __m128i sse2_hi_s16(__m128i v) {
+    return _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+}
+
+/**
+* @brief Horizontal sum of 4 int32 lanes.
+*/
+static inline int sse2_sum_s32(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return _mm_cvtsi128_si32(v);
+}
+
+/**
+* @brief Fast exponential of 4 lanes.
+*/
+static inline __m128 sse2_exp(__m128 x) {
+    __m128 fx, p;
+    __m128i n;
+
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_MIN)), _mm_set1_ps(EXP_MAX));
+
+    /**< n = floor(x / ln(2) + 0.5). */
+    fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(EXP_LOG2E)), _mm_set1_ps(0.5f));
+    n = _mm_cvttps_epi32(fx);
+    n = _mm_add_epi32(n, _mm_castps_si128(
+                            _mm_cmpgt_ps(_mm_cvtepi32_ps(n), fx)));
+    fx = _mm_cvtepi32_ps(n);
+
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_LN2_HI)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_LN2_LO)));
+
+    p = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(EXP_P5)), _mm_set1_ps(EXP_P4));
+    p = _mm_add_ps(_mm_mul_ps(x, p), _mm_set1_ps(EXP_P3));
+    p = _mm_add_ps(_mm_mul_ps(x, p), _mm_set1_ps(EXP_P2));
+    p = _mm_add_ps(_mm_mul_ps(x, p), _mm_set1_ps(EXP_P1));
+    p = _mm_add_ps(_mm_mul_ps(x, p), _mm_set1_ps(EXP_P0));
+    p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(x, x), p), 
+                                            _mm_add_ps(x, _mm_set1_ps(1)));
+
+    /**< Multiply by 2^n building the exponent bits. */
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(
+                            _mm_add_epi32(n, _mm_set1_epi32(127)), 23)));
+}
+
+#endif
+
+/**
+* @brief Dot product of two vectors of n floats, always inlined.
+*
+* Four independent accumulators hide the latency of the multiply and add, the
+* tail of the vectors is summed with the scalar loop. It is inlined by 
+* dot_product and by the gemv kernels specialized on the number of columns:
+* with a constant n the trip counts are known and the tails are removed.
+*
+* @param  a is the first vector
+* @param  b is the second vector
+* @param  n is the length of both vectors
+* @return the sum of a[j] * b[j]
+*/
+static inline __attribute__((always_inline)) float dot_product_inline(
+                                    const float* a, const float* b, int n) {
+
+    int j = 0;
+    float sum = 0;
+
+#if defined(KERNEL_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    float32x4_t acc2 = vdupq_n_f32(0), acc3 = vdupq_n_f32(0);
+
+    for (; j + 16 <= n; j += 16) {
+        acc0 = neon_mac(acc0, vld1q_f32(a + j),      vld1q_f32(b + j));
+        acc1 = neon_mac(acc1, vld1q_f32(a + j + 4),  vld1q_f32(b + j + 4));
+        acc2 = neon_mac(acc2, vld1q_f32(a + j + 8),  vld1q_f32(b + j + 8));
+        acc3 = neon_mac(acc3, vld1q_f32(a + j + 12), vld1q_f32(b + j + 12));
+    }
+    for (; j + 4 <= n; j += 4)
+        acc0 = neon_mac(acc0, vld1q_f32(a + j), vld1q_f32(b + j));
+
+    sum = neon_sum(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+#elif defined(KERNEL_AVX)
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+
+    for (; j + 32 <= n; j += 32) {
+        acc0 = avx_mac(acc0, _mm256_loadu_ps(a + j),
+                                                    _mm256_loadu_ps(b + j));
+        acc1 = avx_mac(acc1, _mm256_loadu_ps(a + j + 8),
+                                                _mm256_loadu_ps(b + j + 8));
+        acc2 = avx_mac(acc2, _mm256_loadu_ps(a + j + 16),
+                                                _mm256_loadu_ps(b + j + 16));
+        acc3 = avx_mac(acc3, _mm256_loadu_ps(a + j + 24),
+                                                _mm256_loadu_ps(b + j + 24));
+    }
+    for (; j + 8 <= n; j += 8)
+        acc0 = avx_mac(acc0, _mm256_loadu_ps(a + j), _mm256_loadu_ps(b + j));
+
+    sum = avx_sum(_mm256_add_ps(_mm256_add_ps(acc0, acc1),
+                                                _mm256_add_ps(acc2, acc3)));
+#elif defined(KERNEL_SSE)
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+
+    for (; j + 16 <= n; j += 16) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + j),
+                                                    _mm_loadu_ps(b + j)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + j + 4),
+                                                    _mm_loadu_ps(b + j + 4)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(a + j + 8),
+                                                    _mm_loadu_ps(b + j + 8)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(a + j + 12),
+                                                    _mm_loadu_ps(b + j + 12)));
+    }
+    for (; j + 4 <= n; j += 4)
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + j),
+                                                        _mm_loadu_ps(b + j)));
+
+    sum = sse_sum(_mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+#endif
+
+    for (; j < n; ++j)
+        sum += a[j] * b[j];
+
+    return sum;
+}
+
+/**
+* @brief Dot products of one vector with four others.
+*
+* Each block of a is loaded once and multiplied by the same block of the 
+* four vectors b0..b3, which are the inputs of four different images.
+*
+* @param  a is the vector shared by the four products
+* @param  b is the array of the four other vectors
+* @param  n is the length of all vectors
+* @param  sum is the array of the four results
+*/
+static void dot_product_x4(const float* a, const float* const* b, int n, 
+                                                                float* sum) {
+    int j = 0, k;
+
+#if defined(KERNEL_NEON)
+    float32x4_t w;
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    float32x4_t acc2 = vdupq_n_f32(0), acc3 = vdupq_n_f32(0);
+
+    for (; j + 4 <= n; j += 4) {
+        w = vld1q_f32(a + j);
+        acc0 = neon_mac(acc0, w, vld1q_f32(b[0] + j));
+        acc1 = neon_mac(acc1, w, vld1q_f32(b[1] + j));
+        acc2 = neon_mac(acc2, w, vld1q_f32(b[2] + j));
+        acc3 = neon_mac(acc3, w, vld1q_f32(b[3] + j));
+    }
+
+    sum[0] = neon_sum(acc0);
+    sum[1] = neon_sum(acc1);
+    sum[2] = neon_sum(acc2);
+    sum[3] = neon_sum(acc3);
+#elif defined(KERNEL_AVX)
+    __m256 w;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+
+    for (; j + 8 <= n; j += 8) {
+        w = _mm256_loadu_ps(a + j);
+        acc0 = avx_mac(acc0, w, _mm256_loadu_ps(b[0] + j));
+        acc1 = avx_mac(acc1, w, _mm256_loadu_ps(b[1] + j));
+        acc2 = avx_mac(acc2, w, _mm256_loadu_ps(b[2] + j));
+        acc3 = avx_mac(acc3, w, _mm256_loadu_ps(b[3] + j));
+    }
+
+    sum[0] = avx_sum(acc0);
+    sum[1] = avx_sum(acc1);
+    sum[2] = avx_sum(acc2);
+    sum[3] = avx_sum(acc3);
+#elif defined(KERNEL_SSE)
+    __m128 w;
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+
+    for (; j + 4 <= n; j += 4) {
+        w = _mm_loadu_ps(a + j);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(w, _mm_loadu_ps(b[0] + j)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(w, _mm_loadu_ps(b[1] + j)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(w, _mm_loadu_ps(b[2] + j)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(w, _mm_loadu_ps(b[3] + j)));
+    }
+
+    sum[0] = sse_sum(acc0);
+    sum[1] = sse_sum(acc1);
+    sum[2] = sse_sum(acc2);
+    sum[3] = sse_sum(acc3);
+#else
+    sum[0] = sum[1] = sum[2] = sum[3] = 0;
+#endif
+
+    for (; j < n; ++j)
+        for (k = 0; k < 4; ++k)
+            sum[k] += a[j] * b[k][j];
+}
+
+/**
+* @brief Dot products of the NN_PANEL_ROWS rows of a panel with a vector.
+*
+* Each block of NN_PANEL_COLS values of x is loaded once and multiplied by 
+* the same block of every row, which follow each other in the panel. The
+* rows have independent accumulators, and the weights are read as a single
+* sequential stream.
+*
+* @param  panel is the panel, see pack_panels
+* @param  x is the vector of cols floats
+* @param  cols is the number of columns, a multiple of NN_PANEL_COLS
+* @param  sum is the array of the NN_PANEL_ROWS results
+*/
+static inline void panel_dot(const float* panel, const float* x, int cols,
+                                                                float* sum) {
+    int j;
+
+#if defined(KERNEL_NEON)
+    float32x4_t lo, hi;
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    float32x4_t acc2 = vdupq_n_f32(0), acc3 = vdupq_n_f32(0);
+
+    for (j = 0; j < cols; j += 8, panel += 32) {
+        lo = vld1q_f32(x + j);
+        hi = vld1q_f32(x + j + 4);
+        acc0 = neon_mac(neon_mac(acc0, vld1q_f32(panel), lo), 
+                                            vld1q_f32(panel + 4), hi);
+        acc1 = neon_mac(neon_mac(acc1, vld1q_f32(panel + 8), lo), 
+                                            vld1q_f32(panel + 12), hi);
+        acc2 = neon_mac(neon_mac(acc2, vld1q_f32(panel + 16), lo), 
+                                            vld1q_f32(panel + 20), hi);
+        acc3 = neon_mac(neon_mac(acc3, vld1q_f32(panel + 24), lo), 
+                                            vld1q_f32(panel + 28), hi);
+    }
+
+    sum[0] = neon_sum(acc0);
+    sum[1] = neon_sum(acc1);
+    sum[2] = neon_sum(acc2);
+    sum[3] = neon_sum(acc3);
+#elif defined(KERNEL_AVX)
+    __m256 v;
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+
+    for (j = 0; j < cols; j += 8, panel += 32) {
+        v = _mm256_loadu_ps(x + j);
+        acc0 = avx_mac(acc0, _mm256_loadu_ps(panel), v);
+        acc1 = avx_mac(acc1, _mm256_loadu_ps(panel + 8), v);
+        acc2 = avx_mac(acc2, _mm256_loadu_ps(panel + 16), v);
+        acc3 = avx_mac(acc3, _mm256_loadu_ps(panel + 24), v);
+    }
+
+    sum[0] = avx_sum(acc0);
+    sum[1] = avx_sum(acc1);
+    sum[2] = avx_sum(acc2);
+    sum[3] = avx_sum(acc3);
+#elif defined(KERNEL_SSE)
+    __m128 lo, hi;
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+
+    for (j = 0; j < cols; j += 8, panel += 32) {
+        lo = _mm_loadu_ps(x + j);
+        hi = _mm_loadu_ps(x + j + 4);
+        acc0 = _mm_add_ps(acc0, _mm_add_ps(_mm_mul_ps(
+                            _mm_loadu_ps(panel), lo),
+                            _mm_mul_ps(_mm_loadu_ps(panel + 4), hi)));
+        acc1 = _mm_add_ps(acc1, _mm_add_ps(_mm_mul_ps(
+                            _mm_loadu_ps(panel + 8), lo),
+                            _mm_mul_ps(_mm_loadu_ps(panel + 12), hi)));
+        acc2 = _mm_add_ps(acc2, _mm_add_ps(_mm_mul_ps(
+                            _mm_loadu_ps(panel + 16), lo),
+                            _mm_mul_ps(_mm_loadu_ps(panel + 20), hi)));
+        acc3 = _mm_add_ps(acc3, _mm_add_ps(_mm_mul_ps(
+                            _mm_loadu_ps(panel + 24), lo),
+                            _mm_mul_ps(_mm_loadu_ps(panel + 28), hi)));
+    }
+
+    sum[0] = sse_sum(acc0);
+    sum[1] = sse_sum(acc1);
+    sum[2] = sse_sum(acc2);
+    sum[3] = sse_sum(acc3);
+#else
+    int r, v;
+
+    for (r = 0; r < NN_PANEL_ROWS; ++r)
+        sum[r] = 0;
+
+    for (j = 0; j < cols; j += NN_PANEL_COLS)
+        for (r = 0; r < NN_PANEL_ROWS; ++r, panel += NN_PANEL_COLS)
+            for (v = 0; v < NN_PANEL_COLS; ++v)
+                sum[r] += panel[v] * x[j + v];
+#endif
+}
+
+/**
+* @brief Sums of each pair of pixels of a row, added to dim cells.
+*
+* @param  row are the 2 * dim pixels of the row
+* @param  sum are the dim sums of the cells
+* @param  dim is the number of cells
+*/
+static inline void add_row_x2(const unsigned char* row, unsigned short* sum,
+                                                                int dim) {
+    int u = 0;
+
+#if defined(KERNEL_NEON)
+    for (; u + 8 <= dim; u += 8)
+        vst1q_u16(sum + u, vpadalq_u8(vld1q_u16(sum + u), 
+                                                vld1q_u8(row + 2 * u)));
+#elif defined(KERNEL_SSE2_INT)
+    const __m128i low = _mm_set1_epi16(0xFF);
+    __m128i v;
+    __m128i* out;
+
+    for (; u + 8 <= dim; u += 8) {
+        v = _mm_loadu_si128((const __m128i*) (row + 2 * u));
+        v = _mm_add_epi16(_mm_and_si128(v, low), _mm_srli_epi16(v, 8));
+        out = (__m128i*) (sum + u);
+        _mm_storeu_si128(out, _mm_add_epi16(_mm_loadu_si128(out), v));
+    }
+#endif
+
+    for (; u < dim; ++u)
+        sum[u] += row[2 * u] + row[2 * u + 1];
+}
+
+/**
+* @brief Sums of each group of 4 pixels of a row, added to dim cells.
+*
+* @param  row are the 4 * dim pixels of the row
+* @param  sum are the dim sums of the cells
+* @param  dim is the number of cells
+*/
+static inline void add_row_x4(const unsigned char* row, unsigned short* sum,
+                                                                int dim) {
+    int u = 0;
+
+#if defined(KERNEL_NEON)
+    uint16x8_t v;
+
+    for (; u + 4 <= dim; u += 4) {
+        v = vpaddlq_u8(vld1q_u8(row + 4 * u));
+        vst1_u16(sum + u, vadd_u16(vld1_u16(sum + u), 
+                            vpadd_u16(vget_low_u16(v), vget_high_u16(v))));
+    }
+#elif defined(KERNEL_SSE2_INT)
+    const __m128i low = _mm_set1_epi16(0xFF);
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i v;
+    __m128i* out;
+
+    for (; u + 4 <= dim; u += 4) {
+        v = _mm_loadu_si128((const __m128i*) (row + 4 * u));
+        v = _mm_add_epi16(_mm_and_si128(v, low), _mm_srli_epi16(v, 8));
+        v = _mm_madd_epi16(v, one);
+        v = _mm_packs_epi32(v, v);
+        out = (__m128i*) (sum + u);
+        _mm_storel_epi64(out, _mm_add_epi16(_mm_loadl_epi64(out), v));
+    }
+#endif
+
+    for (; u < dim; ++u)
+        sum[u] += row[4 * u] + row[4 * u + 1] + row[4 * u + 2] + 
+                                                            row[4 * u + 3];
+}
+
+/**
+* @brief Sums of each group of 8 pixels of a row, added to dim cells.
+*
+* @param  row are the 8 * dim pixels of the row
+* @param  sum are the dim sums of the cells
+* @param  dim is the number of cells
+*/
+static inline void add_row_x8(const unsigned char* row, unsigned short* sum,
+                                                                int dim) {
+    int u = 0, x;
+
+#if defined(KERNEL_NEON)
+    uint16x8_t a, b;
+
+    for (; u + 4 <= dim; u += 4) {
+        a = vpaddlq_u8(vld1q_u8(row + 8 * u));
+        b = vpaddlq_u8(vld1q_u8(row + 8 * u + 16));
+        vst1_u16(sum + u, vadd_u16(vld1_u16(sum + u), vpadd_u16(
+                            vpadd_u16(vget_low_u16(a), vget_high_u16(a)),
+                            vpadd_u16(vget_low_u16(b), vget_high_u16(b)))));
+    }
+#elif defined(KERNEL_SSE2_INT)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a, b;
+    __m128i* out;
+
+    /**< Each sad gives the sums of 8 pixels in the lanes 0 and 4. */
+    for (; u + 4 <= dim; u += 4) {
+        a = _mm_sad_epu8(_mm_loadu_si128((const __m128i*) (row + 8 * u)), 
+                                                                    zero);
+        b = _mm_sad_epu8(_mm_loadu_si128(
+                            (const __m128i*) (row + 8 * u + 16)), zero);
+        a = _mm_packs_epi32(a, b);
+        a = _mm_packs_epi32(a, a);
+        out = (__m128i*) (sum + u);
+        _mm_storel_epi64(out, _mm_add_epi16(_mm_loadl_epi64(out), a));
+    }
+#endif
+
+    for (; u < dim; ++u)
+        for (x = 0; x < 8; ++x)
+            sum[u] += row[8 * u + x];
+}
+
+/**
+* @brief Downsampling kernels specialized on the factor.
+*
+* One downsample_x<factor> is generated for 2, 4 and 8, the ratios between
+* the sizes of the ROI and the input image. The F rows of a band of cells
+* are summed by add_row_x<factor> on 16-bit sums, which hold up to 257 
+* pixels, then each sum is compared with the threshold of the cell area.
+*/
+#define DEFINE_DOWNSAMPLE(F)                                                \
+static void downsample_x##F(const unsigned char* src, int stride, int dim,  \
+                int threshold, unsigned char* dst, int dst_row, int dst_col) \
+{                                                                           \
+    int u, v, y;                                                            \
+    unsigned short sum[DOWNSAMPLE_MAX_DIM];                                 \
+    const int limit = threshold * F * F;                                    \
+                                                                            \
+    for (v = 0; v < dim; ++v) {                                             \
+        memset(sum, 0, dim * sizeof(sum[0]));                               \
+        for (y = 0; y < F; ++y)                                             \
+            add_row_x##F(src + (v * F + y) * stride, sum, dim);             \
+                                                                            \
+        for (u = 0; u < dim; ++u)                                           \
+            dst[v * dst_row + u * dst_col] = sum[u] < limit;                \
+    }                                                                       \
+}
+
+DEFINE_DOWNSAMPLE(2)
+DEFINE_DOWNSAMPLE(4)
+DEFINE_DOWNSAMPLE(8)
+
+/**
+* GLOBAL FUNCTIONS
+*/
+
+/**
+* @brief Name of the kernel set selected at compile time.
+*
+* @return a constant string {"neon", "avx", "sse", "scalar"}
+*/
+const char* kernel_name() {
+    return KERNEL_NAME;
+}
+
+/**
+* @brief Dot product of two vectors of n floats.
+*
+* @param  a is the first vector
+* @param  b is the second vector
+* @param  n is the length of both vectors
+* @return the sum of a[j] * b[j]
+*/
+float dot_product(const float* a, const float* b, int n) {
+    return dot_product_inline(a, b, n);
+}
+
+/**
+* @brief Weighted sums of a sinapsi.
+*
+* For each outgoing neuron i it computes z[i] = [sum of (W[i][j] * x[j])] +
+* b[i], the rows of W are stored back to back.
+*
+* @param  weights is the rows x cols matrix of the sinapsi
+* @param  bias is the bias of each row
+* @param  x is the activation of the incoming layer
+* @param  z is the weighted input of the outgoing layer
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+*/
+void gemv(const float* weights, const float* bias, const float* x, float* z,
+                                                        int rows, int cols) {
+    int i;
+
+    for (i = 0; i < rows; ++i)
+        z[i] = dot_product(weights + i * cols, x, cols) + bias[i];
+}
+
+/**
+* @brief Gemv kernels specialized on the number of columns.
+*
+* One gemv_c<cols> is generated for each number of columns listed in 
+* NN_FIXED_COLS, the dot products are inlined with a constant length.
+*/
+#define DEFINE_GEMV_FIXED(COLS)                                             \
+void gemv_c##COLS(const float* weights, const float* bias, const float* x,  \
+                                                    float* z, int rows) {   \
+    int i;                                                                  \
+                                                                            \
+    for (i = 0; i < rows; ++i)                                              \
+        z[i] = dot_product_inline(weights + i * COLS, x, COLS) + bias[i];   \
+}
+
+NN_FIXED_COLS(DEFINE_GEMV_FIXED)
+
+/**
+* @brief Weighted sums of a sinapsi for a batch of inputs.
+*
+* It is the gemv of n inputs at once, Z = X W^T + b. Each row of W is read
+* from memory once per batch: it is multiplied by four inputs for each load
+* and it is still in the L1 cache for the following ones.
+*
+* @param  weights is the rows x cols matrix of the sinapsi
+* @param  bias is the bias of each row
+* @param  x is the n x cols matrix of the incoming activations
+* @param  z is the n x rows matrix of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+* @param  n is the number of inputs of the batch
+*/
+void gemm(const float* weights, const float* bias, const float* x, float* z,
+                                                int rows, int cols, int n) {
+    int i, b, k;
+    const float* row;
+    const float* in[4];     /**< Inputs sharing the loads of the row. */
+    float sum[4];
+
+    for (i = 0; i < rows; ++i) {
+        row = weights + i * cols;
+
+        for (b = 0; b + 4 <= n; b += 4) {
+            for (k = 0; k < 4; ++k)
+                in[k] = x + (b + k) * cols;
+
+            dot_product_x4(row, in, cols, sum);
+
+            for (k = 0; k < 4; ++k)
+                z[(b + k) * rows + i] = sum[k] + bias[i];
+        }
+
+        for (; b < n; ++b)
+            z[b * rows + i] = dot_product(row, x + b * cols, cols) + bias[i];
+    }
+}
+
+/**
+* @brief Copy the weights of a sinapsi in panels of rows.
+*
+* Each panel holds NN_PANEL_ROWS consecutive rows, stored by blocks of 
+* NN_PANEL_COLS columns: the block b of the rows is followed by the block
+* b + 1. A panel takes the same space of its rows in the dense layout, so 
+* the panel of the row i starts at i * cols.
+*
+* @param  weights are the dense weights, rows stored back to back
+* @param  panels is the output, rows * cols floats
+* @param  rows is the number of rows, a multiple of NN_PANEL_ROWS
+* @param  cols is the number of columns, a multiple of NN_PANEL_COLS
+*/
+void pack_panels(const float* weights, float* panels, int rows, int cols) {
+
+    int i, j, r;
+
+    for (i = 0; i < rows; i += NN_PANEL_ROWS)
+        for (j = 0; j < cols; j += NN_PANEL_COLS)
+            for (r = 0; r < NN_PANEL_ROWS; ++r) {
+                memcpy(panels, weights + (size_t) (i + r) * cols + j, 
+                                            NN_PANEL_COLS * sizeof(float));
+                panels += NN_PANEL_COLS;
+            }
+}
+
+/**
+* @brief Weighted sums of a sinapsi packed in panels.
+*
+* The activation vector is read once for each panel instead of once for 
+* each row, NN_PANEL_ROWS outputs are computed by each pass on it.
+*
+* @param  panels are the weights packed by pack_panels
+* @param  bias is the bias of each row
+* @param  x is the input vector of cols floats
+* @param  z is the output vector of rows floats
+* @param  rows is the number of rows, a multiple of NN_PANEL_ROWS
+* @param  cols is the number of columns, a multiple of NN_PANEL_COLS
+*/
+void gemv_panels(const float* panels, const float* bias, const float* x, 
+                                            float* z, int rows, int cols) {
+    int i, r;
+    float sum[NN_PANEL_ROWS];
+
+    for (i = 0; i < rows; i += NN_PANEL_ROWS) {
+        panel_dot(panels + (size_t) i * cols, x, cols, sum);
+
+        for (r = 0; r < NN_PANEL_ROWS; ++r)
+            z[i + r] = sum[r] + bias[i + r];
+    }
+}
+
+/**
+* @brief Weighted sums of a sinapsi packed in panels for a batch of inputs.
+*
+* Each panel is applied to every input of the batch before the next one, so
+* it is read from memory once and then from the L1 cache.
+*
+* @param  panels are the weights packed by pack_panels
+* @param  bias is the bias of each row
+* @param  x are the n input vectors of cols floats, back to back
+* @param  z are the n output vectors of rows floats, back to back
+* @param  rows is the number of rows, a multiple of NN_PANEL_ROWS
+* @param  cols is the number of columns, a multiple of NN_PANEL_COLS
+* @param  n is the number of inputs
+*/
+void gemm_panels(const float* panels, const float* bias, const float* x, 
+                                    float* z, int rows, int cols, int n) {
+    int i, b, r;
+    float sum[NN_PANEL_ROWS];
+
+    for (i = 0; i < rows; i += NN_PANEL_ROWS)
+        for (b = 0; b < n; ++b) {
+            panel_dot(panels + (size_t) i * cols, x + b * cols, cols, sum);
+
+            for (r = 0; r < NN_PANEL_ROWS; ++r)
+                z[b * rows + i + r] = sum[r] + bias[i + r];
+        }
+}
+
+/**
+* @brief Element-wise sum of two vectors.
+*
+* @param  x is the vector to be added
+* @param  y is the vector which accumulates the sum
+* @param  n is the length of both vectors
+*/
+void vector_add(const float* x, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    for (; j + 8 <= n; j += 8) {
+        vst1q_f32(y + j,     vaddq_f32(vld1q_f32(y + j),     vld1q_f32(x + j)));
+        vst1q_f32(y + j + 4, vaddq_f32(vld1q_f32(y + j + 4), 
+                                                        vld1q_f32(x + j + 4)));
+    }
+#elif defined(KERNEL_AVX)
+    for (; j + 8 <= n; j += 8)
+        _mm256_storeu_ps(y + j, _mm256_add_ps(_mm256_loadu_ps(y + j),
+                                                    _mm256_loadu_ps(x + j)));
+#elif defined(KERNEL_SSE)
+    for (; j + 4 <= n; j += 4)
+        _mm_storeu_ps(y + j, _mm_add_ps(_mm_loadu_ps(y + j), 
+                                                        _mm_loadu_ps(x + j)));
+#endif
+
+    for (; j < n; ++j)
+        y[j] += x[j];
+}
+
+/**
+* @brief Element-wise difference of two vectors.
+*
+* @param  x is the vector to be subtracted
+* @param  y is the vector which accumulates the difference
+* @param  n is the length of both vectors
+*/
+void vector_sub(const float* x, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    for (; j + 8 <= n; j += 8) {
+        vst1q_f32(y + j,     vsubq_f32(vld1q_f32(y + j),     vld1q_f32(x + j)));
+        vst1q_f32(y + j + 4, vsubq_f32(vld1q_f32(y + j + 4), 
+                                                        vld1q_f32(x + j + 4)));
+    }
+#elif defined(KERNEL_AVX)
+    for (; j + 8 <= n; j += 8)
+        _mm256_storeu_ps(y + j, _mm256_sub_ps(_mm256_loadu_ps(y + j),
+                                                    _mm256_loadu_ps(x + j)));
+#elif defined(KERNEL_SSE)
+    for (; j + 4 <= n; j += 4)
+        _mm_storeu_ps(y + j, _mm_sub_ps(_mm_loadu_ps(y + j), 
+                                                        _mm_loadu_ps(x + j)));
+#endif
+
+    for (; j < n; ++j)
+        y[j] -= x[j];
+}
+
+/**
+* @brief Scaled sum of two vectors.
+*
+* @param  a is the scale factor of x
+* @param  x is the vector to be scaled and added
+* @param  y is the vector which accumulates the sum
+* @param  n is the length of both vectors
+*/
+void axpy(float a, const float* x, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    float32x4_t scale = vdupq_n_f32(a);
+
+    for (; j + 4 <= n; j += 4)
+        vst1q_f32(y + j, neon_mac(vld1q_f32(y + j), scale, vld1q_f32(x + j)));
+#elif defined(KERNEL_AVX)
+    __m256 scale = _mm256_set1_ps(a);
+
+    for (; j + 8 <= n; j += 8)
+        _mm256_storeu_ps(y + j, avx_mac(_mm256_loadu_ps(y + j), scale,
+                                                    _mm256_loadu_ps(x + j)));
+#elif defined(KERNEL_SSE)
+    __m128 scale = _mm_set1_ps(a);
+
+    for (; j + 4 <= n; j += 4)
+        _mm_storeu_ps(y + j, _mm_add_ps(_mm_loadu_ps(y + j), 
+                                    _mm_mul_ps(scale, _mm_loadu_ps(x + j))));
+#endif
+
+    for (; j < n; ++j)
+        y[j] += a * x[j];
+}
+
+/**
+* @brief Symmetric int8 quantization of a vector.
+*
+* The scale maps the largest absolute value of x to 127, so that every value
+* is rounded to the nearest of q * scale with q in [-127, 127].
+*
+* @param  x is the vector to be quantized
+* @param  q is the quantized vector
+* @param  n is the length of both vectors
+* @return the scale of the quantized vector
+*/
+float quantize_i8(const float* x, signed char* q, int n) {
+
+    int j;
+    float max = 0;
+    float scale, inv_scale;
+
+    for (j = 0; j < n; ++j) {
+        if (x[j] > max)
+            max = x[j];
+        else if (-x[j] > max)
+            max = -x[j];
+    }
+
+    scale = (max > 0) ? max / 127 : 1;
+    inv_scale = 1 / scale;
+
+    for (j = 0; j < n; ++j)
+        q[j] = (signed char) (x[j] * inv_scale + ((x[j] >= 0) ? 0.5f : -0.5f));
+
+    return scale;
+}
+
+/**
+* @brief Dot product of two int8 vectors.
+*
+* The products are accumulated on int32, on ARMv8.2 with the sdot 
+* instruction, on older NEON with vmull/vmlal on int16 and a pairwise add on
+* int32. Two products of values in [-127, 127] always fit in an int16.
+*
+* @param  a is the first vector
+* @param  b is the second vector
+* @param  n is the length of both vectors
+* @return the sum of a[j] * b[j]
+*/
+int dot_product_i8(const signed char* a, const signed char* b, int n) {
+
+    int j = 0;
+    int sum = 0;
+
+#if defined(KERNEL_NEON)
+    int32x4_t acc = vdupq_n_s32(0);
+
+    for (; j + 16 <= n; j += 16) {
+        int8x16_t va = vld1q_s8(a + j);
+        int8x16_t vb = vld1q_s8(b + j);
+#if defined(__ARM_FEATURE_DOTPROD)
+        acc = vdotq_s32(acc, va, vb);
+#else
+        int16x8_t prod = vmull_s8(vget_low_s8(va), vget_low_s8(vb));
+        prod = vmlal_s8(prod, vget_high_s8(va), vget_high_s8(vb));
+        acc = vpadalq_s16(acc, prod);
+#endif
+    }
+
+    sum = neon_sum_s32(acc);
+#elif defined(KERNEL_SSE2_INT)
+    __m128i acc = _mm_setzero_si128();
+
+    for (; j + 16 <= n; j += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*) (a + j));
+        __m128i vb = _mm_loadu_si128((const __m128i*) (b + j));
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(sse2_lo_s16(va), 
+                                                        sse2_lo_s16(vb)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(sse2_hi_s16(va), 
+                                                        sse2_hi_s16(vb)));
+    }
+
+    sum = sse2_sum_s32(acc);
+#endif
+
+    for (; j < n; ++j)
+        sum += a[j] * b[j];
+
+    return sum;
+}
+
+/**
+* @brief Weighted sums of an int8 sinapsi.
+*
+* For each outgoing neuron i it computes the int32 sum of (Wq[i][j] * xq[j])
+* and dequantizes it as z[i] = sum * scale[i] * x_scale + b[i].
+*
+* @param  weights is the rows x cols int8 matrix of the sinapsi
+* @param  scale is the scale of each row of the matrix
+* @param  bias is the bias of each row
+* @param  x is the int8 activation of the incoming layer
+* @param  x_scale is the scale of the incoming activation
+* @param  z is the weighted input of the outgoing layer
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+*/
+void gemv_i8(const signed char* weights, const float* scale, const float* bias,
+            const signed char* x, float x_scale, float* z, int rows, int cols) {
+    int i;
+
+    for (i = 0; i < rows; ++i)
+        z[i] = dot_product_i8(weights + i * cols, x, cols) * scale[i] * x_scale
+                                                                    + bias[i];
+}
+
+/**
+* @brief Weighted sums of an int8 sinapsi for a batch of inputs.
+*
+* It is the gemv_i8 of n inputs at once, each input has its own scale. Each
+* row of W is read from memory once and stays in the L1 cache for the whole
+* batch.
+*
+* @param  weights is the rows x cols int8 matrix of the sinapsi
+* @param  scale is the scale of each row of the matrix
+* @param  bias is the bias of each row
+* @param  x is the n x cols int8 matrix of the incoming activations
+* @param  x_scale is the scale of each incoming activation vector
+* @param  z is the n x rows matrix of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+* @param  n is the number of inputs of the batch
+*/
+void gemm_i8(const signed char* weights, const float* scale, const float* bias,
+                    const signed char* x, const float* x_scale, float* z, 
+                    int rows, int cols, int n) {
+    int i, b;
+
+    for (i = 0; i < rows; ++i)
+        for (b = 0; b < n; ++b)
+            z[b * rows + i] = dot_product_i8(weights + i * cols, x + b * cols,
+                                    cols) * scale[i] * x_scale[b] + bias[i];
+}
+
+/**
+* @brief Element-wise sum of an int8 vector on an int32 one.
+*
+* @param  x is the vector to be added
+* @param  y is the vector which accumulates the sum
+* @param  n is the length of both vectors
+*/
+void vector_add_i8(const signed char* x, int* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    for (; j + 8 <= n; j += 8) {
+        int16x8_t w = vmovl_s8(vld1_s8(x + j));
+
+        vst1q_s32(y + j,     vaddw_s16(vld1q_s32(y + j),     vget_low_s16(w)));
+        vst1q_s32(y + j + 4, vaddw_s16(vld1q_s32(y + j + 4), vget_high_s16(w)));
+    }
+#elif defined(KERNEL_SSE2_INT)
+    for (; j + 8 <= n; j += 8) {
+        __m128i w = sse2_lo_s16(_mm_loadl_epi64((const __m128i*) (x + j)));
+        __m128i* out = (__m128i*) (y + j);
+
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), 
+                            _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16)));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1),
+                            _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16)));
+    }
+#endif
+
+    for (; j < n; ++j)
+        y[j] += x[j];
+}
+
+/**
+* @brief Element-wise difference of an int8 vector from an int32 one.
+*
+* @param  x is the vector to be subtracted
+* @param  y is the vector which accumulates the difference
+* @param  n is the length of both vectors
+*/
+void vector_sub_i8(const signed char* x, int* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    for (; j + 8 <= n; j += 8) {
+        int16x8_t w = vmovl_s8(vld1_s8(x + j));
+
+        vst1q_s32(y + j,     vsubw_s16(vld1q_s32(y + j),     vget_low_s16(w)));
+        vst1q_s32(y + j + 4, vsubw_s16(vld1q_s32(y + j + 4), vget_high_s16(w)));
+    }
+#elif defined(KERNEL_SSE2_INT)
+    for (; j + 8 <= n; j += 8) {
+        __m128i w = sse2_lo_s16(_mm_loadl_epi64((const __m128i*) (x + j)));
+        __m128i* out = (__m128i*) (y + j);
+
+        _mm_storeu_si128(out, _mm_sub_epi32(_mm_loadu_si128(out), 
+                            _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16)));
+        _mm_storeu_si128(out + 1, _mm_sub_epi32(_mm_loadu_si128(out + 1),
+                            _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16)));
+    }
+#endif
+
+    for (; j < n; ++j)
+        y[j] -= x[j];
+}
+
+/**
+* @brief Conversion of a float to an IEEE half-precision value.
+*
+* The value is rounded to the nearest half, ties to even. Values too large
+* become infinite and values too small become subnormal or zero.
+*
+* @param  f is the float to be converted
+* @return the bits of the half-precision value
+*/
+unsigned short float_to_half(float f) {
+
+    unsigned int bits, mant, half, rem, shift;
+    unsigned int sign;
+    int exp;
+
+    memcpy(&bits, &f, sizeof(bits));
+
+    sign = (bits >> 16) & 0x8000;
+    exp  = (int) ((bits >> 23) & 0xFF) - 127 + 15;
+    mant = bits & 0x7FFFFF;
+
+    /**< Infinite and NaN. */
+    if (((bits >> 23) & 0xFF) == 0xFF)
+        return sign | 0x7C00 | (mant ? 0x200 : 0);
+
+    /**< Overflow. */
+    if (exp >= 31)
+        return sign | 0x7C00;
+
+    /**< Subnormal half or zero. */
+    if (exp <= 0) {
+        if (exp < -10)
+            return sign;
+
+        mant |= 0x800000;
+        shift = 14 - exp;
+        half = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+
+        if (rem > (1u << (shift - 1)) || 
+                                (rem == (1u << (shift - 1)) && (half & 1)))
+            half++;
+
+        return sign | half;
+    }
+
+    half = ((unsigned int) exp << 10) | (mant >> 13);
+    rem = mant & 0x1FFF;
+
+    /**< A carry of the rounding moves correctly into the exponent. */
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+        half++;
+
+    return sign | half;
+}
+
+/**
+* @brief Conversion of an IEEE half-precision value to a float.
+*
+* @param  h is the bits of the half-precision value
+* @return the float value, which is always exact
+*/
+float half_to_float(unsigned short h) {
+
+    unsigned int sign = (unsigned int) (h & 0x8000) << 16;
+    unsigned int exp = (h >> 10) & 0x1F;
+    unsigned int mant = h & 0x3FF;
+    unsigned int bits;
+    float f;
+
+    if (exp == 0) {
+        if (mant == 0) {
+            bits = sign;
+        }
+        else {
+            /**< Subnormal half, normalize it. */
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+        }
+    }
+    else if (exp == 31) {
+        bits = sign | 0x7F800000 | (mant << 13);
+    }
+    else {
+        bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+
+    memcpy(&f, &bits, sizeof(f));
+
+    return f;
+}
+
+/**
+* @brief Dot product of fp16 weights with a float vector.
+*
+* The weights are widened to float in the inner loop, the products are 
+* accumulated on float.
+*
+* @param  a is the fp16 vector
+* @param  b is the float vector
+* @param  n is the length of both vectors
+* @return the sum of a[j] * b[j]
+*/
+float dot_product_f16(const unsigned short* a, const float* b, int n) {
+
+    int j = 0;
+    float sum = 0;
+
+#if defined(KERNEL_NEON_F16)
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+
+    for (; j + 8 <= n; j += 8) {
+        acc0 = neon_mac(acc0, neon_load_f16(a + j),     vld1q_f32(b + j));
+        acc1 = neon_mac(acc1, neon_load_f16(a + j + 4), vld1q_f32(b + j + 4));
+    }
+
+    sum = neon_sum(vaddq_f32(acc0, acc1));
+#elif defined(KERNEL_AVX_F16)
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+
+    for (; j + 16 <= n; j += 16) {
+        acc0 = avx_mac(acc0, avx_load_f16(a + j), _mm256_loadu_ps(b + j));
+        acc1 = avx_mac(acc1, avx_load_f16(a + j + 8), 
+                                                _mm256_loadu_ps(b + j + 8));
+    }
+
+    sum = avx_sum(_mm256_add_ps(acc0, acc1));
+#endif
+
+    for (; j < n; ++j)
+        sum += half_to_float(a[j]) * b[j];
+
+    return sum;
+}
+
+/**
+* @brief Weighted sums of a sinapsi with fp16 weights.
+*
+* @param  weights is the rows x cols fp16 matrix of the sinapsi
+* @param  bias is the bias of each row
+* @param  x is the activation of the incoming layer
+* @param  z is the weighted input of the outgoing layer
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+*/
+void gemv_f16(const unsigned short* weights, const float* bias, const float* x,
+                                            float* z, int rows, int cols) {
+    int i;
+
+    for (i = 0; i < rows; ++i)
+        z[i] = dot_product_f16(weights + i * cols, x, cols) + bias[i];
+}
+
+/**
+* @brief Weighted sums of a fp16 sinapsi for a batch of inputs.
+*
+* It is the gemv_f16 of n inputs at once. Each row of W is read from memory
+* once and stays in the L1 cache for the whole batch.
+*
+* @param  weights is the rows x cols fp16 matrix of the sinapsi
+* @param  bias is the bias of each row
+* @param  x is the n x cols matrix of the incoming activations
+* @param  z is the n x rows matrix of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+* @param  n is the number of inputs of the batch
+*/
+void gemm_f16(const unsigned short* weights, const float* bias, const float* x,
+                                        float* z, int rows, int cols, int n) {
+    int i, b;
+
+    for (i = 0; i < rows; ++i)
+        for (b = 0; b < n; ++b)
+            z[b * rows + i] = dot_product_f16(weights + i * cols, x + b * cols,
+                                                            cols) + bias[i];
+}
+
+/**
+* @brief Element-wise sum of a fp16 vector on a float one.
+*
+* @param  x is the vector to be added
+* @param  y is the vector which accumulates the sum
+* @param  n is the length of both vectors
+*/
+void vector_add_f16(const unsigned short* x, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON_F16)
+    for (; j + 4 <= n; j += 4)
+        vst1q_f32(y + j, vaddq_f32(vld1q_f32(y + j), neon_load_f16(x + j)));
+#elif defined(KERNEL_AVX_F16)
+    for (; j + 8 <= n; j += 8)
+        _mm256_storeu_ps(y + j, _mm256_add_ps(_mm256_loadu_ps(y + j),
+                                                        avx_load_f16(x + j)));
+#endif
+
+    for (; j < n; ++j)
+        y[j] += half_to_float(x[j]);
+}
+
+/**
+* @brief Element-wise difference of a fp16 vector from a float one.
+*
+* @param  x is the vector to be subtracted
+* @param  y is the vector which accumulates the difference
+* @param  n is the length of both vectors
+*/
+void vector_sub_f16(const unsigned short* x, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON_F16)
+    for (; j + 4 <= n; j += 4)
+        vst1q_f32(y + j, vsubq_f32(vld1q_f32(y + j), neon_load_f16(x + j)));
+#elif defined(KERNEL_AVX_F16)
+    for (; j + 8 <= n; j += 8)
+        _mm256_storeu_ps(y + j, _mm256_sub_ps(_mm256_loadu_ps(y + j),
+                                                        avx_load_f16(x + j)));
+#endif
+
+    for (; j < n; ++j)
+        y[j] -= half_to_float(x[j]);
+}
+
+/**
+* @brief Weighted sums z = W x + b of a sparse sinapsi.
+*
+* The rows of W are stored in CSR format: the values of the row i and their
+* columns are values[k] and index[k], for k from row_start[i] to 
+* row_start[i+1]. The gathers of x do not vectorize, so each row is summed 
+* on 4 accumulators to hide the latency of the additions.
+*
+* @param  row_start is the first value of each row, rows + 1 entries
+* @param  index is the column of each value
+* @param  values are the non-zero weights
+* @param  bias is the bias of each row
+* @param  x is the vector of the incoming activations
+* @param  z is the vector of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+*/
+void spmv(const int* row_start, const short* index, const float* values,
+                    const float* bias, const float* x, float* z, int rows) {
+    int i, k, end;
+    float s0, s1, s2, s3;
+
+    for (i = 0; i < rows; ++i) {
+        s0 = s1 = s2 = s3 = 0;
+        k = row_start[i];
+        end = row_start[i+1];
+
+        for (; k + 4 <= end; k += 4) {
+            s0 += values[k] * x[index[k]];
+            s1 += values[k+1] * x[index[k+1]];
+            s2 += values[k+2] * x[index[k+2]];
+            s3 += values[k+3] * x[index[k+3]];
+        }
+        for (; k < end; ++k)
+            s0 += values[k] * x[index[k]];
+
+        z[i] = (s0 + s1) + (s2 + s3) + bias[i];
+    }
+}
+
+/**
+* @brief Weighted sums of a sparse sinapsi for a batch of inputs.
+*
+* Each row of W is read once for 4 inputs of the batch, the index and the 
+* value loads are shared by their sums.
+*
+* @param  row_start is the first value of each row, rows + 1 entries
+* @param  index is the column of each value
+* @param  values are the non-zero weights
+* @param  bias is the bias of each row
+* @param  x is the n x cols matrix of the incoming activations
+* @param  z is the n x rows matrix of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+* @param  n is the number of inputs of the batch
+*/
+void spmm(const int* row_start, const short* index, const float* values,
+        const float* bias, const float* x, float* z, int rows, int cols, 
+        int n) {
+    int i, b, k;
+    float s0, s1, s2, s3;
+    const float *x0, *x1, *x2, *x3;
+
+    for (i = 0; i < rows; ++i) {
+        for (b = 0; b + 4 <= n; b += 4) {
+            x0 = x + b * cols;
+            x1 = x0 + cols;
+            x2 = x1 + cols;
+            x3 = x2 + cols;
+            s0 = s1 = s2 = s3 = 0;
+
+            for (k = row_start[i]; k < row_start[i+1]; ++k) {
+                s0 += values[k] * x0[index[k]];
+                s1 += values[k] * x1[index[k]];
+                s2 += values[k] * x2[index[k]];
+                s3 += values[k] * x3[index[k]];
+            }
+
+            z[b * rows + i] = s0 + bias[i];
+            z[(b + 1) * rows + i] = s1 + bias[i];
+            z[(b + 2) * rows + i] = s2 + bias[i];
+            z[(b + 3) * rows + i] = s3 + bias[i];
+        }
+
+        for (; b < n; ++b)
+            spmv(row_start + i, index, values, bias + i, x + b * cols, 
+                                                        z + b * rows + i, 1);
+    }
+}
+
+/**
+* @brief Weighted sums of a sparse int8 sinapsi.
+*
+* Same CSR format of spmv with int8 values, the products are accumulated on 
+* int32 and each sum is dequantized as in gemv_i8, so the result is the same
+* of gemv_i8 on the dense matrix.
+*
+* @param  row_start is the first value of each row, rows + 1 entries
+* @param  index is the column of each value
+* @param  values are the non-zero int8 weights
+* @param  scale is the scale of each row of the matrix
+* @param  bias is the bias of each row
+* @param  x is the vector of the int8 incoming activations
+* @param  x_scale is the scale of x
+* @param  z is the vector of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+*/
+void spmv_i8(const int* row_start, const short* index, 
+            const signed char* values, const float* scale, const float* bias,
+            const signed char* x, float x_scale, float* z, int rows) {
+    int i, k;
+    int sum;
+
+    for (i = 0; i < rows; ++i) {
+        sum = 0;
+        for (k = row_start[i]; k < row_start[i+1]; ++k)
+            sum += values[k] * x[index[k]];
+
+        z[i] = sum * scale[i] * x_scale + bias[i];
+    }
+}
+
+/**
+* @brief Weighted sums of a sparse int8 sinapsi for a batch of inputs.
+*
+* As in spmm, each row of W is read once for 4 inputs of the batch.
+*
+* @param  row_start is the first value of each row, rows + 1 entries
+* @param  index is the column of each value
+* @param  values are the non-zero int8 weights
+* @param  scale is the scale of each row of the matrix
+* @param  bias is the bias of each row
+* @param  x is the n x cols int8 matrix of the incoming activations
+* @param  x_scale is the scale of each incoming activation vector
+* @param  z is the n x rows matrix of the outgoing weighted inputs
+* @param  rows is the number of outgoing neurons
+* @param  cols is the number of incoming neurons
+* @param  n is the number of inputs of the batch
+*/
+void spmm_i8(const int* row_start, const short* index, 
+            const signed char* values, const float* scale, const float* bias,
+            const signed char* x, const float* x_scale, float* z, 
+            int rows, int cols, int n) {
+    int i, b, k;
+    int s0, s1, s2, s3;
+    const signed char *x0, *x1, *x2, *x3;
+
+    for (i = 0; i < rows; ++i) {
+        for (b = 0; b + 4 <= n; b += 4) {
+            x0 = x + b * cols;
+            x1 = x0 + cols;
+            x2 = x1 + cols;
+            x3 = x2 + cols;
+            s0 = s1 = s2 = s3 = 0;
+
+            for (k = row_start[i]; k < row_start[i+1]; ++k) {
+                s0 += values[k] * x0[index[k]];
+                s1 += values[k] * x1[index[k]];
+                s2 += values[k] * x2[index[k]];
+                s3 += values[k] * x3[index[k]];
+            }
+
+            z[b * rows + i] = s0 * scale[i] * x_scale[b] + bias[i];
+            z[(b + 1) * rows + i] = s1 * scale[i] * x_scale[b + 1] + bias[i];
+            z[(b + 2) * rows + i] = s2 * scale[i] * x_scale[b + 2] + bias[i];
+            z[(b + 3) * rows + i] = s3 * scale[i] * x_scale[b + 3] + bias[i];
+        }
+
+        for (; b < n; ++b)
+            spmv_i8(row_start + i, index, values, scale + i, bias + i, 
+                            x + b * cols, x_scale[b], z + b * rows + i, 1);
+    }
+}
+
+/**
+* @brief Scaled sum y += a * x of a sparse vector on a dense one.
+*
+* @param  a is the scale of x
+* @param  index is the position in y of each value of x
+* @param  values are the n values of x
+* @param  y is the vector which accumulates the sum
+* @param  n is the number of values of x
+*/
+void sparse_axpy(float a, const short* index, const float* values, float* y,
+                                                                    int n) {
+    int k;
+
+    for (k = 0; k < n; ++k)
+        y[index[k]] += a * values[k];
+}
+
+/**
+* @brief Sum of a sparse int8 vector on an int32 one.
+*
+* @param  index is the position in y of each value of x
+* @param  values are the n values of x
+* @param  y is the vector which accumulates the sum
+* @param  n is the number of values of x
+*/
+void sparse_add_i8(const short* index, const signed char* values, int* y, 
+                                                                    int n) {
+    int k;
+
+    for (k = 0; k < n; ++k)
+        y[index[k]] += values[k];
+}
+
+/**
+* @brief Difference of a sparse int8 vector from an int32 one.
+*
+* @param  index is the position in y of each value of x
+* @param  values are the n values of x
+* @param  y is the vector which accumulates the difference
+* @param  n is the number of values of x
+*/
+void sparse_sub_i8(const short* index, const signed char* values, int* y, 
+                                                                    int n) {
+    int k;
+
+    for (k = 0; k < n; ++k)
+        y[index[k]] -= values[k];
+}
+
+/**
+* @brief Area-average a square gray image down to dim x dim and binarize it.
+*
+* The image is split in dim x dim cells, the cell (u, v) covers the columns
+* from u * size / dim to (u + 1) * size / dim and the same rows. A cell is
+* black when the mean of its pixels is below threshold, the comparison is
+* done on the integer sum. A cell is at least one pixel wide, so an image
+* smaller than dim x dim is read with the nearest pixel.
+*
+* The sides 2, 4 and 8 times dim, the sizes of the ROI, are handled by the
+* vectorized downsample_x<factor>, the others by the portable loop.
+*
+* @param  src is the first pixel of the image, 8-bit gray levels
+* @param  stride is the distance in pixels between two rows of src
+* @param  size is the side of the image in pixels
+* @param  dim is the side of the output in cells
+* @param  threshold is the gray level from which a cell is white
+* @param  dst is the output, 1 if the cell (u, v) is black
+* @param  dst_row is the distance in dst between two rows of cells
+* @param  dst_col is the distance in dst between two columns of cells
+*/
+void downsample_binarize(const unsigned char* src, int stride, int size,
+                        int dim, int threshold, unsigned char* dst,
+                        int dst_row, int dst_col) {
+    int u, v, x, y;
+    int x0, x1, y0, y1;         /**< Bounds of a cell. */
+    unsigned int sum;
+    const unsigned char* row;
+
+    if (dim <= DOWNSAMPLE_MAX_DIM) {
+        if (size == 2 * dim) {
+            downsample_x2(src, stride, dim, threshold, dst, dst_row, dst_col);
+            return;
+        }
+        if (size == 4 * dim) {
+            downsample_x4(src, stride, dim, threshold, dst, dst_row, dst_col);
+            return;
+        }
+        if (size == 8 * dim) {
+            downsample_x8(src, stride, dim, threshold, dst, dst_row, dst_col);
+            return;
+        }
+    }
+
+    for (v = 0; v < dim; ++v) {
+        y0 = v * size / dim;
+        y1 = (v + 1) * size / dim;
+        if (y1 == y0)
+            y1 = y0 + 1;
+
+        for (u = 0; u < dim; ++u) {
+            x0 = u * size / dim;
+            x1 = (u + 1) * size / dim;
+            if (x1 == x0)
+                x1 = x0 + 1;
+
+            sum = 0;
+            for (y = y0; y < y1; ++y) {
+                row = src + y * stride;
+                for (x = x0; x < x1; ++x)
+                    sum += row[x];
+            }
+
+            dst[v * dst_row + u * dst_col] =
+                    sum < (unsigned int)(threshold * (x1 - x0) * (y1 - y0));
+        }
+    }
+}
+
+/**
+* @brief Fast exponential of a vector.
+*
+* @param  x is the input vector
+* @param  y is the output vector, it can be the same of x
+* @param  n is the length of both vectors
+*/
+void vector_exp(const float* x, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    for (; j + 4 <= n; j += 4)
+        vst1q_f32(y + j, neon_exp(vld1q_f32(x + j)));
+#elif defined(KERNEL_SSE2_INT)
+    for (; j + 4 <= n; j += 4)
+        _mm_storeu_ps(y + j, sse2_exp(_mm_loadu_ps(x + j)));
+#endif
+
+    for (; j < n; ++j)
+        y[j] = scalar_exp(x[j]);
+}
+
+/**
+* @brief Fast logistic function of a vector.
+*
+* @param  z is the input vector
+* @param  y is the output vector, it can be the same of z
+* @param  n is the length of both vectors
+*/
+void vector_logistic(const float* z, float* y, int n) {
+
+    int j = 0;
+
+#if defined(KERNEL_NEON)
+    float32x4_t one = vdupq_n_f32(1);
+
+    for (; j + 4 <= n; j += 4)
+        vst1q_f32(y + j, neon_div(one, 
+                        vaddq_f32(one, neon_exp(vnegq_f32(vld1q_f32(z + j))))));
+#elif defined(KERNEL_SSE2_INT)
+    __m128 one = _mm_set1_ps(1);
+    __m128 zero = _mm_setzero_ps();
+
+    for (; j + 4 <= n; j += 4)
+        _mm_storeu_ps(y + j, _mm_div_ps(one, _mm_add_ps(one, 
+                        sse2_exp(_mm_sub_ps(zero, _mm_loadu_ps(z + j))))));
+#endif
+
+    for (; j < n; ++j)
+        y[j] = 1 / (1 + scalar_exp(-z[j]));
+}
+
+/**
+* @brief Fast softmax function of a vector.
+*
+* The max of z is subtracted before the exponential to avoid its overflow.
+*
+* @param  z is the input vector
+* @param  y is the output vector, it can be the same of z
+* @param  n is the length of both vectors
+*/
+void vector_softmax(const float* z, float* y, int n) {
+
+    int j;
+    float max = z[0];
+    float sum = 0;
+
+    for (j = 1; j < n; ++j)
+        if (z[j] > max)
+            max = z[j];
+
+    for (j = 0; j < n; ++j)
+        y[j] = z[j] - max;
+
+    vector_exp(y, y, n);
+
+    for (j = 0; j < n; ++j)
+        sum += y[j];
+
+    sum = 1 / sum;
+    for (j = 0; j < n; ++j)
+        y[j] *= sum;
+}
+
+/**
+* @brief Scalar reference of dot_product.
+*/
+float dot_product_ref(const float* a, const float* b, int n) {
+
+    int j;
+    float sum = 0;
+
+    for (j = 0; j < n; ++j)
+        sum += a[j] * b[j];
+
+    return sum;
+}
+
+/**
+* @brief Scalar reference of gemv.
+*/
+void gemv_ref(const float* weights, const float* bias, const float* x,
+                                            float* z, int rows, int cols) {
+    int i;
+
+    for (i = 0; i < rows; ++i)
+        z[i] = dot_product_ref(weights + i * cols, x, cols) + bias[i];
+}
+
+/**
+* @brief Libm reference of vector_logistic.
+*/
+void vector_logistic_ref(const float* z, float* y, int n) {
+
+    int j;
+
+    for (j = 0; j < n; ++j)
+        y[j] = 1 / (1 + exp(-z[j]));
+}
+
+/**
+* @brief Libm reference of vector_softmax.
+*/
+void vector_softmax_ref(const float* z, float* y, int n) {
+
+    int j;
+    float max = z[0];
+    float sum = 0;
+
+    for (j = 1; j < n; ++j)
+        if (z[j] > max)
+            max = z[j];
+
+    for (j = 0; j < n; ++j) {
+        y[j] = exp(z[j] - max);
+        sum += y[j];
+    }
+
+    for (j = 0; j < n; ++j)
+        y[j] /= sum;
+}
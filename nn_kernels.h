@@ -0,0 +1,195 @@
+#ifndef NN_KERNELS_H
+#define NN_KERNELS_H
+
+/**
+* @file nn_kernels.h
+* @author Gianluca D'Amico
+* @brief File containing the vectorized kernels of the neural network
+*
+* HANDLING MODEL KERNELS: It contains the low level loops used by the forward
+* pass of the neural network.
+*
+* The kernel set is selected at compile time from the target flags: NEON on
+* the Raspberry Pi, AVX or SSE on x86 hosts and a portable C loop elsewhere.
+* Defining NN_KERNELS_SCALAR forces the portable loop on every target. The
+* scalar functions (suffix _ref) are always compiled and are the reference
+* the vectorized ones are checked against by check_kernels (make 
+* check-kernels): they differ only by the order of the floating point 
+* additions, so a weighted sum of n terms differs from the reference by 
+* less than 2 n FLT_EPSILON times the sum of its absolute terms. vector_add,
+* vector_sub and the int32 sums of the int8 kernels are exact on every 
+* target, axpy can round its product and sum once instead of twice. The 
+* sparse kernels of the sinapsi stored in CSR format are plain C on every 
+* target. The downsampling of the camera frame to the input image is 
+* vectorized for the ratios 2, 4 and 8 of the ROI sizes, with integer sums
+* it is exact too.
+*
+* The fast activation kernels evaluate exp(x) as 2^n * p(r), with n the
+* nearest integer of x / ln(2), r = x - n ln(2) in [-ln(2)/2, ln(2)/2] and p
+* a degree 6 polynomial. The input is clamped to [-87, 88]. Measured against
+* the double precision exp, the relative error of vector_exp is below 1.5e-7
+* (about 1 ulp), the absolute error is below 1e-7 for vector_logistic and
+* below 5e-7 for vector_softmax. The _ref versions call the exp of libm.
+*
+*/
+
+/**
+* GLOBAL FUNCTION PROTOTYPES
+*/
+
+/**< Name of the kernel set selected at compile time. */
+const char* kernel_name();
+
+/**< Dot product of two vectors of n floats. */
+float dot_product(const float* a, const float* b, int n);
+
+/**< Weighted sums z = W x + b of a sinapsi with rows stored back to back. */
+void gemv(const float* weights, const float* bias, const float* x, float* z,
+                                                        int rows, int cols);
+
+/**< Numbers of columns of the gemv kernels specialized at compile time, a
+* gemv_c<cols>(weights, bias, x, z, rows) is declared for each one of them.
+* They are the sizes of the hidden layers of the known models.*/
+#define NN_FIXED_COLS(X)    X(32) X(64) X(128) X(512)
+
+#define DECLARE_GEMV_FIXED(COLS)                                            \
+void gemv_c##COLS(const float* weights, const float* bias, const float* x,  \
+                                                    float* z, int rows);
+
+/**< Weighted sums z = W x + b of a sinapsi with a constant number of
+* columns.*/
+NN_FIXED_COLS(DECLARE_GEMV_FIXED)
+
+/**< Weighted sums Z = X W^T + b of a batch of n inputs stored back to back. */
+void gemm(const float* weights, const float* bias, const float* x, float* z,
+                                                int rows, int cols, int n);
+
+/**< Rows and columns of the blocks of the weights packed in panels. The
+* vectorized kernels assume 4 rows and 8 columns.*/
+#define NN_PANEL_ROWS   4
+#define NN_PANEL_COLS   8
+
+/**< Copy of the weights of a sinapsi in panels of NN_PANEL_ROWS rows. */
+void pack_panels(const float* weights, float* panels, int rows, int cols);
+
+/**< Weighted sums z = W x + b of a sinapsi packed in panels. */
+void gemv_panels(const float* panels, const float* bias, const float* x, 
+                                            float* z, int rows, int cols);
+
+/**< Weighted sums of a sinapsi packed in panels for a batch of n inputs. */
+void gemm_panels(const float* panels, const float* bias, const float* x, 
+                                    float* z, int rows, int cols, int n);
+
+/**< Element-wise sum y += x of two vectors of n floats. */
+void vector_add(const float* x, float* y, int n);
+
+/**< Element-wise difference y -= x of two vectors of n floats. */
+void vector_sub(const float* x, float* y, int n);
+
+/**< Scaled sum y += a * x of two vectors of n floats. */
+void axpy(float a, const float* x, float* y, int n);
+
+/**< Symmetric int8 quantization q = x / scale of n floats, return scale. */
+float quantize_i8(const float* x, signed char* q, int n);
+
+/**< Dot product of two vectors of n int8 accumulated on int32. */
+int dot_product_i8(const signed char* a, const signed char* b, int n);
+
+/**< Weighted sums z = scale * (Wq xq) * x_scale + b of an int8 sinapsi. */
+void gemv_i8(const signed char* weights, const float* scale, const float* bias,
+            const signed char* x, float x_scale, float* z, int rows, int cols);
+
+/**< Weighted sums of an int8 sinapsi for a batch of n inputs. */
+void gemm_i8(const signed char* weights, const float* scale, const float* bias,
+                    const signed char* x, const float* x_scale, float* z, 
+                    int rows, int cols, int n);
+
+/**< Element-wise sum y += x of n int8 on n int32. */
+void vector_add_i8(const signed char* x, int* y, int n);
+
+/**< Element-wise difference y -= x of n int8 on n int32. */
+void vector_sub_i8(const signed char* x, int* y, int n);
+
+/**< Conversion of a float to an IEEE half-precision value. */
+unsigned short float_to_half(float f);
+
+/**< Conversion of an IEEE half-precision value to a float. */
+float half_to_float(unsigned short h);
+
+/**< Dot product of n fp16 weights with n floats accumulated on float. */
+float dot_product_f16(const unsigned short* a, const float* b, int n);
+
+/**< Weighted sums z = W x + b of a sinapsi with fp16 weights. */
+void gemv_f16(const unsigned short* weights, const float* bias, const float* x,
+                                            float* z, int rows, int cols);
+
+/**< Weighted sums of a sinapsi with fp16 weights for a batch of n inputs. */
+void gemm_f16(const unsigned short* weights, const float* bias, const float* x,
+                                        float* z, int rows, int cols, int n);
+
+/**< Element-wise sum y += x of n fp16 on n floats. */
+void vector_add_f16(const unsigned short* x, float* y, int n);
+
+/**< Element-wise difference y -= x of n fp16 on n floats. */
+void vector_sub_f16(const unsigned short* x, float* y, int n);
+
+/**< Weighted sums z = W x + b of a sinapsi stored in CSR format. */
+void spmv(const int* row_start, const short* index, const float* values,
+                    const float* bias, const float* x, float* z, int rows);
+
+/**< Weighted sums of a CSR sinapsi for a batch of n inputs. */
+void spmm(const int* row_start, const short* index, const float* values,
+        const float* bias, const float* x, float* z, int rows, int cols, 
+        int n);
+
+/**< Weighted sums of an int8 CSR sinapsi, same result of gemv_i8. */
+void spmv_i8(const int* row_start, const short* index, 
+            const signed char* values, const float* scale, const float* bias,
+            const signed char* x, float x_scale, float* z, int rows);
+
+/**< Weighted sums of an int8 CSR sinapsi for a batch of n inputs. */
+void spmm_i8(const int* row_start, const short* index, 
+            const signed char* values, const float* scale, const float* bias,
+            const signed char* x, const float* x_scale, float* z, 
+            int rows, int cols, int n);
+
+/**< Scaled sum y += a * x of n sparse floats, y[index[k]] += a * x[k]. */
+void sparse_axpy(float a, const short* index, const float* values, float* y,
+                                                                    int n);
+
+/**< Sum y[index[k]] += x[k] of n sparse int8 on int32. */
+void sparse_add_i8(const short* index, const signed char* values, int* y, 
+                                                                    int n);
+
+/**< Difference y[index[k]] -= x[k] of n sparse int8 on int32. */
+void sparse_sub_i8(const short* index, const signed char* values, int* y, 
+                                                                    int n);
+
+/**< Binary image dim x dim of the area averages of a square gray image. */
+void downsample_binarize(const unsigned char* src, int stride, int size,
+                        int dim, int threshold, unsigned char* dst,
+                        int dst_row, int dst_col);
+
+/**< Fast exponential y = exp(x) of n floats. */
+void vector_exp(const float* x, float* y, int n);
+
+/**< Fast logistic function y = 1 / (1 + exp(-z)) of n floats. */
+void vector_logistic(const float* z, float* y, int n);
+
+/**< Fast softmax function y = exp(z - max(z)) / sum of n floats. */
+void vector_softmax(const float* z, float* y, int n);
+
+/**< Scalar reference of dot_product. */
+float dot_product_ref(const float* a, const float* b, int n);
+
+/**< Scalar reference of gemv. */
+void gemv_ref(const float* weights, const float* bias, const float* x,
+                                            float* z, int rows, int cols);
+
+/**< Libm reference of vector_logistic. */
+void vector_logistic_ref(const float* z, float* y, int n);
+
+/**< Libm reference of vector_softmax. */
+void vector_softmax_ref(const float* z, float* y, int n);
+
+#endif
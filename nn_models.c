@@ -0,0 +1,2063 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#ifndef NN_NO_ALLEGRO
+#include <allegro.h>
+#endif
+#include <math.h>
+#include <pthread.h>
+
+#include "nn_handler.h"
+#include "nn_kernels.h"
+#include "nn_models.h"
+#include "nn_parse.h"
+#ifdef NN_EMBEDDED_WEIGHTS
+#include "nn_weights.h"
+#endif
+
+/**
+* @file nn_models.c
+* @author Gianluca D'Amico
+* @brief File containing the registry of the neural network models
+*
+* HANDLING MODEL REGISTRY: It manages all the functions needed to load the
+* model weights of the neural network and to keep them up to date.
+*
+* At the start of the application, 3 different predefined models will be 
+* loaded, one for the recognition of digits, one for the recognition of 
+* letters, one for the recognition of both. Each model corresponds to different
+* sinapsi weights trained offline and saved in a txt file, the models of
+* NN_MODEL_DIR are added to them. The weights of a model are written by the
+* thread which loads it and are read-only after its state is MODEL_READY, a
+* reload writes a fresh copy and swaps the pointer read by the inferences.
+*
+*/
+
+/**
+* LOCAL DATA
+*/
+
+#define HID_DIGITS   2              /**< Number of hidden layers of digits. */
+#define HID_LET_MIX  3              /**< Number of hidden layers of letters and 
+                                                                /**< mixed. */
+
+#define HEADER_LINE  256            /**< Max length of a header line. */
+
+#define WEIGHTS_PER_WORKER 131072   /**< Weights of a model which justify one
+                                        more worker for its forward pass. */
+
+#define SPARSE_MAX_WIDTH 32768      /**< Max length of a sparse row, its 
+                                        positions are stored on int16. */
+
+#define ERROR -1        /**< Error returning value. */
+#define SUCCESS 1       /**< Success returning value. */
+#define NO_HEADER 0     /**< File without model header returning value. */
+
+#define WATCH_PERIOD_MS 250     /**< Max delay of the stop of the watcher. */
+#define WATCH_BUFFER    4096    /**< Size of the buffer of inotify events. */
+
+#ifndef NN_EMBEDDED_WEIGHTS
+/**< Filename of the weights of the default models, without header. */
+static const char default_filenames[3][30] = { "digits_2_64_32.txt", 
+                    "letters_3_128_128_128.txt", "mixed_3_512_512_512.txt" };
+#endif
+
+/**< Model container, the registry of the loaded models: DIGITS, LETTERS and
+* MIXED first, then the other models of the model directory. */
+static model_t neural_network[NN_MAX_MODELS]; 
+
+/**< Number of models of the registry. */
+static int num_models;
+
+/**< Model loaded by init_networks, the others are loaded in background. */
+static network_target first_model;
+
+/**< Thread loading the other models and its state. */
+static pthread_t loader_tid;
+static int loader_running;
+static int loader_quit;
+
+/**< Signal of the models which finish loading. */
+static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t load_cond = PTHREAD_COND_INITIALIZER;
+
+/**< Weights used by the inference of each model, the registry ones until
+* reload_model replaces them. */
+static model_t* live_model[NN_MAX_MODELS];
+
+#ifndef NN_EMBEDDED_WEIGHTS
+/**< Reloads are done one at time. */
+static pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/**< Thread watching the model files, its inotify descriptor and its 
+* watches. */
+static pthread_t watcher_tid;
+static int watcher_running;
+static int watcher_quit;
+static int watch_fd = -1;
+static int watch_dir_wd = -1;
+
+/**< Functions of the forward pass, set by models_init. */
+static const model_hooks_t* hooks;
+
+/**< Precision requested for each model. */
+static nn_precision model_precision[NN_MAX_MODELS] = 
+                    { DIGITS_PRECISION, LETTERS_PRECISION, MIXED_PRECISION };
+
+/**< Name of each default model. */
+static const char model_names[3][8] = { "DIGITS", "LETTERS", "MIXED" };
+
+#ifndef NN_EMBEDDED_WEIGHTS
+/**< Name of each activation function in the model files. */
+static const char activation_names[2][9] = { "logistic", "relu" };
+#endif
+
+/**< Mapping between output neuron of the default models and character. */
+static const char digits_map[DIGIT_OUTPUT_SIZE] = 
+                        { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
+
+static const char letters_map[LETTER_OUTPUT_SIZE] = 
+                            { 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 
+                              'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 
+                              'U', 'V', 'W', 'X', 'Y', 'Z'};
+
+static const char mixed_map[MIXED_OUTPUT_SIZE] =  
+                        { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 
+                          'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 
+                          'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 
+                          'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'd', 'e', 
+                          'f', 'g', 'h', 'n', 'q', 'r', 't'};
+
+/**
+* LOCAL FUNCTIONS
+*/
+
+/**
+* @brief Initialization of all structs of digits model.
+*
+* This fuction assign every size to each struct of the digits model.
+*
+*/
+static void init_digits_net() {
+    neural_network[DIGITS].num_hidden   = HID_DIGITS;
+    neural_network[LETTERS].num_hidden  = HID_LET_MIX;
+    neural_network[MIXED].num_hidden    = HID_LET_MIX;
+
+    neural_network[DIGITS].in_S.card_in     = INPUT_SIZE;
+    neural_network[DIGITS].hid_S[0].card_in = DIGIT_HID_SIZE_1;
+    neural_network[DIGITS].out_S.card_in    = DIGIT_HID_SIZE_2;
+
+    neural_network[DIGITS].in_S.card_out        = DIGIT_HID_SIZE_1;
+    neural_network[DIGITS].hid_S[0].card_out    = DIGIT_HID_SIZE_2;
+    neural_network[DIGITS].out_S.card_out       = DIGIT_OUTPUT_SIZE;
+}
+
+/**
+* @brief Initialization of all structs of letters model.
+*
+* This fuction assign every size to each struct of the letters model.
+*
+*/
+static void init_letters_net() {
+    neural_network[LETTERS].in_S.card_in     = INPUT_SIZE;
+    neural_network[LETTERS].hid_S[0].card_in = LET_HID_SIZE;
+    neural_network[LETTERS].hid_S[1].card_in = LET_HID_SIZE;
+    neural_network[LETTERS].out_S.card_in    = LET_HID_SIZE;
+
+    neural_network[LETTERS].in_S.card_out        = LET_HID_SIZE;
+    neural_network[LETTERS].hid_S[0].card_out    = LET_HID_SIZE;
+    neural_network[LETTERS].hid_S[1].card_out    = LET_HID_SIZE;
+    neural_network[LETTERS].out_S.card_out       = LETTER_OUTPUT_SIZE;
+}
+
+/**
+* @brief Initialization of all structs of mixed model.
+*
+* This fuction assign every size to each struct of the mixed model.
+*
+*/
+static void init_mixed_net() {
+    neural_network[MIXED].in_S.card_in     = INPUT_SIZE;
+    neural_network[MIXED].hid_S[0].card_in = MIX_HID_SIZE;
+    neural_network[MIXED].hid_S[1].card_in = MIX_HID_SIZE;
+    neural_network[MIXED].out_S.card_in    = MIX_HID_SIZE;
+
+    neural_network[MIXED].in_S.card_out        = MIX_HID_SIZE;
+    neural_network[MIXED].hid_S[0].card_out    = MIX_HID_SIZE;
+    neural_network[MIXED].hid_S[1].card_out    = MIX_HID_SIZE;
+    neural_network[MIXED].out_S.card_out       = MIXED_OUTPUT_SIZE;
+}
+
+/**
+* @brief Initialization of a default model.
+*
+* It assigns the sizes, the name, the labels and the activation function of 
+* one of the 3 default models.
+*
+* @param  target specificy the model {DIGITS, LETTERS, MIXED}
+*/
+static void init_default_model(network_target target) {
+
+    model_t* model = &neural_network[target];
+
+    switch (target) {
+        case DIGITS:
+            init_digits_net();
+            memcpy(model->labels, digits_map, DIGIT_OUTPUT_SIZE);
+            break;
+        case LETTERS:
+            init_letters_net();
+            memcpy(model->labels, letters_map, LETTER_OUTPUT_SIZE);
+            break;
+        default:
+            init_mixed_net();
+            memcpy(model->labels, mixed_map, MIXED_OUTPUT_SIZE);
+            break;
+    }
+
+    strcpy(model->name, model_names[target]);
+    model->activation = ACT_LOGISTIC;
+}
+
+/**
+* @brief Size in bytes of the arena needed by the weights of a model.
+*
+* Each array of the sinapsi is sized on the real cardinalities of the model
+* and it starts at the beginning of a cache line.
+*
+* @param  model is the model whose cardinalities are already set
+* @return the size of the arena
+*/
+static size_t model_arena_size(const model_t* model) {
+
+    size_t size = 0;
+
+#ifndef NN_EMBEDDED_WEIGHTS
+    int k;
+
+    size += align_size(model->in_S.card_out * model->in_S.card_in * 
+                                                                sizeof(float));
+    size += align_size(model->in_S.card_out * sizeof(float));
+
+    for (k = 0; k < model->num_hidden-1; ++k) {
+        size += align_size(model->hid_S[k].card_out * model->hid_S[k].card_in *
+                                                                sizeof(float));
+        size += align_size(model->hid_S[k].card_out * sizeof(float));
+    }
+
+    size += align_size(model->out_S.card_out * model->out_S.card_in * 
+                                                                sizeof(float));
+    size += align_size(model->out_S.card_out * sizeof(float));
+#else
+    (void) model;
+#endif
+
+    return size;
+}
+
+/**
+* @brief Number of workers sharing the forward pass of a model.
+*
+* One worker is used for each WEIGHTS_PER_WORKER weights of the model, so 
+* that the small models run on the caller alone and do not pay the 
+* synchronization of the workers.
+*
+* @param  model is the model whose cardinalities are already set
+* @param  available is the number of workers of the pool
+* @return the number of workers of the model
+*/
+static int model_workers(const model_t* model, int available) {
+
+    int k;
+    int workers;
+    long weights = (long) model->in_S.card_out * model->in_S.card_in;
+
+    for (k = 0; k < model->num_hidden-1; ++k)
+        weights += (long) model->hid_S[k].card_out * model->hid_S[k].card_in;
+    weights += (long) model->out_S.card_out * model->out_S.card_in;
+
+    workers = weights / WEIGHTS_PER_WORKER;
+
+    if (workers > available)
+        workers = available;
+    if (workers < 1)
+        workers = 1;
+
+    return workers;
+}
+
+/**
+* @brief Allocate the arena of the weights of a model.
+*
+* A single cache-line-aligned block is allocated for the whole model, then
+* the weights and the bias are placed in it one after the other, with the 
+* rows of each sinapsi stored back to back.
+*
+* @param  model is the model to be allocated
+* @return an int to notify if the allocation is done correctly or not
+*/
+static int alloc_model(model_t* model) {
+
+    model->arena_size = model_arena_size(model);
+    if (model->arena_size == 0)
+        return SUCCESS;
+
+    if (posix_memalign((void**) &model->arena, CACHE_LINE, model->arena_size))
+        return ERROR;
+
+    memset(model->arena, 0, model->arena_size);
+
+    /**< The embedded weights are set by embed_network. */
+#ifndef NN_EMBEDDED_WEIGHTS
+    {
+        int k;
+        size_t offset = 0;      /**< First free byte of the arena. */
+
+        model->in_S.weights = arena_take(model->arena, &offset, 
+                                    model->in_S.card_out * model->in_S.card_in);
+        model->in_S.bias = arena_take(model->arena, &offset, 
+                                                        model->in_S.card_out);
+
+        for (k = 0; k < model->num_hidden-1; ++k) {
+            model->hid_S[k].weights = arena_take(model->arena, &offset, 
+                            model->hid_S[k].card_out * model->hid_S[k].card_in);
+            model->hid_S[k].bias = arena_take(model->arena, &offset, 
+                                                    model->hid_S[k].card_out);
+        }
+
+        model->out_S.weights = arena_take(model->arena, &offset, 
+                                model->out_S.card_out * model->out_S.card_in);
+        model->out_S.bias = arena_take(model->arena, &offset, 
+                                                        model->out_S.card_out);
+    }
+#endif
+
+    return SUCCESS;
+}
+
+/**
+* @brief Symmetric int8 quantization of a sinapsi.
+*
+* Each row of weights (all the weights to the same outgoing neuron) has its 
+* own scale, which maps the largest absolute weight of the row to 127.
+*
+* @param  sinapsi is the sinapsi whose float weights are already loaded
+* @param  by_columns is 1 if the weights are stored by columns
+*/
+static void quantize_sinapsi(sinapsi_t* sinapsi, int by_columns) {
+
+    int i, j, index;
+    float max, inv_scale;
+
+    for (i = 0; i < sinapsi->card_out; ++i) {
+
+        max = 0;
+        for (j = 0; j < sinapsi->card_in; ++j) {
+            index = by_columns ? j * sinapsi->card_out + i : 
+                                                    i * sinapsi->card_in + j;
+            if (fabsf(sinapsi->weights[index]) > max)
+                max = fabsf(sinapsi->weights[index]);
+        }
+
+        sinapsi->q_scale[i] = (max > 0) ? max / 127 : 1;
+        inv_scale = 1 / sinapsi->q_scale[i];
+
+        for (j = 0; j < sinapsi->card_in; ++j) {
+            index = by_columns ? j * sinapsi->card_out + i : 
+                                                    i * sinapsi->card_in + j;
+            sinapsi->q_weights[index] = 
+                            (signed char) lrintf(sinapsi->weights[index] * 
+                                                                    inv_scale);
+        }
+    }
+}
+
+/**
+* @brief List the sinapsi of a model in the order of the forward pass.
+*
+* @param  model is the model
+* @param  sinapsi are the pointers to the sinapsi, MAX_HID_NUM + 1 at most
+* @return the number of sinapsi
+*/
+static int model_sinapsi(model_t* model, sinapsi_t** sinapsi) {
+
+    int k;
+    int num_sinapsi = model->num_hidden + 1;
+
+    sinapsi[0] = &model->in_S;
+    for (k = 0; k < model->num_hidden-1; ++k)
+        sinapsi[k+1] = &model->hid_S[k];
+    sinapsi[num_sinapsi-1] = &model->out_S;
+
+    return num_sinapsi;
+}
+
+/**
+* @brief Allocate and fill the int8 or fp16 weights of a model.
+*
+* The int8 weights and their scales, or the fp16 weights, are placed in a 
+* second cache-line-aligned arena of the model, the float weights remain the
+* reference of the model.
+*
+* @param  model is the model to be quantized
+* @param  precision is the precision of the weights {NN_INT8, NN_FP16}
+* @return an int to notify if the quantization is done correctly or not
+*/
+static int quantize_model(model_t* model, nn_precision precision) {
+
+    int i, k;
+    size_t offset = 0;      /**< First free byte of the reduced arena. */
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    int num_sinapsi = model_sinapsi(model, sinapsi);
+    int size;
+
+    model->q_arena_size = 0;
+    for (k = 0; k < num_sinapsi; ++k) {
+        size = sinapsi[k]->card_out * sinapsi[k]->card_in;
+        if (precision == NN_FP16) {
+            model->q_arena_size += align_size(size * sizeof(unsigned short));
+        }
+        else {
+            model->q_arena_size += align_size(size);
+            model->q_arena_size += align_size(sinapsi[k]->card_out * 
+                                                                sizeof(float));
+        }
+    }
+
+    if (posix_memalign((void**) &model->q_arena, CACHE_LINE, 
+                                                        model->q_arena_size))
+        return ERROR;
+
+    for (k = 0; k < num_sinapsi; ++k) {
+        size = sinapsi[k]->card_out * sinapsi[k]->card_in;
+
+        if (precision == NN_FP16) {
+            sinapsi[k]->h_weights = (unsigned short*) arena_take_bytes(
+                    model->q_arena, &offset, size * sizeof(unsigned short));
+
+            for (i = 0; i < size; ++i)
+                sinapsi[k]->h_weights[i] = 
+                                        float_to_half(sinapsi[k]->weights[i]);
+        }
+        else {
+            sinapsi[k]->q_weights = (signed char*) arena_take_bytes(
+                                            model->q_arena, &offset, size);
+            sinapsi[k]->q_scale = (float*) arena_take_bytes(model->q_arena, 
+                            &offset, sinapsi[k]->card_out * sizeof(float));
+
+            quantize_sinapsi(sinapsi[k], k == 0);
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+* @brief Check if a weight of a sinapsi is not zero in a precision.
+*
+* A small float weight can be 0 in int8 or in fp16, then it is not stored
+* by the sparse sinapsi of that precision.
+*
+* @param  sinapsi is the sinapsi, quantized if the precision requires it
+* @param  precision is the precision of the model
+* @param  index is the position of the weight in the dense layout
+* @return 1 if the weight is not zero, 0 otherwise
+*/
+static int nonzero_weight(const sinapsi_t* sinapsi, nn_precision precision,
+                                                                int index) {
+    switch (precision) {
+        case NN_INT8:
+            return sinapsi->q_weights[index] != 0;
+        case NN_FP16:
+            return (sinapsi->h_weights[index] & 0x7fff) != 0;
+        default:
+            return sinapsi->weights[index] != 0;
+    }
+}
+
+/**
+* @brief Count the non-zero weights of a sinapsi.
+*
+* @param  sinapsi is the sinapsi, quantized if the precision requires it
+* @param  precision is the precision of the model
+* @return the number of non-zero weights
+*/
+static long count_nonzero(const sinapsi_t* sinapsi, nn_precision precision) {
+
+    int i;
+    long count = 0;
+    int size = sinapsi->card_out * sinapsi->card_in;
+
+    for (i = 0; i < size; ++i)
+        count += nonzero_weight(sinapsi, precision, i);
+
+    return count;
+}
+
+/**
+* @brief Fill the CSR arrays of a sparse sinapsi from its dense weights.
+*
+* The rows are the stored ones: the outgoing neurons, or the input pixels 
+* for the input sinapsi which is stored by columns. The int8 values keep the
+* scale of their row, the fp16 ones are widened to float.
+*
+* @param  sinapsi is the sinapsi whose CSR arrays are already allocated
+* @param  precision is the precision of the model
+* @param  by_columns is 1 if the weights are stored by columns
+*/
+static void fill_sparse_sinapsi(sinapsi_t* sinapsi, nn_precision precision,
+                                                            int by_columns) {
+    int r, c, index;
+    int k = 0;
+    int rows = by_columns ? sinapsi->card_in : sinapsi->card_out;
+    int width = by_columns ? sinapsi->card_out : sinapsi->card_in;
+
+    for (r = 0; r < rows; ++r) {
+        sinapsi->row_start[r] = k;
+
+        for (c = 0; c < width; ++c) {
+            index = r * width + c;
+            if (!nonzero_weight(sinapsi, precision, index))
+                continue;
+
+            sinapsi->col_index[k] = (short) c;
+            if (precision == NN_INT8)
+                sinapsi->sq_weights[k] = sinapsi->q_weights[index];
+            else if (precision == NN_FP16)
+                sinapsi->s_weights[k] = 
+                                    half_to_float(sinapsi->h_weights[index]);
+            else
+                sinapsi->s_weights[k] = sinapsi->weights[index];
+            ++k;
+        }
+    }
+
+    sinapsi->row_start[rows] = k;
+}
+
+/**
+* @brief Store in CSR format the sinapsi of a model with few non-zero 
+* weights.
+*
+* A sinapsi becomes sparse when at most NN_SPARSE_DENSITY of its weights are
+* not zero in the precision of the model and its rows are short enough for
+* the int16 positions. The CSR arrays of all the sparse sinapsi are placed in
+* a third cache-line-aligned arena of the model.
+*
+* @param  model is the model, already quantized
+* @return an int to notify if the allocation is done correctly or not
+*/
+static int sparsify_model(model_t* model) {
+
+    int k;
+    size_t offset = 0;      /**< First free byte of the sparse arena. */
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    int num_sinapsi = model_sinapsi(model, sinapsi);
+    long nonzero[MAX_HID_NUM+1];
+    int rows[MAX_HID_NUM+1];
+    size_t value_size = (model->precision == NN_INT8) ? 1 : sizeof(float);
+    long size;
+
+    model->s_arena_size = 0;
+    for (k = 0; k < num_sinapsi; ++k) {
+        size = (long) sinapsi[k]->card_out * sinapsi[k]->card_in;
+        nonzero[k] = count_nonzero(sinapsi[k], model->precision);
+        rows[k] = (k == 0) ? sinapsi[k]->card_in : sinapsi[k]->card_out;
+
+        if (nonzero[k] > NN_SPARSE_DENSITY * size ||
+                                size / rows[k] > SPARSE_MAX_WIDTH) {
+            nonzero[k] = -1;
+            continue;
+        }
+
+        model->s_arena_size += align_size((rows[k] + 1) * sizeof(int));
+        model->s_arena_size += align_size(nonzero[k] * sizeof(short));
+        model->s_arena_size += align_size(nonzero[k] * value_size);
+    }
+
+    if (model->s_arena_size == 0)
+        return SUCCESS;
+
+    if (posix_memalign((void**) &model->s_arena, CACHE_LINE, 
+                                                        model->s_arena_size))
+        return ERROR;
+
+    for (k = 0; k < num_sinapsi; ++k) {
+        if (nonzero[k] < 0)
+            continue;
+
+        sinapsi[k]->row_start = (int*) arena_take_bytes(model->s_arena, 
+                                &offset, (rows[k] + 1) * sizeof(int));
+        sinapsi[k]->col_index = (short*) arena_take_bytes(model->s_arena, 
+                                &offset, nonzero[k] * sizeof(short));
+        if (model->precision == NN_INT8)
+            sinapsi[k]->sq_weights = (signed char*) arena_take_bytes(
+                                    model->s_arena, &offset, nonzero[k]);
+        else
+            sinapsi[k]->s_weights = arena_take(model->s_arena, &offset, 
+                                                                nonzero[k]);
+
+        fill_sparse_sinapsi(sinapsi[k], model->precision, k == 0);
+    }
+
+    return SUCCESS;
+}
+
+/**
+* @brief Pack in panels the dense hidden sinapsi of a float model.
+*
+* The weights between two hidden layers are read row by row against the
+* same activation vector, in panels of NN_PANEL_ROWS rows each pass on the
+* vector computes as many outputs. A hidden sinapsi is packed when its 
+* sizes are multiples of the panels, the packed weights are placed in a 
+* fourth cache-line-aligned arena of the model. The panels are internal to
+* the forward pass, the model files keep the dense layout.
+*
+* @param  model is the model, already sparsified
+* @return an int to notify if the allocation is done correctly or not
+*/
+static int pack_model(model_t* model) {
+
+    int k;
+    size_t offset = 0;      /**< First free byte of the packed arena. */
+    int packed[MAX_HID_NUM-1];
+    sinapsi_t* s;
+
+    if (model->precision != NN_FP32)
+        return SUCCESS;
+
+    model->p_arena_size = 0;
+    for (k = 0; k < model->num_hidden-1; ++k) {
+        s = &model->hid_S[k];
+        packed[k] = s->row_start == NULL && 
+                    s->card_out % NN_PANEL_ROWS == 0 &&
+                    s->card_in % NN_PANEL_COLS == 0;
+
+        if (packed[k])
+            model->p_arena_size += align_size((size_t) s->card_out * 
+                                                s->card_in * sizeof(float));
+    }
+
+    if (model->p_arena_size == 0)
+        return SUCCESS;
+
+    if (posix_memalign((void**) &model->p_arena, CACHE_LINE, 
+                                                        model->p_arena_size))
+        return ERROR;
+
+    for (k = 0; k < model->num_hidden-1; ++k) {
+        if (!packed[k])
+            continue;
+
+        s = &model->hid_S[k];
+        s->p_weights = arena_take(model->p_arena, &offset, 
+                                                    s->card_out * s->card_in);
+        pack_panels(s->weights, s->p_weights, s->card_out, s->card_in);
+    }
+
+    return SUCCESS;
+}
+
+/**
+* @brief Move the arrays still used by a model into a smaller arena.
+*
+* The arrays are copied one after the other into a new cache-line-aligned
+* arena, the old one is released.
+*
+* @param  arena is the arena to be replaced
+* @param  arena_size is the size in bytes of the arena
+* @param  array are the pointers to the arrays, they are moved
+* @param  size is the size in bytes of each array
+* @param  n is the number of arrays
+* @return an int to notify if the allocation is done correctly or not
+*/
+static int compact_arena(char** arena, size_t* arena_size, void** array[], 
+                                                const size_t* size, int n) {
+    int k;
+    size_t offset = 0;      /**< First free byte of the new arena. */
+    char* compact;
+
+    *arena_size = 0;
+    for (k = 0; k < n; ++k)
+        *arena_size += align_size(size[k]);
+
+    if (posix_memalign((void**) &compact, CACHE_LINE, *arena_size))
+        return ERROR;
+
+    for (k = 0; k < n; ++k) {
+        memcpy(compact + offset, *array[k], size[k]);
+        *array[k] = arena_take_bytes(compact, &offset, size[k]);
+    }
+
+    free(*arena);
+    *arena = compact;
+
+    return SUCCESS;
+}
+
+/**
+* @brief Release the dense weights of the sparse and the packed sinapsi of
+* a model.
+*
+* The bias, the int8 scales and the dense weights of the other sinapsi are
+* moved into smaller arenas. The embedded weights are not in an arena, they
+* stay in the executable.
+*
+* @param  model is the model, already sparsified and packed
+* @return an int to notify if the allocation is done correctly or not
+*/
+static int compact_model(model_t* model) {
+
+    int k;
+    int n = 0, q_n = 0;     /**< Arrays of the arena and of the int8 or 
+                                                            fp16 arena. */
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    int num_sinapsi = model_sinapsi(model, sinapsi);
+    void** array[2 * (MAX_HID_NUM+1)];
+    void** q_array[2 * (MAX_HID_NUM+1)];
+    size_t size[2 * (MAX_HID_NUM+1)];
+    size_t q_size[2 * (MAX_HID_NUM+1)];
+    size_t count;
+
+    if (model->s_arena == NULL && model->p_arena == NULL)
+        return SUCCESS;
+
+    for (k = 0; k < num_sinapsi; ++k) {
+        count = (size_t) sinapsi[k]->card_out * sinapsi[k]->card_in;
+
+        if (sinapsi[k]->row_start == NULL && sinapsi[k]->p_weights == NULL) {
+            array[n] = (void**) &sinapsi[k]->weights;
+            size[n++] = count * sizeof(float);
+
+            if (model->precision == NN_INT8) {
+                q_array[q_n] = (void**) &sinapsi[k]->q_weights;
+                q_size[q_n++] = count;
+            }
+            else if (model->precision == NN_FP16) {
+                q_array[q_n] = (void**) &sinapsi[k]->h_weights;
+                q_size[q_n++] = count * sizeof(unsigned short);
+            }
+        }
+        else {
+            sinapsi[k]->weights = NULL;
+            sinapsi[k]->q_weights = NULL;
+            sinapsi[k]->h_weights = NULL;
+        }
+
+        array[n] = (void**) &sinapsi[k]->bias;
+        size[n++] = sinapsi[k]->card_out * sizeof(float);
+
+        if (model->precision == NN_INT8) {
+            q_array[q_n] = (void**) &sinapsi[k]->q_scale;
+            q_size[q_n++] = sinapsi[k]->card_out * sizeof(float);
+        }
+    }
+
+    if (model->arena != NULL && 
+            compact_arena(&model->arena, &model->arena_size, array, size, n)
+                                                                    == ERROR)
+        return ERROR;
+
+    if (model->q_arena != NULL && compact_arena(&model->q_arena, 
+                        &model->q_arena_size, q_array, q_size, q_n) == ERROR)
+        return ERROR;
+
+    return SUCCESS;
+}
+
+#ifndef NN_EMBEDDED_WEIGHTS
+/**
+* @brief Magnitude pruning of the weights of a model.
+*
+* The float weights smaller than NN_PRUNE_THRESHOLD in absolute value are 
+* set to zero, before the quantization.
+*
+* @param  model is the model whose float weights are loaded
+*/
+static void prune_model(model_t* model) {
+
+    int i, k, size;
+    long pruned = 0, total = 0;
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    int num_sinapsi = model_sinapsi(model, sinapsi);
+
+    if (NN_PRUNE_THRESHOLD <= 0)
+        return;
+
+    for (k = 0; k < num_sinapsi; ++k) {
+        size = sinapsi[k]->card_out * sinapsi[k]->card_in;
+        total += size;
+
+        for (i = 0; i < size; ++i) {
+            if (sinapsi[k]->weights[i] != 0 && 
+                        fabsf(sinapsi[k]->weights[i]) < NN_PRUNE_THRESHOLD) {
+                sinapsi[k]->weights[i] = 0;
+                ++pruned;
+            }
+        }
+    }
+
+    printf("%s model: %.1f%% of the weights pruned\n", model->name, 
+                                                    100.0 * pruned / total);
+}
+#endif
+
+#ifndef NN_EMBEDDED_WEIGHTS
+/**
+* @brief Loading of weights and bias of input sinapsi.
+*
+* The file from which the weigths are loaded must have a specific pattern.
+* Each weights to the same outgoing neuron are separeted by a '_' .After them 
+* ther is the value of the bias between two '\n', then other weights follow in 
+* the same pattern. At the end of the file there is the accurancy of the model
+* and the relative accurancy for each symbol. The values are read by 
+* read_weight (see nn_parse.h). If the pattern is not followed, the function
+* return an ERROR code.
+*
+* @param  fp is the file descriptor whic contain the weights
+* @param  model is the model whose weights are loaded
+* @return an int to notify if the loading is done correctly or not
+*/
+static int load_input_sinapsi(FILE* fp, model_t* model) {
+
+    int i, j;
+
+    for (i = 0; i < model->in_S.card_out; ++i) {
+
+        for (j = 0; j < model->in_S.card_in; ++j)
+            if (read_weight(fp, &model->in_S.weights[j * 
+                                        model->in_S.card_out + i]))
+                return ERROR;
+
+        if (read_weight(fp, &model->in_S.bias[i]))
+            return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/**
+* @brief Loading of weights and bias of hiddens sinapsi.
+*
+* The file from which the weigths are loaded must have a specific pattern.
+* Each weights to the same outgoing neuron are separeted by a '_' .After them 
+* ther is the value of the bias between two '\n', then other weights follow in 
+* the same pattern. At the end of the file there is the accurancy of the model
+* and the relative accurancy for each symbol. The values are read by 
+* read_weight (see nn_parse.h). If the pattern is not followed, the function
+* return an ERROR code.
+*
+* @param  fp is the file descriptor whic contain the weights
+* @param  model is the model whose weights are loaded
+* @return an int to notify if the loading is done correctly or not
+*/
+static int load_hidden_sinapsi(FILE* fp, model_t* model) {
+
+    int i, j, k;
+
+    for (k = 0; k < model->num_hidden-1; ++k) {
+
+        for (i = 0; i < model->hid_S[k].card_out; ++i) {
+
+            for (j = 0; j < model->hid_S[k].card_in; ++j)
+                if (read_weight(fp, &model->hid_S[k].weights[i * 
+                                            model->hid_S[k].card_in + j]))
+                    return ERROR;
+
+            if (read_weight(fp, &model->hid_S[k].bias[i]))
+                return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+/**
+* @brief Loading of weights and bias of output sinapsi.
+*
+* The file from which the weigths are loaded must have a specific pattern.
+* Each weights to the same outgoing neuron are separeted by a '_' .After them 
+* ther is the value of the bias between two '\n', then other weights follow in 
+* the same pattern. At the end of the file there is the accurancy of the model
+* and the relative accurancy for each symbol. The values are read by 
+* read_weight (see nn_parse.h). If the pattern is not followed, the function
+* return an ERROR code.
+*
+* @param  fp is the file descriptor whic contain the weights
+* @param  model is the model whose weights are loaded
+* @return an int to notify if the loading is done correctly or not
+*/
+static int load_out_sinapsi(FILE* fp, model_t* model) {
+
+    int i, j;
+
+    for (i = 0; i < model->out_S.card_out; ++i) {
+
+        for (j = 0; j < model->out_S.card_in; ++j)
+            if (read_weight(fp, &model->out_S.weights[i * 
+                                                model->out_S.card_in + j]))
+                return ERROR;
+
+        if (read_weight(fp, &model->out_S.bias[i]))
+            return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+/**
+* @brief Loading of weights and bias of all the sinapsi of a model.
+*
+* @param  fp is the file descriptor positioned on the first weight
+* @param  model is the model whose weights are loaded
+* @return an int to notify if the loading is done correctly or not
+*/
+static int load_model_file(FILE* fp, model_t* model) {
+
+    if (load_input_sinapsi(fp, model) == ERROR ||
+                load_hidden_sinapsi(fp, model) == ERROR ||
+                load_out_sinapsi(fp, model) == ERROR)
+        return ERROR;
+
+    return SUCCESS;
+}
+
+/**
+* @brief Reading of the header of a model file.
+*
+* The header starts with a "nn_model" line and ends with an "end" line, each
+* line between them is a key followed by its value (see nn_handler.h). The
+* sizes of the layers, the name, the labels and the activation function are
+* written in the model. After the header the file is positioned on the first
+* weight.
+*
+* @param  fp is the file descriptor of the model file
+* @param  model is the model described by the header
+* @return NO_HEADER if the file does not start with a header, ERROR if the 
+*         header is not valid, SUCCESS otherwise
+*/
+static int read_model_header(FILE* fp, model_t* model) {
+
+    int k, offset, count;
+    int num_layers = 0;             /**< Layers, input and output included. */
+    int num_labels = 0;
+    int size[MAX_HID_NUM+2];        /**< Neurons of each layer. */
+    char line[HEADER_LINE];         /**< Line of the header. */
+    char key[HEADER_LINE];          /**< Key of the line. */
+    char* value;                    /**< Value of the key. */
+
+    if (fgets(line, HEADER_LINE, fp) == NULL)
+        return NO_HEADER;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, "nn_model") != 0)
+        return NO_HEADER;
+
+    model->name[0] = '\0';
+    model->activation = ACT_LOGISTIC;
+
+    while (1) {
+        if (fgets(line, HEADER_LINE, fp) == NULL)
+            return ERROR;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (sscanf(line, "%s %n", key, &offset) != 1)
+            continue;
+        value = line + offset;
+
+        if (strcmp(key, "end") == 0)
+            break;
+
+        if (strcmp(key, "name") == 0) {
+            if (strlen(value) == 0 || strlen(value) >= MODEL_NAME_SIZE)
+                return ERROR;
+            strcpy(model->name, value);
+        }
+        else if (strcmp(key, "layers") == 0) {
+            if (sscanf(value, "%d%n", &num_layers, &offset) != 1 ||
+                        num_layers < 3 || num_layers > MAX_HID_NUM + 2)
+                return ERROR;
+
+            for (k = 0; k < num_layers; ++k) {
+                value += offset;
+                if (sscanf(value, "%d%n", &size[k], &offset) != 1 ||
+                                                                size[k] <= 0)
+                    return ERROR;
+            }
+        }
+        else if (strcmp(key, "activation") == 0) {
+            for (k = ACT_LOGISTIC; k <= ACT_RELU; ++k)
+                if (strcmp(value, activation_names[k]) == 0)
+                    break;
+            if (k > ACT_RELU)
+                return ERROR;
+            model->activation = k;
+        }
+        else if (strcmp(key, "labels") == 0) {
+            num_labels = strlen(value);
+            if (num_labels > NN_MAX_OUTPUTS)
+                return ERROR;
+            memcpy(model->labels, value, num_labels);
+        }
+        else {
+            return ERROR;
+        }
+    }
+
+    /**< The input is the image and each output neuron has a character. */
+    if (model->name[0] == '\0' || num_layers == 0 || 
+            size[0] != INPUT_SIZE || size[num_layers-1] != num_labels)
+        return ERROR;
+
+    count = num_layers - 2;
+    model->num_hidden = count;
+
+    model->in_S.card_in = size[0];
+    model->in_S.card_out = size[1];
+
+    for (k = 0; k < count - 1; ++k) {
+        model->hid_S[k].card_in = size[k+1];
+        model->hid_S[k].card_out = size[k+2];
+    }
+
+    model->out_S.card_in = size[count];
+    model->out_S.card_out = size[count+1];
+
+    return SUCCESS;
+}
+
+/**
+* @brief Registry slot of a model found in the model directory.
+*
+* A model named as a default one replaces it, any other model is appended 
+* to the registry.
+*
+* @param  name is the name of the model
+* @return the index of the slot, -1 if the name is already used or the
+*         registry is full
+*/
+static int registry_slot(const char* name) {
+
+    int i;
+
+    for (i = DIGITS; i <= MIXED; ++i)
+        if (strcasecmp(name, model_names[i]) == 0)
+            return neural_network[i].registered ? -1 : i;
+
+    for (i = MIXED + 1; i < num_models; ++i)
+        if (strcasecmp(name, neural_network[i].name) == 0)
+            return -1;
+
+    if (num_models == NN_MAX_MODELS)
+        return -1;
+
+    return num_models;
+}
+
+/**
+* @brief Registration of the models of a directory.
+*
+* Each file starting with a model header is added to the registry, the other
+* files are ignored. Only the headers are read, the weights are loaded later
+* by load_model. A missing directory is not an error.
+*
+* @param  dir_name is the path of the directory
+* @return NN_SUCCESS or the error code of init_networks
+*/
+static int register_model_dir(const char* dir_name) {
+
+    int target, result;
+    char path[MODEL_FILE_SIZE]; /**< Path of a file of the directory. */
+    model_t header;             /**< Model described by the header. */
+    struct dirent* entry;
+    DIR* dir;
+    FILE* fp;
+
+    dir = opendir(dir_name);
+    if (dir == NULL)
+        return NN_SUCCESS;
+
+    while ((entry = readdir(dir)) != NULL) {
+
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (snprintf(path, MODEL_FILE_SIZE, "%s/%s", dir_name, 
+                                        entry->d_name) >= MODEL_FILE_SIZE)
+            continue;
+
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+
+        memset(&header, 0, sizeof(model_t));
+        result = read_model_header(fp, &header);
+        header.offset = ftell(fp);
+        fclose(fp);
+
+        if (result == NO_HEADER)
+            continue;
+
+        if (result == ERROR) {
+            closedir(dir);
+            return NN_ERROR_READING_FILE;
+        }
+
+        target = registry_slot(header.name);
+        if (target < 0) {
+            printf("Model %s of %s ignored\n", header.name, path);
+            continue;
+        }
+
+        strcpy(header.file, path);
+        header.registered = 1;
+        neural_network[target] = header;
+
+        if (target == num_models)
+            ++num_models;
+    }
+
+    closedir(dir);
+
+    return NN_SUCCESS;
+}
+
+/**
+* @brief Registration of a default model with its legacy file.
+*
+* If NN_SYNTHETIC_WEIGHTS is defined a missing file is not an error, the
+* model is registered without file.
+*
+* @param  target specificy the model {DIGITS, LETTERS, MIXED}
+* @return NN_SUCCESS or NN_ERROR_NO_FILE if the file is missing
+*/
+static int register_default_model(network_target target) {
+
+    FILE *fp;
+
+    fp = fopen(default_filenames[target], "r");
+    if (fp == NULL) {
+#ifdef NN_SYNTHETIC_WEIGHTS
+        /**< The model without file gets the weights of synthetic_weights. */
+        neural_network[target].file[0] = '\0';
+        neural_network[target].registered = 1;
+        return NN_SUCCESS;
+#else
+        return NN_ERROR_NO_FILE;
+#endif
+    }
+    fclose(fp);
+
+    strcpy(neural_network[target].file, default_filenames[target]);
+    neural_network[target].offset = 0;
+    neural_network[target].registered = 1;
+
+    return NN_SUCCESS;
+}
+
+#ifdef NN_SYNTHETIC_WEIGHTS
+/**
+* @brief Fill a model with repeatable random weights.
+*
+* The weights of each sinapsi are uniform in +-1 / sqrt(card_in), so the 
+* weighted sums stay in the range of the trained models. They are used by
+* the benchmark when the file of a default model is missing.
+*
+* @param  model is the model, its arena is allocated
+*/
+static void synthetic_weights(model_t* model) {
+
+    int i, k;
+    unsigned int seed = 1;          /**< Fixed seed, repeatable weights. */
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    int num_sinapsi = model_sinapsi(model, sinapsi);
+    long size;
+    float range;
+
+    for (k = 0; k < num_sinapsi; ++k) {
+        size = (long) sinapsi[k]->card_out * sinapsi[k]->card_in;
+        range = 2 / sqrtf(sinapsi[k]->card_in);
+
+        for (i = 0; i < size; ++i)
+            sinapsi[k]->weights[i] = range * 
+                                    ((float) rand_r(&seed) / RAND_MAX - 0.5f);
+
+        for (i = 0; i < sinapsi[k]->card_out; ++i)
+            sinapsi[k]->bias[i] = 0.1f * 
+                                    ((float) rand_r(&seed) / RAND_MAX - 0.5f);
+    }
+}
+#endif
+
+/**
+* @brief Loading of the weights of a registered model.
+*
+* @param  target is the index of the model in the registry
+* @return NN_SUCCESS or the error code of init_networks
+*/
+static int load_weights(network_target target) {
+
+    FILE *fp;
+    int result;
+    model_t* model = &neural_network[target];
+
+#ifdef NN_SYNTHETIC_WEIGHTS
+    if (model->file[0] == '\0') {
+        if (alloc_model(model) == ERROR)
+            return NN_ERROR_NO_MEMORY;
+
+        synthetic_weights(model);
+        printf("%s model: synthetic weights\n", model->name);
+        return NN_SUCCESS;
+    }
+#endif
+
+    fp = fopen(model->file, "r");
+    if (fp == NULL)
+        return NN_ERROR_NO_FILE;
+
+    if (fseek(fp, model->offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return NN_ERROR_READING_FILE;
+    }
+
+    if (alloc_model(model) == ERROR) {
+        fclose(fp);
+        return NN_ERROR_NO_MEMORY;
+    }
+
+    result = load_model_file(fp, model);
+    fclose(fp);
+
+    if (result == ERROR)
+        return NN_ERROR_READING_FILE;
+
+    return NN_SUCCESS;
+}
+#else
+/**
+* @brief Use the weights and bias linked into the executable.
+*
+* The sinapsi of the model point to the read-only arrays generated by
+* weights_to_c, which already have the layout of the arena. The sizes of the
+* generated model must match the structure of the target one, otherwise the
+* function return an ERROR code.
+*
+* @param  target specificy which model must be set {DIGITS, LETTERS, MIXED}
+* @param  embedded is the generated model
+* @return an int to notify if the model matches the target or not
+*/
+static int embed_network(network_target target, 
+                                        const embedded_model_t* embedded) {
+    int k;
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    model_t* model = &neural_network[target];
+    int num_sinapsi = model->num_hidden + 1;
+
+    if (embedded->num_layers != num_sinapsi + 1)
+        return ERROR;
+
+    sinapsi[0] = &model->in_S;
+    for (k = 0; k < model->num_hidden-1; ++k)
+        sinapsi[k+1] = &model->hid_S[k];
+    sinapsi[num_sinapsi-1] = &model->out_S;
+
+    for (k = 0; k < num_sinapsi; ++k) {
+        if (embedded->size[k] != sinapsi[k]->card_in || 
+                                embedded->size[k+1] != sinapsi[k]->card_out)
+            return ERROR;
+
+        /**< The forward pass only reads the weights. */
+        sinapsi[k]->weights = (float*) embedded->weights[k];
+        sinapsi[k]->bias = (float*) embedded->bias[k];
+    }
+
+    return SUCCESS;
+}
+#endif
+
+/**
+* @brief Loading state of a model.
+*
+* The state is written once by the thread which loads the model, a reader 
+* which sees MODEL_READY also sees all the weights of the model.
+*
+* @param  target is the index of the model in the registry
+* @return MODEL_LOADING, MODEL_READY or MODEL_FAILED
+*/
+static int model_state(int target) {
+    return __atomic_load_n(&neural_network[target].state, __ATOMIC_ACQUIRE);
+}
+
+/**
+* @brief Publish the loading state of a model and wake up its waiters.
+*
+* @param  target is the index of the model in the registry
+* @param  state is MODEL_READY or MODEL_FAILED
+*/
+static void set_model_state(int target, int state) {
+    pthread_mutex_lock(&load_mutex);
+    __atomic_store_n(&neural_network[target].state, state, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&load_cond);
+    pthread_mutex_unlock(&load_mutex);
+}
+
+/**
+* @brief Prepare the loaded weights of a model for the forward pass.
+*
+* The weights are pruned, then quantized if the model requires the int8 or 
+* the fp16 precision, the sinapsi with few non-zero weights are stored in 
+* CSR format and the dense hidden ones of a float model are packed in 
+* panels. At last the hidden pass is selected for the sinapsi which are 
+* still dense. The report and the hidden pass are the ones of the hooks.
+*
+* @param  model is the model whose float weights are loaded
+* @param  num_workers is the number of workers of the quantization report
+* @return NN_SUCCESS or the error code of init_networks
+*/
+static int prepare_model(model_t* model, int num_workers) {
+
+    int k;
+    sinapsi_t* sinapsi[MAX_HID_NUM+1];
+    int num_sinapsi = model_sinapsi(model, sinapsi);
+
+    /**< A reloaded model is a copy of the running one. */
+    for (k = 0; k < num_sinapsi; ++k) {
+        sinapsi[k]->row_start = NULL;
+        sinapsi[k]->p_weights = NULL;
+    }
+
+#ifndef NN_EMBEDDED_WEIGHTS
+    prune_model(model);
+#endif
+
+    if (model->precision != NN_FP32) {
+        if (quantize_model(model, model->precision) == ERROR)
+            return NN_ERROR_NO_MEMORY;
+        hooks->report(model, num_workers);
+    }
+
+    if (sparsify_model(model) == ERROR || pack_model(model) == ERROR ||
+                                                compact_model(model) == ERROR)
+        return NN_ERROR_NO_MEMORY;
+
+    hooks->select_pass(model);
+
+    return NN_SUCCESS;
+}
+
+/**
+* @brief Load a model of the registry and make it ready.
+*
+* The weights are read from the file of the model, unless they are linked
+* into the executable, then they are prepared by prepare_model. The state of
+* the model is published at the end, MODEL_FAILED if an error occurs.
+*
+* @param  target is the index of the model in the registry
+* @param  num_workers is the number of workers of the quantization report
+* @return NN_SUCCESS or the error code of init_networks
+*/
+static int load_model(network_target target, int num_workers) {
+
+    int result = NN_SUCCESS;
+    model_t* model = &neural_network[target];
+
+#ifndef NN_EMBEDDED_WEIGHTS
+    result = load_weights(target);
+#endif
+
+    if (result == NN_SUCCESS) {
+        model->precision = model_precision[target];
+        result = prepare_model(model, num_workers);
+    }
+
+    set_model_state(target, result == NN_SUCCESS ? MODEL_READY : 
+                                                                MODEL_FAILED);
+    return result;
+}
+
+#if NN_BACKGROUND_LOADING
+/**
+* @brief Background loading of the models.
+*
+* It loads in registry order every model but the first one, which is already
+* loaded by init_networks. The forward passes of the quantization reports 
+* use a single worker, so the pool stays free for the recognition.
+*
+* @param  arg is not used
+*/
+static void* loader_thread(void* arg) {
+
+    int i;
+
+    (void) arg;
+
+    for (i = 0; i < num_models; ++i) {
+        if (i == (int) first_model)
+            continue;
+
+        if (__atomic_load_n(&loader_quit, __ATOMIC_ACQUIRE))
+            set_model_state(i, MODEL_FAILED);
+        else if (load_model(i, 1) != NN_SUCCESS)
+            printf("Error loading the %s model\n", neural_network[i].name);
+    }
+
+    return NULL;
+}
+#endif
+
+/**
+* @brief Start the background loading of the models.
+*
+* The loader has the normal time-sharing policy, so it runs only on the CPU
+* time left by the real-time tasks. If the thread cannot be created the 
+* models are loaded by the caller.
+*
+* @return NN_SUCCESS or the error code of init_networks
+*/
+static int start_loader() {
+
+    int i, result;
+#if NN_BACKGROUND_LOADING
+    pthread_attr_t attr;
+    struct sched_param param;
+
+    loader_quit = 0;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+
+    loader_running = !pthread_create(&loader_tid, &attr, loader_thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (loader_running)
+        return NN_SUCCESS;
+#endif
+
+    for (i = 0; i < num_models; ++i) {
+        if (i != (int) first_model) {
+            result = load_model(i, neural_network[i].num_workers);
+            if (result != NN_SUCCESS)
+                return result;
+        }
+    }
+
+    return NN_SUCCESS;
+}
+
+/**
+* @brief Release the weights of a model.
+*
+* @param  target is the index of the model in the registry
+* @param  model are the weights to be released
+*/
+static void free_model(int target, model_t* model) {
+
+    free(model->arena);
+    model->arena = NULL;
+
+    free(model->q_arena);
+    model->q_arena = NULL;
+
+    free(model->s_arena);
+    model->s_arena = NULL;
+
+    free(model->p_arena);
+    model->p_arena = NULL;
+
+    /**< The registry slot is static, a reloaded model is not. */
+    if (model != &neural_network[target])
+        free(model);
+}
+
+#ifndef NN_EMBEDDED_WEIGHTS
+/**
+* @brief Check if a reloaded model has the structure of the running one.
+*
+* @param  a is the first model
+* @param  b is the second model
+* @return 1 if the name, the layers, the activation and the labels of the 
+*         two models are the same, 0 otherwise
+*/
+static int same_structure(const model_t* a, const model_t* b) {
+
+    int k;
+
+    if (strcasecmp(a->name, b->name) != 0 || a->num_hidden != b->num_hidden ||
+            a->activation != b->activation ||
+            a->in_S.card_out != b->in_S.card_out ||
+            a->out_S.card_in != b->out_S.card_in ||
+            a->out_S.card_out != b->out_S.card_out)
+        return 0;
+
+    for (k = 0; k < a->num_hidden-1; ++k)
+        if (a->hid_S[k].card_out != b->hid_S[k].card_out)
+            return 0;
+
+    return memcmp(a->labels, b->labels, a->out_S.card_out) == 0;
+}
+
+/**
+* @brief Load the new weights of a model into a fresh arena.
+*
+* The model already has the structure and the file of the running one, the
+* header of the file, if any, must describe the same structure.
+*
+* @param  model is the fresh model
+* @return NN_SUCCESS or the error code of init_networks
+*/
+static int load_fresh_model(model_t* model) {
+
+    FILE *fp;
+    int result;
+    model_t header;             /**< Model described by the new header. */
+
+    fp = fopen(model->file, "r");
+    if (fp == NULL)
+        return NN_ERROR_NO_FILE;
+
+    /**< Only the files with a header have the weights after offset 0. */
+    if (model->offset > 0) {
+        memset(&header, 0, sizeof(model_t));
+        if (read_model_header(fp, &header) != SUCCESS || 
+                                            !same_structure(&header, model)) {
+            fclose(fp);
+            return NN_ERROR_READING_FILE;
+        }
+        model->offset = ftell(fp);
+    }
+
+    if (alloc_model(model) == ERROR) {
+        fclose(fp);
+        return NN_ERROR_NO_MEMORY;
+    }
+
+    result = load_model_file(fp, model);
+    fclose(fp);
+
+    if (result == ERROR)
+        return NN_ERROR_READING_FILE;
+
+    return prepare_model(model, 1);
+}
+#endif
+
+#if NN_HOT_RELOAD && !defined(NN_EMBEDDED_WEIGHTS)
+/**
+* @brief Reload of the models whose files are rewritten.
+*
+* It waits the inotify events of the model directory and of the working
+* directory, a file closed after writing or moved in place which is the file
+* of a model triggers its reload.
+*
+* @param  arg is not used
+*/
+static void* watcher_thread(void* arg) {
+
+    int i, length, offset;
+    char buffer[WATCH_BUFFER] 
+                    __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[MODEL_FILE_SIZE];     /**< Path of the changed file. */
+    struct inotify_event* event;
+    struct pollfd poll_fd = { watch_fd, POLLIN, 0 };
+
+    (void) arg;
+
+    while (!__atomic_load_n(&watcher_quit, __ATOMIC_ACQUIRE)) {
+
+        if (poll(&poll_fd, 1, WATCH_PERIOD_MS) <= 0)
+            continue;
+
+        length = read(watch_fd, buffer, WATCH_BUFFER);
+
+        for (offset = 0; offset < length; offset += 
+                                sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event*) (buffer + offset);
+            if (event->len == 0)
+                continue;
+
+            if (event->wd == watch_dir_wd)
+                snprintf(path, MODEL_FILE_SIZE, "%s/%s", NN_MODEL_DIR, 
+                                                                event->name);
+            else
+                snprintf(path, MODEL_FILE_SIZE, "%s", event->name);
+
+            for (i = 0; i < num_models; ++i) {
+                if (strcmp(path, neural_network[i].file) != 0)
+                    continue;
+
+                if (reload_model(i) == NN_SUCCESS)
+                    printf("Model %s reloaded\n", neural_network[i].name);
+                else
+                    printf("Error reloading the %s model\n", 
+                                                    neural_network[i].name);
+            }
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+/**
+* @brief Start the watch of the model files.
+*
+* The files of the registry are in the model directory or in the working 
+* directory, both are watched. If inotify is not available the models are
+* not reloaded automatically, reload_model can still be called.
+*/
+static void start_watcher() {
+#if NN_HOT_RELOAD && !defined(NN_EMBEDDED_WEIGHTS)
+    pthread_attr_t attr;
+    struct sched_param param;
+
+    watcher_quit = 0;
+
+    watch_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (watch_fd < 0)
+        return;
+
+    watch_dir_wd = inotify_add_watch(watch_fd, NN_MODEL_DIR, 
+                                                IN_CLOSE_WRITE | IN_MOVED_TO);
+    inotify_add_watch(watch_fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    param.sched_priority = 0;
+    pthread_attr_setschedparam(&attr, &param);
+
+    watcher_running = !pthread_create(&watcher_tid, &attr, watcher_thread, 
+                                                                        NULL);
+    pthread_attr_destroy(&attr);
+
+    if (!watcher_running) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+#endif
+}
+
+/**
+* @brief Stop the watch of the model files.
+*/
+static void stop_watcher() {
+    if (watcher_running) {
+        __atomic_store_n(&watcher_quit, 1, __ATOMIC_RELEASE);
+        pthread_join(watcher_tid, NULL);
+        watcher_running = 0;
+    }
+
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+        watch_dir_wd = -1;
+    }
+}
+
+/**
+* GLOBAL FUNCTIONS
+*/
+
+/**
+* @brief Round a size up to a multiple of the cache line.
+*
+* @param  size is the size in bytes to be rounded
+* @return the rounded size
+*/
+size_t align_size(size_t size) {
+    return (size + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+}
+
+/**
+* @brief Take a cache-line-aligned block from an arena.
+*
+* @param  arena is the memory from which the block is taken
+* @param  offset is the first free byte of the arena, it is moved forward
+* @param  size is the size in bytes of the block
+* @return pointer to the block
+*/
+void* arena_take_bytes(char* arena, size_t* offset, size_t size) {
+    void* block = arena + *offset;
+
+    *offset += align_size(size);
+
+    return block;
+}
+
+/**
+* @brief Take a cache-line-aligned array of floats from an arena.
+*
+* @param  arena is the memory from which the array is taken
+* @param  offset is the first free byte of the arena, it is moved forward
+* @param  count is the number of floats of the array
+* @return pointer to the array
+*/
+float* arena_take(char* arena, size_t* offset, int count) {
+    return (float*) arena_take_bytes(arena, offset, count * sizeof(float));
+}
+
+/**
+* @brief Select the precision of a model.
+*
+* It must be called before init_networks, which quantizes the float weights
+* of the models that require the int8 or the fp16 precision.
+*
+* @param  target specificy the model {DIGITS, LETTERS, MIXED}
+* @param  precision is the precision of the model {NN_FP32, NN_INT8, NN_FP16}
+*/
+void set_model_precision(network_target target, nn_precision precision) {
+    model_precision[target] = precision;
+}
+
+/**
+* @brief Number of models of the registry.
+*
+* @return the number of models loaded by init_networks
+*/
+int count_models() {
+    return num_models;
+}
+
+/**
+* @brief Index of a model of the registry.
+*
+* The name is compared ignoring the case, so "digits" is the DIGITS model.
+*
+* @param  name is the name of the model
+* @return the index of the model, -1 if there is no model with that name
+*/
+int find_model(const char* name) {
+
+    int i;
+
+    for (i = 0; i < num_models; ++i)
+        if (strcasecmp(name, neural_network[i].name) == 0)
+            return i;
+
+    return -1;
+}
+
+/**
+* @brief Name of a model of the registry.
+*
+* @param  model is the index of the model
+* @return the name of the model, NULL if the index is not valid
+*/
+const char* model_name(int model) {
+    if (model < 0 || model >= num_models)
+        return NULL;
+
+    return neural_network[model].name;
+}
+
+/**
+* @brief Register the models and load the first one.
+*
+* The models of the NN_MODEL_DIR directory are registered first, then the 
+* default models not found there are registered with their legacy files.
+* Only the first model is loaded before the function returns, the other ones
+* are loaded by models_start. If NN_EMBEDDED_WEIGHTS is defined the models 
+* use the weights linked into the executable (see nn_weights.h) and no file
+* is read.
+*
+* @param  first is the model needed by the first frame {DIGITS, LETTERS, 
+*         MIXED}
+* @param  available is the number of workers of the pool
+* @param  forward are the functions of the forward pass
+* @return NN_SUCCESS or the error code of init_networks
+*/
+int models_init(network_target first, int available, 
+                                            const model_hooks_t* forward) {
+    int i;
+    int result;
+
+    hooks = forward;
+
+    /**< Initilize all 3 different model structures. */
+    num_models = MIXED + 1;
+    for (i = DIGITS; i <= MIXED; ++i)
+        init_default_model(i);
+
+#ifdef NN_EMBEDDED_WEIGHTS
+    /**< The weights are linked into the executable, nothing to read. */
+    if (alloc_model(&neural_network[DIGITS]) == ERROR || 
+                alloc_model(&neural_network[LETTERS]) == ERROR ||
+                alloc_model(&neural_network[MIXED]) == ERROR)
+        return NN_ERROR_NO_MEMORY;
+
+    if (embed_network(DIGITS, &nn_embedded_digits) == ERROR ||
+                embed_network(LETTERS, &nn_embedded_letters) == ERROR ||
+                embed_network(MIXED, &nn_embedded_mixed) == ERROR)
+        return NN_ERROR_READING_FILE;
+
+    for (i = DIGITS; i <= MIXED; ++i)
+        neural_network[i].registered = 1;
+#else
+    /**< Only the headers and the sizes are read here. */
+    result = register_model_dir(NN_MODEL_DIR);
+    if (result != NN_SUCCESS)
+        return result;
+
+    for (i = DIGITS; i <= MIXED; ++i) {
+        if (!neural_network[i].registered) {
+            result = register_default_model(i);
+            if (result != NN_SUCCESS)
+                return result;
+        }
+    }
+#endif
+
+    for (i = 0; i < num_models; ++i) {
+        neural_network[i].num_workers = model_workers(&neural_network[i], 
+                                                                    available);
+        hooks->select_pass(&neural_network[i]);
+        neural_network[i].state = MODEL_LOADING;
+        live_model[i] = &neural_network[i];
+    }
+
+    first_model = first;
+    result = load_model(first_model, neural_network[first_model].num_workers);
+
+    return result;
+}
+
+/**
+* @brief Start the loading of the other models and the watch of the model 
+* files.
+*
+* @return NN_SUCCESS or the error code of init_networks
+*/
+int models_start() {
+
+    int result;
+
+    result = start_loader();
+    if (result != NN_SUCCESS)
+        return result;
+
+    start_watcher();
+
+    return NN_SUCCESS;
+}
+
+/**
+* @brief Registry slot of a model.
+*
+* Its sizes, name and labels can be read at any time, a reloaded copy of 
+* the weights keeps them (see live_weights).
+*
+* @param  model is the index of the model in the registry
+* @return the model
+*/
+const model_t* registry_model(int model) {
+    return &neural_network[model];
+}
+
+/**
+* @brief Weights used by the inferences of a model.
+*
+* They must be read inside an inference, reload_model releases the replaced
+* weights only after the inferences which started before the swap.
+*
+* @param  model is the index of the model in the registry
+* @return the current weights of the model
+*/
+const model_t* live_weights(int model) {
+    return __atomic_load_n(&live_model[model], __ATOMIC_SEQ_CST);
+}
+
+/**
+* @brief Model loaded by models_init.
+*
+* @return the first model, which is always ready
+*/
+network_target fallback_model() {
+    return first_model;
+}
+
+/**
+* @brief Wait the end of the loading of all the models.
+*
+* @return NN_SUCCESS if every model is ready, NN_ERROR_READING_FILE if the
+*         loading of one of them failed
+*/
+int wait_models() {
+
+    int i;
+    int result = NN_SUCCESS;
+
+    for (i = 0; i < num_models; ++i)
+        if (!wait_model(i, -1))
+            result = NN_ERROR_READING_FILE;
+
+    return result;
+}
+
+/**
+* @brief Check if a model can be used.
+*
+* @param  model is the index of the model in the registry
+* @return 1 if the model is loaded, 0 if it is still loading or it failed
+*/
+int model_ready(int model) {
+    if (model < 0 || model >= num_models)
+        return 0;
+
+    return model_state(model) == MODEL_READY;
+}
+
+/**
+* @brief Wait a model which is being loaded.
+*
+* @param  target is the index of the model in the registry
+* @param  wait_ms is the max waiting time in milliseconds, -1 to wait until
+*         the loading ends
+* @return 1 if the model is ready, 0 otherwise
+*/
+int wait_model(int target, int wait_ms) {
+
+    struct timespec deadline;
+    int state = model_state(target);
+
+    if (state != MODEL_LOADING || wait_ms == 0)
+        return state == MODEL_READY;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&load_mutex);
+    while ((state = model_state(target)) == MODEL_LOADING) {
+        if (wait_ms < 0)
+            pthread_cond_wait(&load_cond, &load_mutex);
+        else if (pthread_cond_timedwait(&load_cond, &load_mutex, &deadline))
+            break;
+    }
+    pthread_mutex_unlock(&load_mutex);
+
+    return state == MODEL_READY;
+}
+
+/**
+* @brief Model used in place of a requested one.
+*
+* A model which is still loading is waited for NN_LOAD_WAIT_MS, then the 
+* first model, which is always ready, is used in its place.
+*
+* @param  target is the requested model
+* @return the requested model if it is ready, the first model otherwise
+*/
+network_target usable_model(network_target target) {
+    if (wait_model(target, NN_LOAD_WAIT_MS))
+        return target;
+
+    return first_model;
+}
+
+/**
+* @brief Replace the weights of a model with the ones of its file.
+*
+* The new weights are loaded in a fresh arena while the recognition goes on
+* with the old ones, then they are published by an atomic swap of the 
+* pointer of the model. The old weights are released after the end of the
+* inferences which use them. The structure of the model cannot change, the
+* model must be ready and its weights must not be linked into the 
+* executable.
+*
+* @param  model is the index of the model in the registry
+* @return NN_SUCCESS or the error code of init_networks
+*/
+int reload_model(int model) {
+#ifdef NN_EMBEDDED_WEIGHTS
+    (void) model;
+
+    return NN_ERROR_NO_FILE;
+#else
+    int result;
+    model_t *old, *fresh;
+
+    if (model < 0 || model >= num_models || 
+                                        model_state(model) != MODEL_READY)
+        return NN_ERROR_READING_FILE;
+
+    pthread_mutex_lock(&reload_mutex);
+
+    old = live_model[model];
+
+    fresh = (model_t*) malloc(sizeof(model_t));
+    if (fresh == NULL) {
+        pthread_mutex_unlock(&reload_mutex);
+        return NN_ERROR_NO_MEMORY;
+    }
+
+    *fresh = *old;
+    ++fresh->generation;
+    fresh->arena = NULL;
+    fresh->q_arena = NULL;
+    fresh->s_arena = NULL;
+    fresh->p_arena = NULL;
+
+    result = load_fresh_model(fresh);
+    if (result != NN_SUCCESS) {
+        free(fresh->arena);
+        free(fresh->q_arena);
+        free(fresh->s_arena);
+        free(fresh->p_arena);
+        free(fresh);
+        pthread_mutex_unlock(&reload_mutex);
+        return result;
+    }
+
+    __atomic_store_n(&live_model[model], fresh, __ATOMIC_SEQ_CST);
+
+    hooks->wait_readers();
+    free_model(model, old);
+
+    pthread_mutex_unlock(&reload_mutex);
+
+    return NN_SUCCESS;
+#endif
+}
+
+/**
+* @brief Release the memory of the models of the registry.
+*
+* The watch of the model files and the background loading are stopped 
+* before, the model being loaded is completed.
+*/
+void models_free() {
+
+    int i;
+
+    stop_watcher();
+
+    if (loader_running) {
+        __atomic_store_n(&loader_quit, 1, __ATOMIC_RELEASE);
+        pthread_join(loader_tid, NULL);
+        loader_running = 0;
+    }
+
+    for (i = 0; i < num_models; ++i) {
+        if (live_model[i] != &neural_network[i])
+            free_model(i, live_model[i]);
+        free_model(i, &neural_network[i]);
+        live_model[i] = NULL;
+
+        neural_network[i].registered = 0;
+        neural_network[i].state = MODEL_LOADING;
+    }
+}
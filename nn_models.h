@@ -0,0 +1,206 @@
+#ifndef NN_MODELS_H
+#define NN_MODELS_H
+
+/**
+* @file nn_models.h
+* @author Gianluca D'Amico
+* @brief File containing the registry of the neural network models
+*
+* HANDLING MODEL REGISTRY: It manages the weights of the models shared by
+* the inference contexts of nn_handler.
+*
+* The models are registered from NN_MODEL_DIR and from the legacy files of
+* the default ones, then their weights are loaded, pruned, quantized, 
+* sparsified and packed for the forward pass, the first one by models_init
+* and the others by a background thread. The weights used by the inferences
+* are read through live_weights, reload_model replaces them with an atomic
+* swap. The registry does not see the layers of the contexts: the forward 
+* pass gives it the functions it needs through model_hooks_t.
+*
+*/
+
+#include <stddef.h>
+
+#include "nn_handler.h"
+
+/**
+* GLOBAL DATA
+*/
+
+/**< Neural network model size. */
+#define INPUT_SIZE INPUT_DIM * INPUT_DIM     /**< Input layer size. */
+
+#define DIGIT_HID_SIZE_1    64      /**< First hidden size of digits. */
+#define DIGIT_HID_SIZE_2    32      /**< Second hidden size of digits. */
+#define DIGIT_OUTPUT_SIZE   10      /**< Output layer size of digits. */
+#define LET_HID_SIZE        128     /**< Hidden layer size of letters. */
+#define LETTER_OUTPUT_SIZE  26      /**< Output layer size of letters. */
+#define MIX_HID_SIZE        512     /**< Hidden layer size of mixed. */
+#define MIXED_OUTPUT_SIZE   47      /**< Output layer size of mixed. */
+
+#if MIXED_OUTPUT_SIZE > NN_MAX_OUTPUTS
+#error "NN_MAX_OUTPUTS is smaller than the output layer of a model"
+#endif
+
+#define MAX_HID_NUM  6              /**< Max number of hidden layers. */
+
+#define MODEL_NAME_SIZE 16          /**< Max length of a model name, '\0'
+                                                                included. */
+#define MODEL_FILE_SIZE 512         /**< Max length of the path of a model
+                                                                    file. */
+
+#define CACHE_LINE   64             /**< Alignment of the model arenas. */
+
+#define MODEL_LOADING 0     /**< The weights of the model are being loaded. */
+#define MODEL_READY   1     /**< The model can be used. */
+#define MODEL_FAILED -1     /**< The weights of the model are not valid. */
+
+/**
+* GLOBAL STRUCTS
+*/
+
+/**
+* NEURAL NETWORK SINAPSI 
+*/
+
+/**< Sinapsi between two layers, sized exactly on its cardinalities. The rows
+* of weights (one for each outgoing neuron) are stored back to back inside the
+* arena of the model, so weights[i * card_in + j] connects the incoming neuron
+* j to the outgoing neuron i. The input sinapsi is stored by columns instead,
+* weights[j * card_out + i], so that the contribution of a single input pixel
+* is a contiguous vector. 
+*
+* A sinapsi with few non-zero weights is stored in CSR format instead: the
+* non-zero values of the stored row r (an outgoing neuron, or an input pixel
+* for the input sinapsi) are the ones from row_start[r] to row_start[r+1], 
+* with their position in the row in col_index. */
+typedef struct {
+    float *weights;     /**< Weights of the connection.*/
+    float *bias;        /**< Bias of the connection. */
+
+    signed char *q_weights; /**< Int8 weights, same layout of weights.*/
+    float *q_scale;         /**< Scale of the int8 weights of each row.*/
+
+    unsigned short *h_weights;  /**< Fp16 weights, same layout of weights.*/
+
+    int *row_start;         /**< First value of each stored row, NULL if the
+                                                        sinapsi is dense.*/
+    short *col_index;       /**< Position in its row of each value.*/
+    float *s_weights;       /**< Float values, fp16 ones widened.*/
+    signed char *sq_weights;/**< Int8 values, q_scale is kept.*/
+
+    float *p_weights;       /**< Float weights packed in panels of rows, 
+                                        NULL if the sinapsi is not packed.*/
+
+    int card_in;   /**< Number of incoming neurons connetcted to the sinapsi.*/
+    int card_out;  /**< Number of outgoing neurons connetcted to the sinapsi.*/
+} sinapsi_t;
+
+/**
+* NEURAL NETWORK MODEL
+*/
+
+/**< Activation function of the hidden layers.*/
+typedef enum {
+    ACT_LOGISTIC = 0,   /**< 1 / (1 + exp(-z)).*/
+    ACT_RELU            /**< max(0, z).*/
+} activation_t;
+
+struct network_s;
+
+/**< Hidden and output layers of the forward pass of a worker.*/
+typedef void (*hidden_pass_t)(struct network_s*, int, int);
+
+/**< Weights of each neural network model, read-only after init_networks.*/
+typedef struct {
+    /**< Sinapsi from first layer to first hidden one.*/
+    sinapsi_t in_S;
+    /**< Sinapsi between consecutive hidden layers.*/
+    sinapsi_t hid_S[MAX_HID_NUM-1];
+    /**< Sinapsi from last hidden layer to output one.*/
+    sinapsi_t out_S;
+
+    int num_hidden;     /**< Number of hidden layers of the model.*/
+    int num_workers;    /**< Workers sharing the forward pass.*/
+    hidden_pass_t hidden_pass;  /**< Float pass of the hidden layers.*/
+
+    char name[MODEL_NAME_SIZE];     /**< Name of the model.*/
+    char labels[NN_MAX_OUTPUTS];    /**< Character of each output neuron.*/
+    activation_t activation;        /**< Activation of the hidden layers.*/
+    int registered;                 /**< 1 if the slot has a model.*/
+
+    char file[MODEL_FILE_SIZE]; /**< File of the weights.*/
+    long offset;                /**< Position of the first weight.*/
+    int state;                  /**< MODEL_LOADING, MODEL_READY or 
+                                    MODEL_FAILED, see model_state.*/
+
+    nn_precision precision; /**< Precision used by the forward pass.*/
+    unsigned int generation;/**< Incremented by each reload of the 
+                                                                weights.*/
+
+    char *arena;        /**< Cache-line-aligned memory of the weights.*/
+    size_t arena_size;  /**< Size in bytes of the arena.*/
+
+    char *q_arena;      /**< Cache-line-aligned memory of the int8 or fp16 
+                                                                    weights.*/
+    size_t q_arena_size;/**< Size in bytes of the int8 or fp16 arena.*/
+
+    char *s_arena;      /**< Cache-line-aligned memory of the sparse 
+                                                                    weights.*/
+    size_t s_arena_size;/**< Size in bytes of the sparse arena.*/
+
+    char *p_arena;      /**< Cache-line-aligned memory of the weights 
+                                                        packed in panels.*/
+    size_t p_arena_size;/**< Size in bytes of the packed arena.*/
+} model_t;
+
+/**< Functions of the forward pass used by the registry. */
+typedef struct {
+    /**< Compare a quantized model with its float weights, before they are
+    * sparsified. */
+    void (*report)(const model_t* model, int num_workers);
+    /**< Select the hidden pass of a model. */
+    void (*select_pass)(model_t* model);
+    /**< Wait the end of the inferences started on the replaced weights. */
+    void (*wait_readers)(void);
+} model_hooks_t;
+
+/**
+* GLOBAL FUNCTION PROTOTYPES
+*/
+
+/**< Round a size up to a multiple of the cache line. */
+size_t align_size(size_t size);
+
+/**< Take a cache-line-aligned block from an arena. */
+void* arena_take_bytes(char* arena, size_t* offset, size_t size);
+
+/**< Take a cache-line-aligned array of floats from an arena. */
+float* arena_take(char* arena, size_t* offset, int count);
+
+/**< Register the models and load the first one on the given workers. */
+int models_init(network_target first, int available, 
+                                            const model_hooks_t* hooks);
+
+/**< Load the other models in background and watch the model files. */
+int models_start();
+
+/**< Stop the loading and the watch, release the weights of the models. */
+void models_free();
+
+/**< Registry slot of a model, its weights belong to the first load. */
+const model_t* registry_model(int model);
+
+/**< Weights used by the inferences of a model, see reload_model. */
+const model_t* live_weights(int model);
+
+/**< Wait a model which is being loaded, return 1 if it is ready. */
+int wait_model(int model, int wait_ms);
+
+/**< Model used in place of a requested one which is not ready. */
+network_target usable_model(network_target target);
+
+/**< Model loaded by models_init, always ready. */
+network_target fallback_model();
+
+#endif
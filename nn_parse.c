@@ -0,0 +1,61 @@
+/**
+* @file nn_parse.c
+* @author Gianluca D'Amico
+* @brief File containing the parser of the values of the weights files
+*
+* HANDLING WEIGHTS FILES: It reads the weights and the bias written by
+* save_file of MLP/NN.c.
+*
+* atof and strtof read the decimal separator of the current locale, which
+* is '.' in the C locale of a program that never calls setlocale: a stock
+* value like -0,3101 would stop at the comma and become -0. The separator
+* of the value is replaced by the one of the locale before strtof, so the
+* parsing does not depend on the locale of the file nor on the one of the
+* application.
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+
+#include "nn_parse.h"
+
+/**
+* GLOBAL FUNCTIONS
+*/
+
+/**
+* @brief Read the next value of a weights file.
+*
+* The characters are read until the next '_' or end of line. The whole
+* value must be a number, with ',' or '.' as decimal separator.
+*
+* @param  fp is the weights file
+* @param  value is the read value
+* @return 0 if a value is read, -1 if the file ends or the value is not a
+*         number
+*/
+int read_weight(FILE* fp, float* value) {
+
+    int ch;
+    int char_count = 0;                     /**< Characters read. */
+    char string[WEIGHT_MAX_CHARS + 1];      /**< Characters of the value. */
+    char point = localeconv()->decimal_point[0];
+    char* end;
+
+    while ((ch = fgetc(fp)) != '_' && ch != '\n') {
+        if (ch == EOF || char_count == WEIGHT_MAX_CHARS)
+            return -1;
+
+        string[char_count++] = (ch == ',' || ch == '.') ? point : ch;
+    }
+
+    if (char_count == 0)
+        return -1;
+
+    string[char_count] = '\0';
+    *value = strtof(string, &end);
+
+    return (*end == '\0') ? 0 : -1;
+}
@@ -0,0 +1,31 @@
+#ifndef NN_PARSE_H
+#define NN_PARSE_H
+
+#include <stdio.h>
+
+/**
+* @file nn_parse.h
+* @author Gianluca D'Amico
+* @brief File containing the parser of the values of the weights files
+*
+* HANDLING WEIGHTS FILES: It reads the weights and the bias written by
+* save_file of MLP/NN.c, it is shared by the loader of nn_models.c and by
+* weights_to_c so the two always compute the same floats.
+*
+* The values of a row are separated by '_' and the last one ends the line.
+* save_file prints them with the decimal separator of the locale of the
+* training machine, so the stock files use a comma (-0,3101): both ',' and
+* '.' are accepted whatever locale the application runs in.
+*
+*/
+
+#define WEIGHT_MAX_CHARS 32     /**< Max characters of a value of the file. */
+
+/**
+* GLOBAL FUNCTION PROTOTYPES
+*/
+
+/**< Read the next value of a weights file, return 0 or -1 on error. */
+int read_weight(FILE* fp, float* value);
+
+#endif
@@ -0,0 +1,268 @@
+/**
+* @file nn_pool.c
+* @author Gianluca D'Amico
+* @brief File containing the worker pool of the neural network
+*
+* HANDLING INFERENCE WORKERS: It manages the threads which share the forward
+* pass of a large model.
+*
+* The helpers wait for a job on a condition variable, so they do not use the
+* cores between two inferences. Inside a job the layers are synchronized by a
+* spinning barrier, which costs much less than a sleep and a wake up. Since
+* the helpers run with the real-time priority of the caller, a worker spins
+* for a bounded number of iterations and then yields the core, so a worker
+* sharing its core with another one cannot stall the barrier for a whole
+* round-robin slice.
+*
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "nn_pool.h"
+
+/**
+* LOCAL DATA
+*/
+
+#define MAX_WORKERS 8       /**< Max number of workers, caller included. */
+#define SPIN_LIMIT  4096    /**< Spins of the barrier before a yield. */
+
+/**
+* LOCAL STRUCTS
+*/
+
+/**< State of the pool, shared by all the workers. */
+typedef struct {
+    pthread_t tid[MAX_WORKERS];     /**< Helper threads, 0 is unused.*/
+    int num_workers;                /**< Workers available, caller included.*/
+
+    pthread_mutex_t run_mutex;      /**< One job at time.*/
+    pthread_mutex_t mutex;          /**< Protects the fields of the job.*/
+    pthread_cond_t start;           /**< Signaled when a job is run.*/
+
+    void (*job)(void*, int, int);   /**< Job of the current run.*/
+    void* arg;                      /**< Argument of the job.*/
+    int num_active;                 /**< Workers of the current run.*/
+    unsigned int generation;        /**< Counter of the runs.*/
+    int quit;                       /**< 1 when the helpers must exit.*/
+
+    int barrier_count;              /**< Workers arrived at the barrier.*/
+    unsigned int barrier_gen;       /**< Counter of the completed barriers.*/
+} pool_t;
+
+static pool_t pool = {
+    .num_workers = 1,
+    .run_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER
+};
+
+/**
+* LOCAL FUNCTIONS
+*/
+
+/**
+* @brief Hint to the core that the thread is spinning.
+*/
+static inline void cpu_relax() {
+#if defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+* @brief Body of a helper thread.
+*
+* It sleeps until a new run starts, then it computes the job if it is one of
+* the active workers of the run and it waits the others on the barrier.
+*
+* @param  arg is the index of the worker
+*/
+static void* worker_thread(void* arg) {
+
+    int id = (int) (long) arg;
+    unsigned int seen = 0;          /**< Last run executed. */
+    void (*job)(void*, int, int);
+    void* job_arg;
+    int num_active;
+
+    for (;;) {
+        pthread_mutex_lock(&pool.mutex);
+        while (pool.generation == seen && !pool.quit)
+            pthread_cond_wait(&pool.start, &pool.mutex);
+
+        if (pool.quit) {
+            pthread_mutex_unlock(&pool.mutex);
+            break;
+        }
+
+        seen = pool.generation;
+        job = pool.job;
+        job_arg = pool.arg;
+        num_active = pool.num_active;
+        pthread_mutex_unlock(&pool.mutex);
+
+        if (id < num_active) {
+            job(job_arg, id, num_active);
+            pool_barrier(num_active);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+* GLOBAL FUNCTIONS
+*/
+
+/**
+* @brief Create the helper threads.
+*
+* The helper i is pinned to the core i, the caller of pool_run is left where
+* the scheduler puts it. The helpers use the round-robin policy with the
+* given priority, if it is not permitted they use the default one. At most
+* one worker for each online core is created.
+*
+* @param  num_workers is the number of requested workers, caller included
+* @param  priority is the real-time priority of the helpers
+* @return the number of available workers, 1 if no helper has been created
+*/
+int pool_init(int num_workers, int priority) {
+
+    int i;
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_attr_t attr;
+    struct sched_param param;
+    cpu_set_t cpus;
+
+    if (num_workers > MAX_WORKERS)
+        num_workers = MAX_WORKERS;
+    if (num_cores > 0 && num_workers > num_cores)
+        num_workers = num_cores;
+
+    for (i = 1; i < num_workers; ++i) {
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_RR);
+        param.sched_priority = priority;
+        pthread_attr_setschedparam(&attr, &param);
+
+        CPU_ZERO(&cpus);
+        CPU_SET(i, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+        if (pthread_create(&pool.tid[i], &attr, worker_thread,
+                                                        (void*) (long) i)) {
+            /**< Not a real-time process, keep only the affinity. */
+            pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+            if (pthread_create(&pool.tid[i], &attr, worker_thread,
+                                                        (void*) (long) i)) {
+                pthread_attr_destroy(&attr);
+                break;
+            }
+        }
+
+        pthread_attr_destroy(&attr);
+    }
+
+    pool.num_workers = i;
+
+    return pool.num_workers;
+}
+
+/**
+* @brief Run a job on the workers of the pool.
+*
+* The job is called once by each worker with its index and the number of
+* workers of the run, the function returns when all of them have finished.
+* With a single worker the job is called directly by the caller.
+*
+* @param  job is the function computed by each worker
+* @param  arg is the argument passed to the job
+* @param  num_workers is the number of workers of the run
+*/
+void pool_run(void (*job)(void*, int, int), void* arg, int num_workers) {
+
+    if (num_workers > pool.num_workers)
+        num_workers = pool.num_workers;
+
+    if (num_workers <= 1) {
+        job(arg, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.run_mutex);
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.job = job;
+    pool.arg = arg;
+    pool.num_active = num_workers;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.mutex);
+
+    job(arg, 0, num_workers);
+    pool_barrier(num_workers);
+
+    pthread_mutex_unlock(&pool.run_mutex);
+}
+
+/**
+* @brief Barrier among the workers of the running job.
+*
+* The last worker which arrives resets the counter and starts a new barrier
+* generation, the others spin until the generation changes.
+*
+* @param  num_workers is the number of workers of the run
+*/
+void pool_barrier(int num_workers) {
+
+    int spins = 0;
+    unsigned int gen;
+
+    if (num_workers <= 1)
+        return;
+
+    gen = __atomic_load_n(&pool.barrier_gen, __ATOMIC_ACQUIRE);
+
+    if (__atomic_add_fetch(&pool.barrier_count, 1, __ATOMIC_ACQ_REL) ==
+                                                                num_workers) {
+        __atomic_store_n(&pool.barrier_count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&pool.barrier_gen, gen + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    while (__atomic_load_n(&pool.barrier_gen, __ATOMIC_ACQUIRE) == gen) {
+        if (++spins < SPIN_LIMIT) {
+            cpu_relax();
+        }
+        else {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+/**
+* @brief Stop and join the helper threads.
+*/
+void pool_free() {
+
+    int i;
+
+    pthread_mutex_lock(&pool.mutex);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (i = 1; i < pool.num_workers; ++i)
+        pthread_join(pool.tid[i], NULL);
+
+    pool.num_workers = 1;
+    pool.quit = 0;
+}
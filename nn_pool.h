@@ -0,0 +1,37 @@
+#ifndef NN_POOL_H
+#define NN_POOL_H
+
+/**
+* @file nn_pool.h
+* @author Gianluca D'Amico
+* @brief File containing the worker pool of the neural network
+*
+* HANDLING INFERENCE WORKERS: It manages the threads which share the forward
+* pass of a large model.
+*
+* The helper threads are created once, each one pinned to its own core, and
+* they sleep until a job is run. The caller of pool_run is the worker 0 and
+* the helpers are the workers 1 .. n-1, every worker computes its share of
+* each layer and waits for the others on a spinning barrier before the next
+* one. A job run with a single worker is a plain call, so the same code is
+* used by the small models.
+*
+*/
+
+/**
+* GLOBAL FUNCTION PROTOTYPES
+*/
+
+/**< Create the helper threads, return the number of available workers. */
+int pool_init(int num_workers, int priority);
+
+/**< Run job(arg, worker, num_workers) on num_workers workers and wait. */
+void pool_run(void (*job)(void*, int, int), void* arg, int num_workers);
+
+/**< Wait until all the num_workers workers of the running job arrive. */
+void pool_barrier(int num_workers);
+
+/**< Stop and join the helper threads. */
+void pool_free();
+
+#endif
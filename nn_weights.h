@@ -0,0 +1,44 @@
+#ifndef NN_WEIGHTS_H
+#define NN_WEIGHTS_H
+
+/**
+* @file nn_weights.h
+* @author Gianluca D'Amico
+* @brief File containing the models linked into the executable
+*
+* HANDLING EMBEDDED MODELS: It declares the weights of the 3 models converted
+* into C sources by weights_to_c.
+*
+* When the application is built with EMBED_WEIGHTS=1 the Makefile generates
+* nn_weights_digits.c, nn_weights_letters.c and nn_weights_mixed.c from the
+* weights files and defines NN_EMBEDDED_WEIGHTS, then init_networks uses
+* these arrays in place of the files. The weights are in the read-only data
+* of the executable: they are not parsed at startup, their pages are loaded
+* only when they are used and they are shared by all the processes running
+* the application.
+*
+*/
+
+#define EMBEDDED_MAX_LAYERS 8   /**< Max number of layers of a model. */
+
+/**
+* GLOBAL STRUCTS
+*/
+
+/**< Model generated by weights_to_c. */
+typedef struct {
+    int num_layers;                 /**< Number of layers, input included.*/
+    int size[EMBEDDED_MAX_LAYERS];  /**< Number of neurons of each layer.*/
+    const float* const* weights;    /**< Weights of each sinapsi.*/
+    const float* const* bias;       /**< Bias of each sinapsi.*/
+} embedded_model_t;
+
+/**
+* GLOBAL DATA
+*/
+
+extern const embedded_model_t nn_embedded_digits;   /**< Digits model.*/
+extern const embedded_model_t nn_embedded_letters;  /**< Letters model.*/
+extern const embedded_model_t nn_embedded_mixed;    /**< Mixed model.*/
+
+#endif
@@ -23,6 +23,8 @@
 *   - '+': increase dimension of ROI, moving it in the center;
 *   - '-': decrease dimension of ROI, moving it in the center;
 *
+*   - 'M': switch on or off the all models mode;
+*
 *   - 'ESC': close the application.
 *
 * Mouse interaction: it is possible to click on the model button to change 
@@ -61,6 +63,8 @@
 * - '+': increase dimension of ROI, moving it in the center;
 * - '-': decrease dimension of ROI, moving it in the center;
 *
+* - 'M': switch on or off the all models mode;
+*
 * - 'ESC': close the application.
 *
 * @param key Keyboard key pressed by the user.
@@ -236,6 +240,13 @@ int key_pressed(int key) {
             ROI_dim.centerY = CAM_MRG_TOP + CAM_HEIGHT/2;
             pthread_mutex_unlock(&ROI_dim_mutex);
             break;
+        case KEY_M:
+            /**< Compute all the models at every frame, or only the */
+            /**< requested one. */
+            pthread_mutex_lock(&actual_model_mutex);
+            all_models_mode = !all_models_mode;
+            pthread_mutex_unlock(&actual_model_mutex);
+            break;
         default:
             break;
     }
@@ -26,6 +26,8 @@
 *   - '+': increase dimension of ROI, moving it in the center;
 *   - '-': decrease dimension of ROI, moving it in the center;
 *
+*   - 'M': switch on or off the all models mode;
+*
 *   - 'ESC': close the application.
 *
 * Mouse interaction: it is possible to click on the model button to change 
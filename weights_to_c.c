@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nn_weights.h"
+#include "nn_parse.h"
+
+/**
+* @file weights_to_c.c
+* @author Gianluca D'Amico
+* @brief Tool converting the weights of a model into a C source file
+*
+* HANDLING EMBEDDED MODELS: It reads a weights file written by save_file of
+* MLP/NN.c and it prints on the standard output a C source file which defines
+* the same weights as static const float arrays, aligned on a cache line.
+*
+* Usage: weights_to_c <name> <weights file> <input> <hidden ...> <output>
+*
+* The sizes of the layers are not stored in the weights file, so they are
+* given on the command line, e.g. weights_to_c digits digits_2_64_32.txt 784
+* 64 32 10. The generated file defines the nn_embedded_<name> model declared
+* by nn_weights.h. The arrays have the layout used by nn_handler: the rows of
+* each sinapsi back to back, except the input sinapsi which is stored by
+* columns. The values are read by read_weight, the parser of the loader of
+* nn_models.c, and printed with 9 significant digits, so they are the same
+* floats the loader would compute. The header of a self-describing model 
+* file (see nn_handler.h) is skipped. A file holding more values than the
+* given layers is an error.
+*
+*/
+
+#define PER_LINE    6       /**< Values printed on each line of the output. */
+#define MAX_LINE    256     /**< Max characters of a line of the header. */
+
+/**
+* @brief Skip the header of a model file.
+*
+* If the file does not start with a header it is rewound.
+*
+* @param  fp is the weights file
+* @return 0 if the file is positioned on the first weight, -1 otherwise
+*/
+static int skip_header(FILE* fp) {
+
+    char line[MAX_LINE];
+
+    if (fgets(line, MAX_LINE, fp) == NULL || 
+                                    strncmp(line, "nn_model", 8) != 0) {
+        rewind(fp);
+        return 0;
+    }
+
+    while (fgets(line, MAX_LINE, fp) != NULL)
+        if (strncmp(line, "end", 3) == 0)
+            return 0;
+
+    return -1;
+}
+
+/**
+* @brief Print an array of floats as a static const definition.
+*
+* @param  name is the name of the model
+* @param  kind is the kind of the array ("w" or "b")
+* @param  index is the index of the sinapsi
+* @param  values is the array
+* @param  n is the number of values
+*/
+static void print_array(const char* name, const char* kind, int index,
+                                                const float* values, int n) {
+    int i;
+
+    printf("static const float %s_%s%d[%d] __attribute__((aligned(64))) = {",
+                                                        name, kind, index, n);
+
+    for (i = 0; i < n; ++i) {
+        if (i % PER_LINE == 0)
+            printf("\n   ");
+        printf(" %.9g,", values[i]);
+    }
+
+    printf("\n};\n\n");
+}
+
+/**
+* @brief Print the pointers to the arrays of each sinapsi.
+*
+* @param  name is the name of the model
+* @param  kind is the kind of the arrays ("w" or "b")
+* @param  num_sinapsi is the number of sinapsi
+*/
+static void print_table(const char* name, const char* kind,
+                                                            int num_sinapsi) {
+    int k;
+
+    printf("static const float* const %s_%s[%d] = {", name, kind, num_sinapsi);
+    for (k = 0; k < num_sinapsi; ++k)
+        printf(" %s_%s%d%s", name, kind, k, k < num_sinapsi - 1 ? "," : "");
+    printf(" };\n\n");
+}
+
+int main(int argc, char* argv[]) {
+
+    int i, j, k;
+    int num_layers = argc - 3;
+    int size[EMBEDDED_MAX_LAYERS];
+    int card_in, card_out;
+    float *weights, *bias;
+    float value;
+    FILE *fp;
+
+    if (num_layers < 2 || num_layers > EMBEDDED_MAX_LAYERS) {
+        fprintf(stderr, "Usage: %s <name> <weights file> <input> "
+                                    "<hidden ...> <output>\n", argv[0]);
+        return 1;
+    }
+
+    for (k = 0; k < num_layers; ++k) {
+        size[k] = atoi(argv[k + 3]);
+        if (size[k] <= 0) {
+            fprintf(stderr, "Wrong size of the layer %d!\n", k);
+            return 1;
+        }
+    }
+
+    fp = fopen(argv[2], "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening %s!\n", argv[2]);
+        return 1;
+    }
+
+    if (skip_header(fp)) {
+        fprintf(stderr, "Error reading %s!\n", argv[2]);
+        return 1;
+    }
+
+    printf("/* Generated by weights_to_c from %s, do not edit. */\n\n",
+                                                                    argv[2]);
+    printf("#include \"nn_weights.h\"\n\n");
+
+    for (k = 0; k < num_layers - 1; ++k) {
+
+        card_in = size[k];
+        card_out = size[k + 1];
+
+        weights = malloc((size_t) card_in * card_out * sizeof(float));
+        bias = malloc(card_out * sizeof(float));
+        if (weights == NULL || bias == NULL) {
+            fprintf(stderr, "Out of memory!\n");
+            return 1;
+        }
+
+        for (i = 0; i < card_out; ++i) {
+            for (j = 0; j < card_in; ++j) {
+                if (read_weight(fp, &value)) {
+                    fprintf(stderr, "Error reading %s!\n", argv[2]);
+                    return 1;
+                }
+
+                /**< The input sinapsi is stored by columns. */
+                if (k == 0)
+                    weights[j * card_out + i] = value;
+                else
+                    weights[i * card_in + j] = value;
+            }
+
+            if (read_weight(fp, &bias[i])) {
+                fprintf(stderr, "Error reading %s!\n", argv[2]);
+                return 1;
+            }
+        }
+
+        print_array(argv[1], "w", k, weights, card_in * card_out);
+        print_array(argv[1], "b", k, bias, card_out);
+
+        free(weights);
+        free(bias);
+    }
+
+    /**< The accuracy line which follows the weights is not a value. */
+    if (read_weight(fp, &value) == 0) {
+        fprintf(stderr, "%s holds more values than the layers!\n", argv[2]);
+        return 1;
+    }
+
+    fclose(fp);
+
+    print_table(argv[1], "w", num_layers - 1);
+    print_table(argv[1], "b", num_layers - 1);
+
+    printf("const embedded_model_t nn_embedded_%s = {\n", argv[1]);
+    printf("    %d,\n    {", num_layers);
+    for (k = 0; k < num_layers; ++k)
+        printf(" %d%s", size[k], k < num_layers - 1 ? "," : "");
+    printf(" },\n    %s_w,\n    %s_b\n};\n", argv[1], argv[1]);
+
+    return 0;
+}